@@ -0,0 +1,181 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Mock CMXS SDK.
+ *
+ * It has the part of the CMXS SDK API used by the examples, and moves the data locally,
+ * so the plugins can run and be measured without the Caton cloud:
+ *   - in process: the datagrams sent for a stream key go to the receivers of the same key.
+ *   - over loopback UDP, between processes: when CMXS_MOCK_UDP_PORT is set, senders send to
+ *     127.0.0.1:port and receivers read from that port, whatever the stream key is.
+ *
+ * It mirrors the API, not the ABI: everything must be built with these headers.
+ * See README.md for the environment variables.
+ */
+
+#ifndef CMXS_MOCK_CMXSSDK_H
+#define CMXS_MOCK_CMXSSDK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cmxs_type.h"
+
+typedef int32_t CMXSErr;
+
+enum {
+    CMXSERR_OK = 0,
+    CMXSERR_Again,
+    CMXSERR_BufferNotEnough,
+    CMXSERR_ServiceUnavailable,
+    CMXSERR_InvalidArgs,
+    CMXSERR_NotFound,
+    CMXSERR_NoMem,
+    CMXSERR_DataPortDetectFailed,
+    CMXSERR_NotReceiveDataInTime,
+    CMXSERR_ConnectFailed,
+};
+
+enum {
+    CMXSMSG_ServerConnected = 1,
+    CMXSMSG_ServerConnectFailed,
+    CMXSMSG_DataReady,
+    CMXSMSG_DataServerState,
+    CMXSMSG_DataServerLinkState,
+    CMXSMSG_Stat,
+    CMXSMSG_StreamParamChanged,
+    CMXSMSG_ConnectProgress,
+    CMXSMSG_ERROR,
+    CMXSMSG_WARNING,
+};
+
+enum {
+    CMXSLOG_LEVEL_F = 0,
+    CMXSLOG_LEVEL_E,
+    CMXSLOG_LEVEL_W,
+    CMXSLOG_LEVEL_I,
+    CMXSLOG_LEVEL_D,
+};
+
+typedef struct {
+    const char * mServer;
+    const char * mDeviceId;
+} CMXSConfig_t;
+
+typedef struct {
+    const char * mStreamkey;
+    uint32_t mConnectTimeOut;
+    uint32_t mNetDevicesCount;
+    const char ** mNetDevices;
+    const CMXSLinkDeviceType_t * mNetDeviceTypes;
+} CMXSStreamParam_t;
+
+typedef struct {
+    const char * mErrorInfo;
+} CMXSServerConnectFailedMsgData_t;
+
+typedef struct {
+    uint32_t mDataServerConnectState;
+} CMXSDataServerStateMsgData_t;
+
+typedef struct {
+    const char * mNetDevice;
+    uint32_t mDataServerConnectState;
+} CMXSDataServerLinkStateMsgData_t;
+
+typedef struct {
+    uint32_t mLastSize;
+} CMXSReceiveStatMsgData_t;
+
+typedef struct {
+    const char * mDesc;
+} CMXSStreamParamChangedMsgData_t;
+
+typedef struct {
+    const char * mDescription;
+} CMXSConnectProgressMsgData_t;
+
+typedef struct {
+    uint32_t mPortsCount;
+    const uint16_t * mPorts;
+} CMXSDataPortDetectFailedMsgData_t;
+
+typedef struct {
+    const char * mErrorInfo;
+} CMXSUnAvailableMsgData_t;
+
+typedef void (*CMXSLogCallback)(int level, const char * format, ...);
+
+extern "C" {
+const char * cmxssdk_error_str(int err);
+void cmxssdk_set_log_callback(CMXSLogCallback cb);
+const char * cmxssdk_version();
+}
+
+namespace caton {
+namespace cmxs {
+
+class CMXSListener {
+ public:
+    virtual ~CMXSListener() {}
+    virtual void onMessage(uint32_t message, uint32_t param1, const void * param2) noexcept = 0;
+};
+
+class CMXSSDK {
+ public:
+    static CMXSErr init(const CMXSConfig_t * config, CMXSListener * listener);
+    static void uninit();
+};
+
+class Sender {
+ public:
+    static Sender * create(const CMXSStreamParam_t * param, CMXSListener * listener);
+    // No message is sent to the listener once it returns.
+    static void destroy(Sender * sender);
+
+    CMXSErr send(const void * data, uint32_t len, int32_t timeoutMs);
+
+ protected:
+    Sender() {}
+    virtual ~Sender() {}
+};
+
+class Receiver {
+ public:
+    static Receiver * create(const CMXSStreamParam_t * param, CMXSListener * listener);
+    // No message is sent to the listener once it returns.
+    static void destroy(Receiver * receiver);
+
+    // Returns CMXSERR_Again if no datagram came in timeoutMs.
+    // If len is too small, it is set to the needed size and CMXSERR_BufferNotEnough is returned,
+    // the datagram is kept for the next call.
+    CMXSErr receive(void * buf, uint32_t * len, uint32_t flags, int32_t timeoutMs);
+
+ protected:
+    Receiver() {}
+    virtual ~Receiver() {}
+};
+
+}  // namespace cmxs
+}  // namespace caton
+
+#endif  // CMXS_MOCK_CMXSSDK_H
@@ -0,0 +1,302 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * The CMXS SDK entry points of the mock.
+ */
+
+#include <stdlib.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <cmxssdk/cmxssdk.h>
+
+#include "mock_dispatcher.h"
+#include "mock_impairment.h"
+#include "mock_replay.h"
+#include "mock_transport.h"
+
+using namespace caton::cmxs;
+using namespace cmxs_mock;
+
+namespace {
+
+std::atomic<CMXSLogCallback> sLogCallback(nullptr);
+
+std::mutex sInitMtx;
+bool sInit = false;
+
+#define MOCK_LOG(level, ...) \
+    do { \
+        CMXSLogCallback cb = sLogCallback; \
+        if (cb) { \
+            cb(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+bool isInit() {
+    std::unique_lock<std::mutex> locker(sInitMtx);
+    return sInit;
+}
+
+// Messages of a new sender or receiver: its links are up, then it is connected.
+void postConnected(const void * owner, CMXSListener * listener, const CMXSStreamParam_t * param) {
+    const Clock::time_point at = Clock::now() + std::chrono::milliseconds(MockConfig::get().connectDelayMs);
+    for (uint32_t i = 0; i < param->mNetDevicesCount; ++i) {
+        std::string device = param->mNetDevices[i] ? param->mNetDevices[i] : "";
+        Dispatcher::instance().post(owner, listener, at, [device](CMXSListener * l) {
+            CMXSDataServerLinkStateMsgData_t data;
+            data.mNetDevice = device.c_str();
+            data.mDataServerConnectState = 1;
+            l->onMessage(CMXSMSG_DataServerLinkState, 0, &data);
+        });
+    }
+    Dispatcher::instance().post(owner, listener, at, [](CMXSListener * l) {
+        CMXSDataServerStateMsgData_t data;
+        data.mDataServerConnectState = 1;
+        l->onMessage(CMXSMSG_DataServerState, 0, &data);
+    });
+    Dispatcher::instance().post(owner, listener, at, [](CMXSListener * l) {
+        l->onMessage(CMXSMSG_ServerConnected, 0, nullptr);
+    });
+}
+
+class MockSender : public Sender {
+ public:
+    explicit MockSender(const std::string & key)
+        : mKey(key) {
+        if (MockConfig::get().udpPort) {
+            mUdp.reset(new UdpSink(UdpEndpoint(MockConfig::get().udpPort, mKey)));
+        }
+    }
+    ~MockSender() {
+        Dispatcher::instance().cancel(this);
+    }
+
+    CMXSErr doSend(const void * data, uint32_t len) {
+        if (!data || !len) {
+            return CMXSERR_InvalidArgs;
+        }
+        if (mUdp) {
+            mUdp->send(data, len);
+        } else {
+            // like UDP, nobody listening is not an error.
+            Hub::instance().publish(mKey, data, len);
+        }
+        return CMXSERR_OK;
+    }
+
+ private:
+    const std::string mKey;
+    std::unique_ptr<UdpSink> mUdp;
+};
+
+class MockReceiver : public Receiver {
+ public:
+    MockReceiver(const std::string & key, CMXSListener * listener)
+        : mKey(key),
+        mListener(listener),
+        mQueue(MockConfig::get().queueCapacity) {
+        if (Scenario::get()) {
+            mImpairment.reset(new Impairment(*Scenario::get()));
+            mQueue.setImpairment(mImpairment.get());
+        } else if (getenv("CMXS_MOCK_SCENARIO")) {
+            MOCK_LOG(CMXSLOG_LEVEL_E, "cmxs mock: cannot load scenario %s\n", getenv("CMXS_MOCK_SCENARIO"));
+        }
+        if (!MockConfig::get().replayPath.empty()) {
+            mReplay.reset(new ReplaySource(MockConfig::get().replayPath, MockConfig::get().replaySpeed,
+                MockConfig::get().connectDelayMs, &mQueue));
+        } else if (MockConfig::get().udpPort) {
+            UdpEndpoint endpoint(MockConfig::get().udpPort, mKey);
+            mUdp.reset(new UdpSource(endpoint, &mQueue));
+            if (!mUdp->ok()) {
+                MOCK_LOG(CMXSLOG_LEVEL_E, "cmxs mock: cannot join udp group %u.%u.%u.%u:%u\n",
+                    endpoint.group >> 24, (endpoint.group >> 16) & 0xff, (endpoint.group >> 8) & 0xff,
+                    endpoint.group & 0xff, endpoint.port);
+            }
+        } else {
+            Hub::instance().attach(mKey, &mQueue);
+        }
+    }
+    ~MockReceiver() {
+        if (!mUdp && !mReplay) {
+            Hub::instance().detach(mKey, &mQueue);
+        }
+        mUdp.reset();
+        // closed first, a fast replay may wait for room in it.
+        mQueue.close();
+        if (mReplay) {
+            mReplay->stop();
+        }
+        Dispatcher::instance().cancel(this);
+        if (mQueue.dropped()) {
+            MOCK_LOG(CMXSLOG_LEVEL_W, "cmxs mock: receiver %s dropped %llu datagrams\n",
+                mKey.c_str(), static_cast<unsigned long long>(mQueue.dropped()));
+        }
+        if (mReplay && mReplay->failed()) {
+            MOCK_LOG(CMXSLOG_LEVEL_E, "cmxs mock: cannot read capture %s\n", MockConfig::get().replayPath.c_str());
+        } else if (mReplay) {
+            MOCK_LOG(CMXSLOG_LEVEL_I, "cmxs mock: replayed %llu datagrams, %llu bytes in %lld ms%s\n",
+                static_cast<unsigned long long>(mReplay->datagrams()),
+                static_cast<unsigned long long>(mReplay->bytes()),
+                static_cast<long long>(mReplay->elapsedMs()),
+                mReplay->elapsedMs() ? "" : " (not finished)");
+        }
+        if (mImpairment) {
+            MOCK_LOG(CMXSLOG_LEVEL_I, "cmxs mock: receiver %s scenario: %s\n",
+                mKey.c_str(), mImpairment->summary().c_str());
+        }
+    }
+
+    CMXSErr doReceive(void * buf, uint32_t * len, int32_t timeoutMs) {
+        if (mImpairment) {
+            CMXSErr err = mImpairment->onReceive();
+            if (err == CMXSERR_ServiceUnavailable && mListener) {
+                Dispatcher::instance().post(this, mListener, Clock::now(), [](CMXSListener * l) {
+                    CMXSUnAvailableMsgData_t data;
+                    data.mErrorInfo = "mock scenario";
+                    l->onMessage(CMXSMSG_ERROR, CMXSERR_ServiceUnavailable, &data);
+                });
+            }
+            if (err != CMXSERR_OK) {
+                return err;
+            }
+        }
+        return mQueue.pop(buf, len, timeoutMs);
+    }
+
+ private:
+    const std::string mKey;
+    CMXSListener * const mListener;
+    // before mQueue, which uses it.
+    std::unique_ptr<Impairment> mImpairment;
+    ReceiverQueue mQueue;
+    std::unique_ptr<UdpSource> mUdp;
+    std::unique_ptr<ReplaySource> mReplay;
+};
+
+}  // namespace
+
+extern "C" {
+
+const char * cmxssdk_error_str(int err) {
+    switch (err) {
+        case CMXSERR_OK:
+            return "OK";
+        case CMXSERR_Again:
+            return "Again";
+        case CMXSERR_BufferNotEnough:
+            return "Buffer not enough";
+        case CMXSERR_ServiceUnavailable:
+            return "Service unavailable";
+        case CMXSERR_InvalidArgs:
+            return "Invalid arguments";
+        case CMXSERR_NotFound:
+            return "Not found";
+        case CMXSERR_NoMem:
+            return "No memory";
+        case CMXSERR_DataPortDetectFailed:
+            return "Data port detect failed";
+        case CMXSERR_NotReceiveDataInTime:
+            return "Not receive data in time";
+        case CMXSERR_ConnectFailed:
+            return "Connect failed";
+        default:
+            return "Unknown error";
+    }
+}
+
+void cmxssdk_set_log_callback(CMXSLogCallback cb) {
+    sLogCallback = cb;
+}
+
+const char * cmxssdk_version() {
+    return "mock";
+}
+
+}  // extern "C"
+
+namespace caton {
+namespace cmxs {
+
+CMXSErr CMXSSDK::init(const CMXSConfig_t * config, CMXSListener * listener) {
+    (void)listener;
+    if (!config) {
+        return CMXSERR_InvalidArgs;
+    }
+    std::unique_lock<std::mutex> locker(sInitMtx);
+    sInit = true;
+    MOCK_LOG(CMXSLOG_LEVEL_I, "cmxs mock: init, server: %s, device: %s\n",
+        config->mServer ? config->mServer : "", config->mDeviceId ? config->mDeviceId : "");
+    return CMXSERR_OK;
+}
+
+void CMXSSDK::uninit() {
+    std::unique_lock<std::mutex> locker(sInitMtx);
+    sInit = false;
+}
+
+Sender * Sender::create(const CMXSStreamParam_t * param, CMXSListener * listener) {
+    if (!param || !param->mStreamkey || !isInit()) {
+        return nullptr;
+    }
+    MockSender * sender = new (std::nothrow) MockSender(param->mStreamkey);
+    if (sender) {
+        postConnected(sender, listener, param);
+    }
+    return sender;
+}
+
+void Sender::destroy(Sender * sender) {
+    delete sender;
+}
+
+CMXSErr Sender::send(const void * data, uint32_t len, int32_t timeoutMs) {
+    (void)timeoutMs;
+    return static_cast<MockSender *>(this)->doSend(data, len);
+}
+
+Receiver * Receiver::create(const CMXSStreamParam_t * param, CMXSListener * listener) {
+    if (!param || !param->mStreamkey || !isInit()) {
+        return nullptr;
+    }
+    MockReceiver * receiver = new (std::nothrow) MockReceiver(param->mStreamkey, listener);
+    if (receiver) {
+        postConnected(receiver, listener, param);
+    }
+    return receiver;
+}
+
+void Receiver::destroy(Receiver * receiver) {
+    delete receiver;
+}
+
+CMXSErr Receiver::receive(void * buf, uint32_t * len, uint32_t flags, int32_t timeoutMs) {
+    (void)flags;
+    return static_cast<MockReceiver *>(this)->doReceive(buf, len, timeoutMs);
+}
+
+}  // namespace cmxs
+}  // namespace caton
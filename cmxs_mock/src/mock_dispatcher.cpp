@@ -0,0 +1,98 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "mock_dispatcher.h"
+
+namespace cmxs_mock {
+
+Dispatcher & Dispatcher::instance() {
+    static Dispatcher sDispatcher;
+    return sDispatcher;
+}
+
+Dispatcher::Dispatcher() : mQuit(false) {
+    mThread = std::thread(&Dispatcher::run, this);
+}
+
+Dispatcher::~Dispatcher() {
+    {
+        std::unique_lock<std::mutex> locker(mMtx);
+        mQuit = true;
+    }
+    mCond.notify_all();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void Dispatcher::post(const void * owner, CMXSListener * listener, Clock::time_point at, Delivery delivery) {
+    if (!listener) {
+        return;
+    }
+    std::unique_lock<std::mutex> locker(mMtx);
+    std::list<Item>::iterator pos = mItems.begin();
+    while (pos != mItems.end() && pos->at <= at) {
+        ++pos;
+    }
+    mItems.insert(pos, Item{owner, listener, at, std::move(delivery)});
+    mCond.notify_all();
+}
+
+void Dispatcher::cancel(const void * owner) {
+    std::unique_lock<std::mutex> deliverLocker(mDeliverMtx);
+    std::unique_lock<std::mutex> locker(mMtx);
+    for (std::list<Item>::iterator i = mItems.begin(); i != mItems.end();) {
+        if (i->owner == owner) {
+            i = mItems.erase(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void Dispatcher::run() {
+    std::unique_lock<std::mutex> locker(mMtx);
+    while (!mQuit) {
+        if (mItems.empty()) {
+            mCond.wait(locker);
+            continue;
+        }
+        if (mItems.front().at > Clock::now()) {
+            mCond.wait_until(locker, mItems.front().at);
+            continue;
+        }
+        // cancel() of the owner waits for the delivery, take the item under both locks.
+        locker.unlock();
+        std::unique_lock<std::mutex> deliverLocker(mDeliverMtx);
+        locker.lock();
+        if (mQuit || mItems.empty() || mItems.front().at > Clock::now()) {
+            continue;
+        }
+        Item item = std::move(mItems.front());
+        mItems.pop_front();
+        locker.unlock();
+        item.delivery(item.listener);
+        deliverLocker.unlock();
+        locker.lock();
+    }
+}
+
+}  // namespace cmxs_mock
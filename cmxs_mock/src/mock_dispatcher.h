@@ -0,0 +1,85 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * The listener messages are sent from a thread of the mock, as the SDK does,
+ * so the plugins see the same threading as with the real SDK.
+ */
+
+#ifndef CMXS_MOCK_DISPATCHER_H
+#define CMXS_MOCK_DISPATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+
+#include <cmxssdk/cmxssdk.h>
+
+namespace cmxs_mock {
+
+using caton::cmxs::CMXSListener;
+
+class Dispatcher {
+ public:
+    typedef std::chrono::steady_clock Clock;
+    // Calls the listener, the message data lives on its stack.
+    typedef std::function<void(CMXSListener *)> Delivery;
+
+    static Dispatcher & instance();
+
+    // Deliver to listener at the given time. owner identifies the Sender/Receiver for cancel().
+    void post(const void * owner, CMXSListener * listener, Clock::time_point at, Delivery delivery);
+    void post(const void * owner, CMXSListener * listener, Delivery delivery) {
+        post(owner, listener, Clock::now(), std::move(delivery));
+    }
+
+    // Drop the pending messages of owner, and wait for the one being delivered.
+    void cancel(const void * owner);
+
+ private:
+    Dispatcher();
+    ~Dispatcher();
+
+    void run();
+
+    struct Item {
+        const void * owner;
+        CMXSListener * listener;
+        Clock::time_point at;
+        Delivery delivery;
+    };
+
+    std::mutex mMtx;
+    std::condition_variable mCond;
+    // sorted by time
+    std::list<Item> mItems;
+    bool mQuit;
+    // held while a message is delivered
+    std::mutex mDeliverMtx;
+    std::thread mThread;
+};
+
+}  // namespace cmxs_mock
+
+#endif  // CMXS_MOCK_DISPATCHER_H
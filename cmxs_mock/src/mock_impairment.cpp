@@ -0,0 +1,260 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "mock_impairment.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace cmxs_mock {
+
+static bool toDouble(const std::string & s, double & value) {
+    char * end = nullptr;
+    value = strtod(s.c_str(), &end);
+    return end && *end == '\0' && !s.empty();
+}
+
+static bool toUint(const std::string & s, uint64_t & value) {
+    char * end = nullptr;
+    value = strtoull(s.c_str(), &end, 10);
+    return end && *end == '\0' && !s.empty();
+}
+
+const Scenario * Scenario::get() {
+    static Scenario * sScenario = []() -> Scenario * {
+        const char * path = getenv("CMXS_MOCK_SCENARIO");
+        if (!path || !*path) {
+            return nullptr;
+        }
+        Scenario * scenario = new Scenario();
+        if (!scenario->load(path)) {
+            delete scenario;
+            return nullptr;
+        }
+        return scenario;
+    }();
+    return sScenario;
+}
+
+bool Scenario::load(const std::string & path) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::vector<std::string> setting;
+        std::string word;
+        while (words >> word) {
+            setting.push_back(word);
+        }
+        if (setting.empty()) {
+            continue;
+        }
+        if (setting[0] == "seed" && setting.size() == 2) {
+            uint64_t seed = 0;
+            if (!toUint(setting[1], seed)) {
+                return false;
+            }
+            mSeed = static_cast<uint32_t>(seed);
+        } else if (setting[0] == "at" && setting.size() >= 3) {
+            uint64_t atDatagram = 0;
+            if (!toUint(setting[1], atDatagram)) {
+                return false;
+            }
+            Event event{atDatagram, std::vector<std::string>(setting.begin() + 2, setting.end())};
+            // checked now, the file errors are found at once.
+            ImpairmentParams params;
+            uint64_t unavailableDatagrams = 0;
+            if (!apply(event.setting, params, unavailableDatagrams)) {
+                return false;
+            }
+            mEvents.push_back(event);
+        } else {
+            uint64_t unavailableDatagrams = 0;
+            if (!apply(setting, mInitial, unavailableDatagrams) || unavailableDatagrams) {
+                return false;
+            }
+        }
+    }
+    std::stable_sort(mEvents.begin(), mEvents.end(), [](const Event & a, const Event & b) {
+        return a.atDatagram < b.atDatagram;
+    });
+    return true;
+}
+
+bool Scenario::apply(const std::vector<std::string> & setting, ImpairmentParams & params,
+    uint64_t & unavailableDatagrams) {
+    std::vector<double> values;
+    for (size_t i = 1; i < setting.size(); ++i) {
+        double value = 0;
+        if (!toDouble(setting[i], value) || value < 0) {
+            return false;
+        }
+        values.push_back(value);
+    }
+    const std::string & name = setting[0];
+    if (name == "loss" && values.size() == 1) {
+        params.loss = values[0];
+    } else if (name == "burst_loss" && values.size() == 3) {
+        params.burstEnter = values[0];
+        params.burstExit = values[1];
+        params.burstLoss = values[2];
+    } else if (name == "latency_ms" && values.size() == 1) {
+        params.latencyMs = static_cast<uint32_t>(values[0]);
+    } else if (name == "jitter_ms" && values.size() == 1) {
+        params.jitterMs = static_cast<uint32_t>(values[0]);
+    } else if (name == "reorder" && values.size() == 2) {
+        params.reorder = values[0];
+        params.reorderMs = static_cast<uint32_t>(values[1]);
+    } else if (name == "rate_kbps" && values.size() == 1) {
+        params.rateBitsPerSecond = static_cast<uint64_t>(values[0] * 1000);
+    } else if (name == "queue_ms" && values.size() == 1) {
+        params.queueMs = static_cast<uint32_t>(values[0]);
+    } else if (name == "again" && values.size() == 1) {
+        params.again = values[0];
+    } else if (name == "service_unavailable" && values.size() == 1) {
+        unavailableDatagrams = static_cast<uint64_t>(values[0]);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Impairment::Impairment(const Scenario & scenario)
+    : mScenario(scenario),
+    mParams(scenario.initial()),
+    mRandom(scenario.seed()),
+    // another stream of the same seed, not the same numbers.
+    mAgainRandom(scenario.seed() ^ 0x5bd1e995u),
+    mUniform(0.0, 1.0),
+    mNextEvent(0),
+    mBurst(false),
+    mLinkFree(Clock::now()),
+    mLastDelivery(mLinkFree),
+    mUnavailableLeft(0),
+    mUnavailableNotified(true),
+    mDatagrams(0),
+    mLost(0),
+    mBurstLost(0),
+    mQueueDropped(0),
+    mReordered(0),
+    mUnavailableDropped(0),
+    mAgain(0) {
+}
+
+void Impairment::advance() {
+    const std::vector<Scenario::Event> & events = mScenario.events();
+    while (mNextEvent < events.size() && events[mNextEvent].atDatagram <= mDatagrams) {
+        uint64_t unavailableDatagrams = 0;
+        Scenario::apply(events[mNextEvent].setting, mParams, unavailableDatagrams);
+        if (unavailableDatagrams) {
+            mUnavailableLeft = unavailableDatagrams;
+            mUnavailableNotified = false;
+        }
+        ++mNextEvent;
+    }
+}
+
+bool Impairment::onDatagram(size_t len, Clock::time_point now, Clock::time_point & at) {
+    std::unique_lock<std::mutex> locker(mMtx);
+    advance();
+    ++mDatagrams;
+    if (mUnavailableLeft) {
+        --mUnavailableLeft;
+        ++mUnavailableDropped;
+        return false;
+    }
+
+    // burst state first, so it moves for every datagram.
+    if (mBurst) {
+        mBurst = uniform() >= mParams.burstExit;
+    } else {
+        mBurst = mParams.burstEnter > 0 && uniform() < mParams.burstEnter;
+    }
+    if (mBurst && uniform() < mParams.burstLoss) {
+        ++mBurstLost;
+        return false;
+    }
+    if (mParams.loss > 0 && uniform() < mParams.loss) {
+        ++mLost;
+        return false;
+    }
+
+    Clock::time_point sent = now;
+    if (mParams.rateBitsPerSecond) {
+        Clock::time_point start = std::max(now, mLinkFree);
+        if (start - now > std::chrono::milliseconds(mParams.queueMs)) {
+            ++mQueueDropped;
+            return false;
+        }
+        mLinkFree = start + std::chrono::microseconds(len * 8 * 1000000 / mParams.rateBitsPerSecond);
+        sent = mLinkFree;
+    }
+
+    at = sent + std::chrono::milliseconds(mParams.latencyMs);
+    if (mParams.jitterMs) {
+        at += std::chrono::microseconds(static_cast<int64_t>(uniform() * mParams.jitterMs * 1000));
+    }
+    if (mParams.reorder > 0 && uniform() < mParams.reorder) {
+        // delivered after the next ones.
+        ++mReordered;
+        at += std::chrono::milliseconds(mParams.reorderMs);
+        return true;
+    }
+    // jitter alone does not reorder.
+    at = std::max(at, mLastDelivery);
+    mLastDelivery = at;
+    return true;
+}
+
+CMXSErr Impairment::onReceive() {
+    std::unique_lock<std::mutex> locker(mMtx);
+    if (!mUnavailableNotified) {
+        // then receive() just gets nothing until the period ends.
+        mUnavailableNotified = true;
+        return CMXSERR_ServiceUnavailable;
+    }
+    if (mParams.again > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(mAgainRandom) < mParams.again) {
+        ++mAgain;
+        return CMXSERR_Again;
+    }
+    return CMXSERR_OK;
+}
+
+std::string Impairment::summary() {
+    std::unique_lock<std::mutex> locker(mMtx);
+    std::ostringstream out;
+    out << "datagrams=" << mDatagrams
+        << " lost=" << mLost
+        << " burst_lost=" << mBurstLost
+        << " queue_dropped=" << mQueueDropped
+        << " unavailable_dropped=" << mUnavailableDropped
+        << " reordered=" << mReordered
+        << " again=" << mAgain;
+    return out.str();
+}
+
+}  // namespace cmxs_mock
@@ -0,0 +1,148 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Network impairments of the mock receivers, from the scenario file of CMXS_MOCK_SCENARIO.
+ *
+ * One setting per line, '#' starts a comment:
+ *
+ *   seed 42                  random seed, the same seed gives the same losses for the same input
+ *   loss 0.01                probability of losing a datagram
+ *   burst_loss 0.001 0.3 1   Gilbert-Elliott: probability to enter the bad state, to leave it,
+ *                            and of losing a datagram while in it
+ *   latency_ms 20            delay of every datagram
+ *   jitter_ms 10             random extra delay, 0 to 10 ms, the order is kept
+ *   reorder 0.005 30         probability of delaying a datagram by 30 ms more, after the next ones
+ *   rate_kbps 8000           bandwidth cap, the datagrams wait for their turn
+ *   queue_ms 200             max wait for the bandwidth cap, the later datagrams are dropped
+ *   again 0.01               probability that receive() returns CMXSERR_Again while data is there
+ *   at 10000 <setting>       change a setting from the 10000th datagram of the receiver on, e.g.
+ *   at 10000 loss 0.2
+ *   at 30000 service_unavailable 2000
+ *                            the next 2000 datagrams are lost: the next receive() returns
+ *                            CMXSERR_ServiceUnavailable and the listener gets
+ *                            CMXSMSG_ERROR/CMXSERR_ServiceUnavailable
+ *
+ * Every receiver has its own state, and two random generators starting with the seed: one for the
+ * datagrams, one for the again draws of receive(). The events are counted in datagrams, not in time,
+ * so the same seed impairs the same datagrams however often the receiver polls.
+ */
+
+#ifndef CMXS_MOCK_IMPAIRMENT_H
+#define CMXS_MOCK_IMPAIRMENT_H
+
+#include <stdint.h>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "mock_transport.h"
+
+namespace cmxs_mock {
+
+struct ImpairmentParams {
+    double loss = 0;
+    double burstEnter = 0;
+    double burstExit = 1;
+    double burstLoss = 1;
+    uint32_t latencyMs = 0;
+    uint32_t jitterMs = 0;
+    double reorder = 0;
+    uint32_t reorderMs = 0;
+    uint64_t rateBitsPerSecond = 0;
+    uint32_t queueMs = 200;
+    double again = 0;
+};
+
+class Scenario {
+ public:
+    struct Event {
+        // index of the datagram it applies from
+        uint64_t atDatagram;
+        std::vector<std::string> setting;
+    };
+
+    // The scenario of CMXS_MOCK_SCENARIO, nullptr if it is not set.
+    static const Scenario * get();
+
+    bool load(const std::string & path);
+
+    uint32_t seed() const { return mSeed; }
+    const ImpairmentParams & initial() const { return mInitial; }
+    // sorted by datagram
+    const std::vector<Event> & events() const { return mEvents; }
+
+    // Apply a "name values..." setting. unavailableDatagrams is set by service_unavailable.
+    static bool apply(const std::vector<std::string> & setting, ImpairmentParams & params,
+        uint64_t & unavailableDatagrams);
+
+ private:
+    uint32_t mSeed = 0;
+    ImpairmentParams mInitial;
+    std::vector<Event> mEvents;
+};
+
+class Impairment {
+ public:
+    explicit Impairment(const Scenario & scenario);
+
+    // A datagram of len bytes arrives now. Returns false if it is lost, else sets when it can be received.
+    bool onDatagram(size_t len, Clock::time_point now, Clock::time_point & at);
+
+    // Error receive() returns instead of the data, CMXSERR_OK for none.
+    // CMXSERR_ServiceUnavailable is returned once for each period.
+    CMXSErr onReceive();
+
+    // Counters for the log.
+    std::string summary();
+
+ private:
+    // the events up to the current datagram.
+    void advance();
+    double uniform() { return mUniform(mRandom); }
+
+    const Scenario & mScenario;
+    std::mutex mMtx;
+    ImpairmentParams mParams;
+    // draws of the datagrams, mAgainRandom those of receive(): the polls do not move the losses.
+    std::mt19937 mRandom;
+    std::mt19937 mAgainRandom;
+    std::uniform_real_distribution<double> mUniform;
+    size_t mNextEvent;
+    bool mBurst;
+    Clock::time_point mLinkFree;
+    Clock::time_point mLastDelivery;
+    uint64_t mUnavailableLeft;
+    bool mUnavailableNotified;
+
+    uint64_t mDatagrams;
+    uint64_t mLost;
+    uint64_t mBurstLost;
+    uint64_t mQueueDropped;
+    uint64_t mReordered;
+    uint64_t mUnavailableDropped;
+    uint64_t mAgain;
+};
+
+}  // namespace cmxs_mock
+
+#endif  // CMXS_MOCK_IMPAIRMENT_H
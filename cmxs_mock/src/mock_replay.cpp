@@ -0,0 +1,108 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include "mock_replay.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "cmxs_capture.h"
+
+namespace cmxs_mock {
+
+ReplaySource::ReplaySource(const std::string & path, double speed, uint32_t delayMs, ReceiverQueue * queue)
+    : mPath(path),
+    mSpeed(speed > 0 ? speed : 0),
+    mDelayMs(delayMs),
+    mQueue(queue),
+    mQuit(false),
+    mFailed(false),
+    mDatagrams(0),
+    mBytes(0),
+    mElapsedMs(0) {
+    mThread = std::thread(&ReplaySource::run, this);
+}
+
+ReplaySource::~ReplaySource() {
+    stop();
+}
+
+void ReplaySource::stop() {
+    mQuit = true;
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+bool ReplaySource::sleepUntil(Clock::time_point at) {
+    // by steps, so destroy does not wait for a long gap of the capture.
+    while (!mQuit) {
+        Clock::time_point now = Clock::now();
+        if (now >= at) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::min<Clock::duration>(at - now, std::chrono::milliseconds(100)));
+    }
+    return false;
+}
+
+void ReplaySource::run() {
+    cmxs_common::CaptureReader reader;
+    if (!reader.open(mPath)) {
+        mFailed = true;
+        return;
+    }
+    // the data comes once connected, as from a sender.
+    if (!sleepUntil(Clock::now() + std::chrono::milliseconds(mDelayMs))) {
+        return;
+    }
+
+    std::vector<uint8_t> data;
+    uint64_t timeNs = 0;
+    bool first = true;
+    uint64_t firstNs = 0;
+    Clock::time_point start;
+    while (!mQuit && reader.next(data, timeNs)) {
+        if (first) {
+            first = false;
+            firstNs = timeNs;
+            start = Clock::now();
+        }
+        if (mSpeed > 0) {
+            uint64_t offsetNs = static_cast<uint64_t>((timeNs > firstNs ? timeNs - firstNs : 0) / mSpeed);
+            if (!sleepUntil(start + std::chrono::nanoseconds(offsetNs))) {
+                return;
+            }
+        } else if (!mQueue->waitNotFull()) {
+            return;
+        }
+        mQueue->push(data.data(), data.size());
+        ++mDatagrams;
+        mBytes += data.size();
+    }
+    if (!first) {
+        mElapsedMs = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(
+            Clock::now() - start).count());
+    }
+}
+
+}  // namespace cmxs_mock
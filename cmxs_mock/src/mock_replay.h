@@ -0,0 +1,75 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * Feeds a receiver with a capture file (common/cmxs_capture.h) instead of the senders' data,
+ * at the captured timing, faster, or as fast as the receiver takes it.
+ */
+
+#ifndef CMXS_MOCK_REPLAY_H
+#define CMXS_MOCK_REPLAY_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "mock_transport.h"
+
+namespace cmxs_mock {
+
+class ReplaySource {
+ public:
+    // speed: 1 for the captured timing, 0 for as fast as possible. It starts after delayMs.
+    ReplaySource(const std::string & path, double speed, uint32_t delayMs, ReceiverQueue * queue);
+    ~ReplaySource();
+
+    // Stop the replay thread, the counters are final after it.
+    void stop();
+
+    // The capture could not be opened.
+    bool failed() const { return mFailed; }
+    uint64_t datagrams() const { return mDatagrams; }
+    uint64_t bytes() const { return mBytes; }
+    // From the first datagram to the last one, 0 while replaying.
+    int64_t elapsedMs() const { return mElapsedMs; }
+
+ private:
+    void run();
+    // Returns false if quit meanwhile.
+    bool sleepUntil(Clock::time_point at);
+
+    const std::string mPath;
+    const double mSpeed;
+    const uint32_t mDelayMs;
+    ReceiverQueue * mQueue;
+    std::atomic<bool> mQuit;
+    std::atomic<bool> mFailed;
+    std::atomic<uint64_t> mDatagrams;
+    std::atomic<uint64_t> mBytes;
+    std::atomic<int64_t> mElapsedMs;
+    std::thread mThread;
+};
+
+}  // namespace cmxs_mock
+
+#endif  // CMXS_MOCK_REPLAY_H
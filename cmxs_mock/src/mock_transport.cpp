@@ -0,0 +1,308 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "mock_transport.h"
+#include "mock_impairment.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace cmxs_mock {
+
+static uint32_t envUint(const char * name, uint32_t defaultValue) {
+    const char * value = getenv(name);
+    if (!value || !*value) {
+        return defaultValue;
+    }
+    return static_cast<uint32_t>(strtoul(value, nullptr, 10));
+}
+
+static std::string envString(const char * name) {
+    const char * value = getenv(name);
+    return value ? value : "";
+}
+
+static double envDouble(const char * name, double defaultValue) {
+    const char * value = getenv(name);
+    if (!value || !*value) {
+        return defaultValue;
+    }
+    return strtod(value, nullptr);
+}
+
+const MockConfig & MockConfig::get() {
+    static const MockConfig sConfig = {
+        envUint("CMXS_MOCK_CONNECT_MS", 50),
+        static_cast<uint16_t>(envUint("CMXS_MOCK_UDP_PORT", 0)),
+        envUint("CMXS_MOCK_QUEUE", 4096),
+        envString("CMXS_MOCK_REPLAY"),
+        envDouble("CMXS_MOCK_REPLAY_SPEED", 1),
+    };
+    return sConfig;
+}
+
+ReceiverQueue::ReceiverQueue(size_t capacity)
+    : mCapacity(capacity ? capacity : 1),
+    mImpairment(nullptr),
+    mClosed(false),
+    mDropped(0) {
+}
+
+void ReceiverQueue::push(const void * data, size_t len, Clock::time_point at) {
+    const uint8_t * bytes = static_cast<const uint8_t *>(data);
+    std::unique_lock<std::mutex> locker(mMtx);
+    if (mClosed) {
+        return;
+    }
+    while (mDatagrams.size() >= mCapacity) {
+        // the receiver is too slow, as a full socket buffer does.
+        mDatagrams.pop_front();
+        ++mDropped;
+    }
+    std::deque<Datagram>::iterator pos = mDatagrams.end();
+    while (pos != mDatagrams.begin() && (pos - 1)->at > at) {
+        --pos;
+    }
+    mDatagrams.insert(pos, Datagram{std::vector<uint8_t>(bytes, bytes + len), at});
+    mCond.notify_one();
+}
+
+void ReceiverQueue::push(const void * data, size_t len) {
+    Clock::time_point at = Clock::now();
+    if (mImpairment && !mImpairment->onDatagram(len, at, at)) {
+        return;
+    }
+    push(data, len, at);
+}
+
+CMXSErr ReceiverQueue::pop(void * buf, uint32_t * len, int32_t timeoutMs) {
+    if (!buf || !len) {
+        return CMXSERR_InvalidArgs;
+    }
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs > 0 ? timeoutMs : 0);
+    std::unique_lock<std::mutex> locker(mMtx);
+    while (true) {
+        if (mClosed) {
+            return CMXSERR_Again;
+        }
+        const Clock::time_point now = Clock::now();
+        if (!mDatagrams.empty() && mDatagrams.front().at <= now) {
+            break;
+        }
+        if (now >= deadline) {
+            return CMXSERR_Again;
+        }
+        Clock::time_point wakeup = deadline;
+        if (!mDatagrams.empty() && mDatagrams.front().at < wakeup) {
+            wakeup = mDatagrams.front().at;
+        }
+        mCond.wait_until(locker, wakeup);
+    }
+
+    Datagram & datagram = mDatagrams.front();
+    if (datagram.data.size() > *len) {
+        *len = static_cast<uint32_t>(datagram.data.size());
+        return CMXSERR_BufferNotEnough;
+    }
+    memcpy(buf, datagram.data.data(), datagram.data.size());
+    *len = static_cast<uint32_t>(datagram.data.size());
+    mDatagrams.pop_front();
+    mNotFull.notify_one();
+    return CMXSERR_OK;
+}
+
+bool ReceiverQueue::waitNotFull() {
+    std::unique_lock<std::mutex> locker(mMtx);
+    mNotFull.wait(locker, [this]() { return mClosed || mDatagrams.size() < mCapacity; });
+    return !mClosed;
+}
+
+void ReceiverQueue::close() {
+    std::unique_lock<std::mutex> locker(mMtx);
+    mClosed = true;
+    mCond.notify_all();
+    mNotFull.notify_all();
+}
+
+Hub & Hub::instance() {
+    static Hub sHub;
+    return sHub;
+}
+
+void Hub::attach(const std::string & key, ReceiverQueue * queue) {
+    std::unique_lock<std::mutex> locker(mMtx);
+    mReceivers[key].insert(queue);
+}
+
+void Hub::detach(const std::string & key, ReceiverQueue * queue) {
+    std::unique_lock<std::mutex> locker(mMtx);
+    std::map<std::string, std::set<ReceiverQueue *>>::iterator receivers = mReceivers.find(key);
+    if (receivers == mReceivers.end()) {
+        return;
+    }
+    receivers->second.erase(queue);
+    if (receivers->second.empty()) {
+        mReceivers.erase(receivers);
+    }
+}
+
+bool Hub::publish(const std::string & key, const void * data, size_t len) {
+    std::unique_lock<std::mutex> locker(mMtx);
+    std::map<std::string, std::set<ReceiverQueue *>>::iterator receivers = mReceivers.find(key);
+    if (receivers == mReceivers.end()) {
+        return false;
+    }
+    for (ReceiverQueue * queue : receivers->second) {
+        queue->push(data, len);
+    }
+    return true;
+}
+
+UdpEndpoint::UdpEndpoint(uint16_t basePort, const std::string & key) {
+    // FNV-1a, the same in every process.
+    uint32_t hash = 2166136261u;
+    for (char c : key) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    group = (239u << 24) | (255u << 16) | (hash & 0xffff);
+    uint32_t ports = std::min<uint32_t>(1000, 65536 - basePort);
+    port = static_cast<uint16_t>(basePort + (hash >> 16) % ports);
+}
+
+#ifndef _WIN32
+static sockaddr_in groupAddress(const UdpEndpoint & endpoint) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(endpoint.port);
+    addr.sin_addr.s_addr = htonl(endpoint.group);
+    return addr;
+}
+
+UdpSink::UdpSink(const UdpEndpoint & endpoint) : mFd(socket(AF_INET, SOCK_DGRAM, 0)), mEndpoint(endpoint) {
+    if (mFd < 0) {
+        return;
+    }
+    // on the loopback only, and looped back to the receivers of this host.
+    in_addr loopback;
+    loopback.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(mFd, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback));
+    unsigned char loop = 1;
+    setsockopt(mFd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    unsigned char ttl = 0;
+    setsockopt(mFd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+}
+
+UdpSink::~UdpSink() {
+    if (mFd >= 0) {
+        ::close(mFd);
+    }
+}
+
+bool UdpSink::send(const void * data, size_t len) {
+    if (mFd < 0) {
+        return false;
+    }
+    sockaddr_in addr = groupAddress(mEndpoint);
+    return sendto(mFd, data, len, 0, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == static_cast<ssize_t>(len);
+}
+
+UdpSource::UdpSource(const UdpEndpoint & endpoint, ReceiverQueue * queue)
+    : mFd(socket(AF_INET, SOCK_DGRAM, 0)),
+    mQueue(queue),
+    mQuit(false) {
+    if (mFd < 0) {
+        return;
+    }
+    // several receivers of the key each get every datagram of the group.
+    int reuse = 1;
+    setsockopt(mFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // the senders may burst a whole frame.
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(mFd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    // bound to the group, the other groups on the same port are not received.
+    sockaddr_in addr = groupAddress(endpoint);
+    ip_mreq membership;
+    membership.imr_multiaddr.s_addr = htonl(endpoint.group);
+    membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(mFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0
+        || setsockopt(mFd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0) {
+        ::close(mFd);
+        mFd = -1;
+        return;
+    }
+    mThread = std::thread(&UdpSource::run, this);
+}
+
+UdpSource::~UdpSource() {
+    mQuit = true;
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+    if (mFd >= 0) {
+        ::close(mFd);
+    }
+}
+
+void UdpSource::run() {
+    std::vector<uint8_t> buf(65536);
+    while (!mQuit) {
+        pollfd pfd = {mFd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        ssize_t len = recv(mFd, buf.data(), buf.size(), 0);
+        if (len > 0) {
+            mQueue->push(buf.data(), static_cast<size_t>(len));
+        }
+    }
+}
+#else
+UdpSink::UdpSink(const UdpEndpoint & endpoint) : mFd(-1), mEndpoint(endpoint) {
+}
+
+UdpSink::~UdpSink() {
+}
+
+bool UdpSink::send(const void *, size_t) {
+    return false;
+}
+
+UdpSource::UdpSource(const UdpEndpoint &, ReceiverQueue * queue) : mFd(-1), mQueue(queue), mQuit(false) {
+}
+
+UdpSource::~UdpSource() {
+}
+
+void UdpSource::run() {
+}
+#endif
+
+}  // namespace cmxs_mock
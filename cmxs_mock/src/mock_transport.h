@@ -0,0 +1,164 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Moves the datagrams from the mock senders to the mock receivers:
+ * in process through the Hub, or between processes over loopback UDP multicast.
+ */
+
+#ifndef CMXS_MOCK_TRANSPORT_H
+#define CMXS_MOCK_TRANSPORT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cmxssdk/cmxssdk.h>
+
+namespace cmxs_mock {
+
+typedef std::chrono::steady_clock Clock;
+
+class Impairment;
+
+// Settings from the environment, read once.
+struct MockConfig {
+    // CMXS_MOCK_CONNECT_MS: delay of CMXSMSG_ServerConnected after create.
+    uint32_t connectDelayMs;
+    // CMXS_MOCK_UDP_PORT: use loopback UDP multicast instead of the in-process hub, 0 for none.
+    // Each stream key has its group and port from this one, see UdpEndpoint.
+    uint16_t udpPort;
+    // CMXS_MOCK_QUEUE: max datagrams waiting in a receiver, the oldest are dropped.
+    size_t queueCapacity;
+    // CMXS_MOCK_REPLAY: capture file (common/cmxs_capture.h) the receivers get instead of the senders' data.
+    std::string replayPath;
+    // CMXS_MOCK_REPLAY_SPEED: 1 for the captured timing, 2 for twice as fast..., 0 for as fast as possible.
+    double replaySpeed;
+
+    static const MockConfig & get();
+};
+
+// Datagrams waiting for Receiver::receive.
+class ReceiverQueue {
+ public:
+    explicit ReceiverQueue(size_t capacity);
+
+    // The datagrams pushed without a time go through it first, nullptr for none. Set before the first push.
+    void setImpairment(Impairment * impairment) { mImpairment = impairment; }
+
+    // The datagram can be received from time at.
+    void push(const void * data, size_t len, Clock::time_point at);
+    // The datagram arrives now.
+    void push(const void * data, size_t len);
+
+    // Same contract as Receiver::receive.
+    CMXSErr pop(void * buf, uint32_t * len, int32_t timeoutMs);
+
+    // Wait until a datagram can be pushed without dropping one. Returns false if closed.
+    bool waitNotFull();
+
+    // Wake up and fail the waiting pop(), for destroy.
+    void close();
+
+    uint64_t dropped() const { return mDropped; }
+
+ private:
+    struct Datagram {
+        std::vector<uint8_t> data;
+        Clock::time_point at;
+    };
+
+    const size_t mCapacity;
+    Impairment * mImpairment;
+    std::mutex mMtx;
+    std::condition_variable mCond;
+    std::condition_variable mNotFull;
+    // sorted by time
+    std::deque<Datagram> mDatagrams;
+    bool mClosed;
+    std::atomic<uint64_t> mDropped;
+};
+
+// In-process fan out, by stream key.
+class Hub {
+ public:
+    static Hub & instance();
+
+    void attach(const std::string & key, ReceiverQueue * queue);
+    void detach(const std::string & key, ReceiverQueue * queue);
+    // Returns false if no receiver uses the key.
+    bool publish(const std::string & key, const void * data, size_t len);
+
+ private:
+    std::mutex mMtx;
+    std::map<std::string, std::set<ReceiverQueue *>> mReceivers;
+};
+
+// The multicast group and port of a stream key: 239.255.x.y and basePort + 0..999 from a hash of
+// the key. Every receiver of the key gets the datagrams, and a relay does not get what it sends
+// to its other keys.
+struct UdpEndpoint {
+    UdpEndpoint(uint16_t basePort, const std::string & key);
+
+    // host order
+    uint32_t group;
+    uint16_t port;
+};
+
+// Loopback UDP multicast, between the processes using the mock.
+class UdpSink {
+ public:
+    explicit UdpSink(const UdpEndpoint & endpoint);
+    ~UdpSink();
+    bool send(const void * data, size_t len);
+
+ private:
+    int mFd;
+    const UdpEndpoint mEndpoint;
+};
+
+// Joins the multicast group of a stream key, and reads it into a queue.
+class UdpSource {
+ public:
+    UdpSource(const UdpEndpoint & endpoint, ReceiverQueue * queue);
+    ~UdpSource();
+    bool ok() const { return mFd >= 0; }
+
+ private:
+    void run();
+
+    int mFd;
+    ReceiverQueue * mQueue;
+    std::atomic<bool> mQuit;
+    std::thread mThread;
+};
+
+}  // namespace cmxs_mock
+
+#endif  // CMXS_MOCK_TRANSPORT_H
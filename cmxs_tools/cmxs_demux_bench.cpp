@@ -0,0 +1,343 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+
+/*
+ * cmxs-demux-bench: time the TS demuxer of the CMXS source (common/cmxs_ts_demux.h) on a recording,
+ * and libavformat on the same data when the tool is built with it.
+ *
+ * The recording is a capture of a CMXS source (.cmxscap), or a TS file cut into datagrams.
+ * It is read into memory first, both demuxers then run from memory: the loopback UDP the source
+ * used to go through to libavformat is not counted. The AAC frames are counted one by one on both
+ * sides, as libavformat splits them, and the packets of every PID are compared.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cmxs_capture.h"
+#include "cmxs_ts_demux.h"
+
+#ifdef CMXS_BENCH_LIBAVFORMAT
+extern "C" {
+#include <libavformat/avformat.h>
+}
+#endif
+
+using namespace cmxs_common;
+
+static const char * kUsage =
+    "usage: cmxs-demux-bench [-n runs] [-l datagram_size] file\n"
+    "  file: a capture of a CMXS source (.cmxscap), or a TS file cut into datagrams of datagram_size (1316) bytes.\n";
+
+// What is compared of a packet.
+struct BenchPacket {
+    int64_t pts;                // 33 bits, -1 if none
+    size_t size;
+};
+
+typedef std::map<int, std::vector<BenchPacket>> BenchPackets;
+
+struct BenchResult {
+    double seconds = 0;         // of all the runs
+    uint64_t packets = 0;       // of one run
+    BenchPackets byPid;
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int64_t bench33(int64_t pts) {
+    return pts == kTsNoTimestamp ? -1 : pts & (kTsTimestampWrap - 1);
+}
+
+static bool loadDatagrams(const std::string & path, size_t datagramSize, std::vector<std::vector<uint8_t>> & datagrams) {
+    CaptureReader capture;
+    if (capture.open(path)) {
+        std::vector<uint8_t> data;
+        uint64_t timeNs = 0;
+        while (capture.next(data, timeNs)) {
+            datagrams.push_back(data);
+        }
+        return true;
+    }
+    FILE * file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    std::vector<uint8_t> data(datagramSize);
+    size_t size;
+    while ((size = fread(data.data(), 1, data.size(), file)) > 0) {
+        datagrams.push_back(std::vector<uint8_t>(data.begin(), data.begin() + size));
+    }
+    fclose(file);
+    return true;
+}
+
+static void benchNative(const std::vector<std::vector<uint8_t>> & datagrams, int runs, BenchResult & result,
+    TsDemuxStats & stats, TsPidQuality & quality) {
+    for (int run = 0; run < runs; ++run) {
+        const bool record = run == 0;
+        uint64_t packets = 0;
+        TsDemuxer demux;
+        auto onFrame = [&](TsFrame & frame) {
+            if (frame.streamType != kTsStreamTypeAAC) {
+                ++packets;
+                if (record) {
+                    result.byPid[frame.pid].push_back(BenchPacket{bench33(frame.pts), frame.size});
+                }
+                return;
+            }
+            // as the source splits them
+            int64_t pts = frame.pts;
+            const uint8_t * data = frame.data;
+            size_t size = frame.size;
+            AdtsHeader adts;
+            while (size > 0) {
+                size_t frameSize = size;
+                int sampleRate = 0;
+                if (parseAdtsHeader(data, size, adts)) {
+                    frameSize = adts.frameSize;
+                    sampleRate = adts.sampleRate;
+                }
+                ++packets;
+                if (record) {
+                    result.byPid[frame.pid].push_back(BenchPacket{bench33(pts), frameSize});
+                }
+                data += frameSize;
+                size -= frameSize;
+                if (pts != kTsNoTimestamp && sampleRate) {
+                    pts += aacFrameDuration(sampleRate);
+                }
+            }
+        };
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (const std::vector<uint8_t> & datagram : datagrams) {
+            demux.feed(datagram.data(), datagram.size(), onFrame);
+        }
+        demux.flush(onFrame);
+        result.seconds += secondsSince(start);
+        result.packets = packets;
+        stats = demux.stats();
+        quality = demux.quality().total();
+    }
+}
+
+#ifdef CMXS_BENCH_LIBAVFORMAT
+struct MemoryInput {
+    const std::vector<uint8_t> * data;
+    size_t offset;
+};
+
+static int readMemory(void * opaque, uint8_t * buf, int size) {
+    MemoryInput * input = static_cast<MemoryInput *>(opaque);
+    size_t left = input->data->size() - input->offset;
+    if (!left) {
+        return AVERROR_EOF;
+    }
+    size_t n = std::min(left, static_cast<size_t>(size));
+    memcpy(buf, input->data->data() + input->offset, n);
+    input->offset += n;
+    return static_cast<int>(n);
+}
+
+// The probe (avformat_find_stream_info) is timed apart, the source did it once per pulling.
+static bool benchLibavformat(const std::vector<uint8_t> & ts, int runs, BenchResult & result, double & probeSeconds) {
+    const AVInputFormat * mpegts = av_find_input_format("mpegts");
+    for (int run = 0; run < runs; ++run) {
+        const bool record = run == 0;
+        MemoryInput input = {&ts, 0};
+        const int ioSize = 32 * 1024;
+        uint8_t * ioBuffer = static_cast<uint8_t *>(av_malloc(ioSize));
+        AVIOContext * io = avio_alloc_context(ioBuffer, ioSize, 0, &input, readMemory, nullptr, nullptr);
+        AVFormatContext * ctx = avformat_alloc_context();
+        if (!io || !ctx) {
+            avformat_free_context(ctx);
+            if (io) {
+                av_freep(&io->buffer);
+            } else {
+                av_free(ioBuffer);
+            }
+            avio_context_free(&io);
+            return false;
+        }
+        ctx->pb = io;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        // avformat_open_input() frees ctx when it fails, the custom io is ours.
+        if (avformat_open_input(&ctx, nullptr, mpegts, nullptr) != 0 || avformat_find_stream_info(ctx, nullptr) < 0) {
+            avformat_close_input(&ctx);
+            av_freep(&io->buffer);
+            avio_context_free(&io);
+            return false;
+        }
+        probeSeconds += secondsSince(start);
+        start = std::chrono::steady_clock::now();
+        uint64_t packets = 0;
+        AVPacket * packet = av_packet_alloc();
+        while (av_read_frame(ctx, packet) >= 0) {
+            ++packets;
+            if (record) {
+                AVStream * stream = ctx->streams[packet->stream_index];
+                result.byPid[stream->id].push_back(BenchPacket{
+                    packet->pts == AV_NOPTS_VALUE ? -1 : packet->pts & (kTsTimestampWrap - 1),
+                    static_cast<size_t>(packet->size)});
+            }
+            av_packet_unref(packet);
+        }
+        result.seconds += secondsSince(start);
+        result.packets = packets;
+        av_packet_free(&packet);
+        avformat_close_input(&ctx);
+        // the buffer may have been replaced by libavformat.
+        av_freep(&io->buffer);
+        avio_context_free(&io);
+    }
+    return true;
+}
+
+// Returns true if both have the same packets. The AAC timestamps libavformat interpolates may be
+// rounded another way, 1 tick apart is the same.
+static bool comparePackets(const BenchPackets & native, const BenchPackets & libav) {
+    bool same = true;
+    for (const auto & entry : libav) {
+        auto it = native.find(entry.first);
+        if (it == native.end()) {
+            printf("  pid %d: %zu packets from libavformat only\n", entry.first, entry.second.size());
+            same = false;
+            continue;
+        }
+        const std::vector<BenchPacket> & a = it->second;
+        const std::vector<BenchPacket> & b = entry.second;
+        size_t i = 0;
+        for (; i < a.size() && i < b.size(); ++i) {
+            if (a[i].size != b[i].size || std::abs(a[i].pts - b[i].pts) > 1) {
+                break;
+            }
+        }
+        if (i == a.size() && i == b.size()) {
+            printf("  pid %d: same %zu packets\n", entry.first, a.size());
+            continue;
+        }
+        same = false;
+        printf("  pid %d: %zu packets, libavformat %zu, differ from packet %zu", entry.first, a.size(), b.size(), i);
+        if (i < a.size() && i < b.size()) {
+            printf(" (pts %lld size %zu, libavformat pts %lld size %zu)", static_cast<long long>(a[i].pts), a[i].size,
+                static_cast<long long>(b[i].pts), b[i].size);
+        }
+        printf("\n");
+    }
+    for (const auto & entry : native) {
+        if (!libav.count(entry.first)) {
+            printf("  pid %d: %zu packets from the native demuxer only\n", entry.first, entry.second.size());
+            same = false;
+        }
+    }
+    return same;
+}
+#endif
+
+static void printRate(const char * name, const BenchResult & result, int runs, uint64_t bytes) {
+    double perRun = result.seconds / runs;
+    printf("%-12s %8.2f ms/run %9.1f MB/s %8.2f us/packet, %llu packets\n", name, perRun * 1e3,
+        perRun > 0 ? bytes / perRun / 1e6 : 0.0,
+        result.packets ? perRun * 1e6 / result.packets : 0.0, static_cast<unsigned long long>(result.packets));
+}
+
+int main(int argc, char * argv[]) {
+    int runs = 10;
+    size_t datagramSize = 1316;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                runs = atoi(optarg);
+                break;
+            case 'l':
+                datagramSize = static_cast<size_t>(strtoul(optarg, nullptr, 10));
+                break;
+            default:
+                fprintf(stderr, "%s", kUsage);
+                return 1;
+        }
+    }
+    if (optind + 1 != argc || runs < 1 || datagramSize < kTsPacketSize) {
+        fprintf(stderr, "%s", kUsage);
+        return 1;
+    }
+    const std::string path = argv[optind];
+
+    std::vector<std::vector<uint8_t>> datagrams;
+    if (!loadDatagrams(path, datagramSize, datagrams)) {
+        fprintf(stderr, "cannot read %s\n", path.c_str());
+        return 1;
+    }
+    uint64_t bytes = 0;
+    for (const std::vector<uint8_t> & datagram : datagrams) {
+        bytes += datagram.size();
+    }
+    printf("%s: %zu datagrams, %.1f MB, %d runs\n", path.c_str(), datagrams.size(), bytes / 1e6, runs);
+
+    BenchResult native;
+    TsDemuxStats stats;
+    TsPidQuality quality;
+    benchNative(datagrams, runs, native, stats, quality);
+    printRate("native", native, runs, bytes);
+    printf("  %llu TS packets, %llu frames, %llu continuity errors (%llu TS packets lost), %llu duplicates, "
+        "%llu corrupt frames, %llu sync losses\n",
+        static_cast<unsigned long long>(stats.packets), static_cast<unsigned long long>(stats.frames),
+        static_cast<unsigned long long>(quality.ccErrors), static_cast<unsigned long long>(quality.lostPackets),
+        static_cast<unsigned long long>(quality.duplicates), static_cast<unsigned long long>(stats.corruptFrames),
+        static_cast<unsigned long long>(stats.syncLosses));
+
+#ifdef CMXS_BENCH_LIBAVFORMAT
+    std::vector<uint8_t> ts;
+    ts.reserve(bytes);
+    for (const std::vector<uint8_t> & datagram : datagrams) {
+        ts.insert(ts.end(), datagram.begin(), datagram.end());
+    }
+    av_log_set_level(AV_LOG_ERROR);
+    BenchResult libav;
+    double probeSeconds = 0;
+    if (!benchLibavformat(ts, runs, libav, probeSeconds)) {
+        fprintf(stderr, "libavformat cannot open the stream\n");
+        return 1;
+    }
+    printRate("libavformat", libav, runs, bytes);
+    printf("  and %.2f ms/run of avformat_find_stream_info before the first packet\n", probeSeconds / runs * 1e3);
+    if (native.seconds > 0) {
+        printf("native is %.1fx faster\n", libav.seconds / native.seconds);
+    }
+    return comparePackets(native.byPid, libav.byPid) ? 0 : 2;
+#else
+    printf("built without libavformat, nothing to compare with\n");
+    return 0;
+#endif
+}
@@ -0,0 +1,319 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * cmxs-recv: receive a CMXS stream and write the TS to a file or a pipe.
+ *
+ * The datagrams are received back to back into a page aligned ring, and written by batches
+ * with one call: vmsplice() when the output is a pipe on Linux, so the pages are given to the
+ * pipe without a copy, write() otherwise. A batch is written when it is 64KB, 10ms old,
+ * or when no data comes. The ring is twice the pipe size, so a page is received into again
+ * only once the reader read it; a reader which splices the pipe onward would keep references
+ * to the pages, use a plain read() on the other end.
+ *
+ * Stats: the rate, the output delay (arrival to written), and the PCR jitter, the arrival
+ * delay variation of the datagrams carrying a PCR, from the smallest delay seen.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/uio.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <cmxssdk/cmxssdk.h>
+
+#include "cmxs_tool.h"
+#include "cmxs_ts.h"
+
+using namespace cmxs_tools;
+
+static const char * kUsage =
+    "usage: cmxs-recv -s server -d device -k key [-o file|-] [-l max_datagram_size]\n"
+    "                 [-i stats_interval_s] [-t duration_s] [-c connect_timeout_ms] [-v]\n"
+    "  the TS is written to stdout by default.\n";
+
+static constexpr size_t kFlushBytes = 64 * 1024;
+static constexpr int64_t kFlushAgeUs = 10000;
+
+class RecvOutput {
+ public:
+    RecvOutput(int fd, size_t maxDatagram) : mFd(fd), mPipe(false), mFailed(false) {
+        size_t ringSize = 4 * 1024 * 1024;
+#ifdef __linux__
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+            int pipeSize = fcntl(fd, F_GETPIPE_SZ);
+            if (pipeSize > 0) {
+                mPipe = true;
+                // a page is received into again once most of the ring went through the pipe,
+                // which holds at most pipeSize bytes: it is read by then.
+                ringSize = std::max(ringSize, static_cast<size_t>(pipeSize) * 2);
+            }
+        }
+#endif
+        ringSize = std::max(ringSize, maxDatagram * 4);
+        long pageSize = sysconf(_SC_PAGESIZE);
+        mRingSize = (ringSize + pageSize - 1) / pageSize * pageSize;
+        void * ring = nullptr;
+        if (posix_memalign(&ring, pageSize, mRingSize) != 0) {
+            ring = nullptr;
+        }
+        mRing = static_cast<uint8_t *>(ring);
+        mStart = 0;
+        mEnd = 0;
+    }
+
+    ~RecvOutput() {
+        free(mRing);
+    }
+
+    bool ok() const { return mRing && !mFailed; }
+    bool pipe() const { return mPipe; }
+
+    // Room for a datagram of size bytes, the batch is written first if it must wrap.
+    uint8_t * reserve(size_t size) {
+        if (mRingSize - mEnd < size) {
+            flush();
+            mStart = 0;
+            mEnd = 0;
+        }
+        return mRing + mEnd;
+    }
+
+    void commit(size_t size, int64_t arrivalUs) {
+        if (mStart == mEnd) {
+            mBatchArrivalUs = arrivalUs;
+        }
+        mEnd += size;
+    }
+
+    // Write the batch if it is big or old enough, or always with force.
+    void flushIfNeeded(int64_t nowUs, bool force) {
+        if (mStart == mEnd) {
+            return;
+        }
+        if (force || mEnd - mStart >= kFlushBytes || nowUs - mBatchArrivalUs >= kFlushAgeUs) {
+            flush();
+        }
+    }
+
+    IntervalStat & delay() { return mDelay; }
+
+ private:
+    void flush() {
+        while (mStart < mEnd && !mFailed) {
+            ssize_t written;
+#ifdef __linux__
+            if (mPipe) {
+                struct iovec iov = {mRing + mStart, mEnd - mStart};
+                written = vmsplice(mFd, &iov, 1, 0);
+            } else {
+                written = write(mFd, mRing + mStart, mEnd - mStart);
+            }
+#else
+            written = write(mFd, mRing + mStart, mEnd - mStart);
+#endif
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "write failed: %s\n", strerror(errno));
+                mFailed = true;
+                return;
+            }
+            mStart += static_cast<size_t>(written);
+        }
+        mDelay.add(nowUs() - mBatchArrivalUs);
+    }
+
+    const int mFd;
+    bool mPipe;
+    uint8_t * mRing;
+    size_t mRingSize;
+    // the batch not written yet
+    size_t mStart;
+    size_t mEnd;
+    int64_t mBatchArrivalUs;
+    bool mFailed;
+    IntervalStat mDelay;
+};
+
+// Arrival delay variation of the PCRs of the first PCR PID.
+class PcrJitter {
+ public:
+    PcrJitter() : mPcrPid(-1), mHasBase(false), mMinDelayUs(0), mLastPcrUs(0) {}
+
+    void add(const uint8_t * data, size_t size, int64_t arrivalUs) {
+        for (size_t offset = 0; offset + cmxs_common::kTsPacketSize <= size; offset += cmxs_common::kTsPacketSize) {
+            cmxs_common::TsPacket pkt;
+            if (!cmxs_common::parseTsPacket(data + offset, pkt) || !pkt.hasPcr) {
+                continue;
+            }
+            if (mPcrPid < 0) {
+                mPcrPid = pkt.pid;
+            }
+            if (pkt.pid != mPcrPid) {
+                continue;
+            }
+            int64_t pcrUs = static_cast<int64_t>(pkt.pcr / 27);
+            int64_t delayUs = arrivalUs - pcrUs;
+            if (pkt.discontinuity || !mHasBase || pcrUs < mLastPcrUs || pcrUs - mLastPcrUs > 1000000) {
+                // a new timeline, e.g. the sender restarted or the PCR wrapped.
+                mHasBase = true;
+                mMinDelayUs = delayUs;
+            }
+            mLastPcrUs = pcrUs;
+            if (delayUs < mMinDelayUs) {
+                mMinDelayUs = delayUs;
+            }
+            mJitter.add(delayUs - mMinDelayUs);
+        }
+    }
+
+    IntervalStat & jitter() { return mJitter; }
+
+ private:
+    int mPcrPid;
+    bool mHasBase;
+    int64_t mMinDelayUs;
+    int64_t mLastPcrUs;
+    IntervalStat mJitter;
+};
+
+int main(int argc, char * argv[]) {
+    ToolOptions options;
+    if (!parseOptions(argc, argv, "o:", [&options](int, const char * arg) {
+            options.path = arg;
+            return true;
+        }, kUsage, options)) {
+        return 2;
+    }
+    setupSignals();
+    setupLog(options.verbose);
+
+    int fd = STDOUT_FILENO;
+    if (options.path != "-") {
+        fd = open(options.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "cannot open %s: %s\n", options.path.c_str(), strerror(errno));
+            return 1;
+        }
+    }
+
+    CMXSConfig_t cmxsCfg;
+    cmxsCfg.mServer = options.server.c_str();
+    cmxsCfg.mDeviceId = options.device.c_str();
+    CMXSErr err = CMXSSDK::init(&cmxsCfg, nullptr);
+    if (err != CMXSERR_OK) {
+        fprintf(stderr, "CMXSSDK::init failed: %d(%s)\n", err, cmxssdk_error_str(err));
+        return 1;
+    }
+
+    ToolListener listener;
+    CMXSStreamParam_t streamCfg;
+    memset(&streamCfg, 0, sizeof(CMXSStreamParam_t));
+    streamCfg.mStreamkey = options.key.c_str();
+    Receiver * receiver = Receiver::create(&streamCfg, &listener);
+    if (!receiver) {
+        fprintf(stderr, "Failed to create receiver\n");
+        CMXSSDK::uninit();
+        return 1;
+    }
+
+    int ret = 0;
+    if (!listener.waitConnected(options.connectTimeoutMs)) {
+        fprintf(stderr, "not connected\n");
+        ret = 1;
+    } else {
+        uint32_t maxSize = options.datagramSize;
+        RecvOutput output(fd, 64 * 1024);
+        if (!output.ok()) {
+            fprintf(stderr, "no memory\n");
+            ret = 1;
+        } else {
+            fprintf(stderr, "connected, writing to %s%s\n", options.path.c_str(), output.pipe() ? " (pipe)" : "");
+        }
+
+        PcrJitter pcr;
+        RateMeter meter(options.statsInterval);
+        uint64_t timeouts = 0;
+        const int64_t endUs = options.duration ? nowUs() + options.duration * 1000000LL : 0;
+        while (ret == 0 && !quitRequested() && output.ok() && (!endUs || nowUs() < endUs)) {
+            uint32_t size = maxSize;
+            uint8_t * buf = output.reserve(size);
+            err = receiver->receive(buf, &size, 0, 10);
+            int64_t now = nowUs();
+            switch (err) {
+                case CMXSERR_OK:
+                    output.commit(size, now);
+                    meter.add(size);
+                    pcr.add(buf, size, now);
+                    output.flushIfNeeded(now, false);
+                    break;
+                case CMXSERR_BufferNotEnough:
+                    if (size > 64 * 1024) {
+                        fprintf(stderr, "datagram too large: %u\n", size);
+                        ret = 1;
+                    }
+                    maxSize = size;
+                    break;
+                case CMXSERR_Again:
+                    ++timeouts;
+                    output.flushIfNeeded(now, true);
+                    break;
+                default:
+                    fprintf(stderr, "receive: %d(%s)\n", err, cmxssdk_error_str(err));
+                    output.flushIfNeeded(now, true);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    break;
+            }
+            if (meter.due(now)) {
+                fprintf(stderr, "recv: %s, output delay(ms) %s, pcr jitter(ms) %s, idle 10ms %llu\n",
+                    meter.rate().c_str(), output.delay().msString().c_str(), pcr.jitter().msString().c_str(),
+                    static_cast<unsigned long long>(timeouts));
+                output.delay().reset();
+                pcr.jitter().reset();
+                timeouts = 0;
+            }
+        }
+        output.flushIfNeeded(nowUs(), true);
+        fprintf(stderr, "received %llu bytes\n", static_cast<unsigned long long>(meter.totalBytes()));
+    }
+
+    Receiver::destroy(receiver);
+    CMXSSDK::uninit();
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+    return ret;
+}
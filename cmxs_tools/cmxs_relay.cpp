@@ -0,0 +1,323 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * cmxs-relay: forward one CMXS stream to several stream keys, without decoding or remuxing.
+ *
+ * Each received datagram is shared by all the legs, it is not copied. Every leg has its
+ * own sender, queue and thread, so a slow destination only fills its own queue. When a
+ * queue is full, the leg drops by its policy: the oldest datagram (the default, the leg
+ * catches up with the live stream) or the new one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cmxssdk/cmxssdk.h>
+
+#include "cmxs_tool.h"
+
+using namespace cmxs_tools;
+
+static const char * kUsage =
+    "usage: cmxs-relay -s server -d device -k key -o key[,drop=oldest|newest][,queue=datagrams] [-o ...]\n"
+    "                  [-l max_datagram_size] [-i stats_interval_s] [-t duration_s] [-c connect_timeout_ms] [-v]\n"
+    "  the stream of -k is sent to every -o key, queue is 2048 datagrams by default.\n";
+
+typedef std::shared_ptr<const std::vector<uint8_t>> datagram_ptr;
+
+struct LegConfig {
+    std::string key;
+    bool dropNewest = false;
+    size_t queueSize = 2048;
+};
+
+// "key[,drop=oldest|newest][,queue=n]"
+static bool parseLeg(const char * arg, LegConfig & leg) {
+    std::string str = arg;
+    size_t pos = str.find(',');
+    leg.key = str.substr(0, pos);
+    while (pos != std::string::npos) {
+        size_t next = str.find(',', pos + 1);
+        std::string item = str.substr(pos + 1, next == std::string::npos ? std::string::npos : next - pos - 1);
+        if (item == "drop=oldest") {
+            leg.dropNewest = false;
+        } else if (item == "drop=newest") {
+            leg.dropNewest = true;
+        } else if (item.compare(0, 6, "queue=") == 0 && atoi(item.c_str() + 6) > 0) {
+            leg.queueSize = static_cast<size_t>(atoi(item.c_str() + 6));
+        } else {
+            return false;
+        }
+        pos = next;
+    }
+    return !leg.key.empty();
+}
+
+class RelayLeg {
+ public:
+    explicit RelayLeg(const LegConfig & cfg)
+        : mCfg(cfg),
+        mSender(nullptr),
+        mQuit(false),
+        mDead(false),
+        mDropped(0),
+        mMaxDepth(0),
+        mMeter(0) {
+    }
+
+    ~RelayLeg() {
+        stop();
+        if (mSender) {
+            Sender::destroy(mSender);
+        }
+    }
+
+    const std::string & key() const { return mCfg.key; }
+
+    bool start(uint32_t connectTimeoutMs) {
+        CMXSStreamParam_t streamCfg;
+        memset(&streamCfg, 0, sizeof(CMXSStreamParam_t));
+        streamCfg.mStreamkey = mCfg.key.c_str();
+        mSender = Sender::create(&streamCfg, &mListener);
+        if (!mSender) {
+            fprintf(stderr, "%s: failed to create sender\n", mCfg.key.c_str());
+            return false;
+        }
+        mThread = std::thread(&RelayLeg::run, this, connectTimeoutMs);
+        return true;
+    }
+
+    void stop() {
+        {
+            std::unique_lock<std::mutex> locker(mMtx);
+            mQuit = true;
+            mCond.notify_all();
+        }
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+    }
+
+    // Never blocks, the datagram is dropped by the policy if the queue is full.
+    void push(const datagram_ptr & datagram) {
+        std::unique_lock<std::mutex> locker(mMtx);
+        if (mDead) {
+            ++mDropped;
+            return;
+        }
+        if (mQueue.size() >= mCfg.queueSize) {
+            ++mDropped;
+            if (mCfg.dropNewest) {
+                return;
+            }
+            mQueue.pop_front();
+        }
+        mQueue.push_back(datagram);
+        mMaxDepth = std::max(mMaxDepth, mQueue.size());
+        mCond.notify_one();
+    }
+
+    // The stats line of the leg, the interval counters restart.
+    std::string stats() {
+        uint64_t dropped;
+        size_t maxDepth;
+        {
+            std::unique_lock<std::mutex> locker(mMtx);
+            dropped = mDropped;
+            maxDepth = mMaxDepth;
+            mDropped = 0;
+            mMaxDepth = mQueue.size();
+        }
+        std::string rate;
+        {
+            std::unique_lock<std::mutex> locker(mMeterMtx);
+            mMeter.take(nowUs());
+            rate = mMeter.rate();
+        }
+        char str[256];
+        snprintf(str, sizeof(str), "%s: %s, dropped %llu, max queue %zu%s", mCfg.key.c_str(), rate.c_str(),
+            static_cast<unsigned long long>(dropped), maxDepth, mDead ? ", not connected" : "");
+        return str;
+    }
+
+ private:
+    void run(uint32_t connectTimeoutMs) {
+        if (!mListener.waitConnected(connectTimeoutMs)) {
+            fprintf(stderr, "%s: not connected, its datagrams are dropped\n", mCfg.key.c_str());
+            std::unique_lock<std::mutex> locker(mMtx);
+            mDead = true;
+            mDropped += mQueue.size();
+            mQueue.clear();
+            return;
+        }
+        while (true) {
+            datagram_ptr datagram;
+            {
+                std::unique_lock<std::mutex> locker(mMtx);
+                mCond.wait(locker, [this]() { return mQuit || !mQueue.empty(); });
+                if (mQuit) {
+                    return;
+                }
+                datagram = std::move(mQueue.front());
+                mQueue.pop_front();
+            }
+            CMXSErr err;
+            do {
+                err = mSender->send(datagram->data(), static_cast<uint32_t>(datagram->size()), 100);
+            } while (err == CMXSERR_Again && !mQuit);
+            if (err == CMXSERR_OK) {
+                std::unique_lock<std::mutex> locker(mMeterMtx);
+                mMeter.add(datagram->size());
+            }
+        }
+    }
+
+    const LegConfig mCfg;
+    Sender * mSender;
+    ToolListener mListener;
+    std::thread mThread;
+
+    std::mutex mMtx;
+    std::condition_variable mCond;
+    std::deque<datagram_ptr> mQueue;
+    bool mQuit;
+    // not connected, everything is dropped.
+    std::atomic<bool> mDead;
+    uint64_t mDropped;
+    size_t mMaxDepth;
+
+    // counted by the leg thread, read by stats().
+    std::mutex mMeterMtx;
+    RateMeter mMeter;
+};
+
+int main(int argc, char * argv[]) {
+    ToolOptions options;
+    std::vector<LegConfig> legConfigs;
+    if (!parseOptions(argc, argv, "o:", [&legConfigs](int, const char * arg) {
+            LegConfig leg;
+            if (!parseLeg(arg, leg)) {
+                return false;
+            }
+            legConfigs.push_back(leg);
+            return true;
+        }, kUsage, options)) {
+        return 2;
+    }
+    if (legConfigs.empty()) {
+        fprintf(stderr, "%s", kUsage);
+        return 2;
+    }
+    setupSignals();
+    setupLog(options.verbose);
+
+    CMXSConfig_t cmxsCfg;
+    cmxsCfg.mServer = options.server.c_str();
+    cmxsCfg.mDeviceId = options.device.c_str();
+    CMXSErr err = CMXSSDK::init(&cmxsCfg, nullptr);
+    if (err != CMXSERR_OK) {
+        fprintf(stderr, "CMXSSDK::init failed: %d(%s)\n", err, cmxssdk_error_str(err));
+        return 1;
+    }
+
+    int ret = 0;
+    std::vector<std::unique_ptr<RelayLeg>> legs;
+    for (const LegConfig & cfg : legConfigs) {
+        legs.emplace_back(new RelayLeg(cfg));
+        if (!legs.back()->start(options.connectTimeoutMs)) {
+            ret = 1;
+        }
+    }
+
+    ToolListener listener;
+    CMXSStreamParam_t streamCfg;
+    memset(&streamCfg, 0, sizeof(CMXSStreamParam_t));
+    streamCfg.mStreamkey = options.key.c_str();
+    Receiver * receiver = ret ? nullptr : Receiver::create(&streamCfg, &listener);
+    if (!ret && !receiver) {
+        fprintf(stderr, "Failed to create receiver\n");
+        ret = 1;
+    }
+
+    if (receiver && !listener.waitConnected(options.connectTimeoutMs)) {
+        fprintf(stderr, "not connected\n");
+        ret = 1;
+    } else if (receiver) {
+        fprintf(stderr, "connected, relaying %s to %zu keys\n", options.key.c_str(), legs.size());
+        uint32_t maxSize = options.datagramSize;
+        // reused until a datagram is received into it, the legs then keep it.
+        std::shared_ptr<std::vector<uint8_t>> datagram = std::make_shared<std::vector<uint8_t>>(maxSize);
+        RateMeter meter(options.statsInterval);
+        const int64_t endUs = options.duration ? nowUs() + options.duration * 1000000LL : 0;
+        while (!quitRequested() && (!endUs || nowUs() < endUs)) {
+            uint32_t size = maxSize;
+            err = receiver->receive(datagram->data(), &size, 0, 100);
+            switch (err) {
+                case CMXSERR_OK:
+                    datagram->resize(size);
+                    meter.add(size);
+                    for (std::unique_ptr<RelayLeg> & leg : legs) {
+                        leg->push(datagram);
+                    }
+                    datagram = std::make_shared<std::vector<uint8_t>>(maxSize);
+                    break;
+                case CMXSERR_BufferNotEnough:
+                    maxSize = size;
+                    datagram->resize(maxSize);
+                    break;
+                case CMXSERR_Again:
+                    break;
+                default:
+                    fprintf(stderr, "receive: %d(%s)\n", err, cmxssdk_error_str(err));
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    break;
+            }
+            if (meter.due(nowUs())) {
+                fprintf(stderr, "relay in: %s\n", meter.rate().c_str());
+                for (std::unique_ptr<RelayLeg> & leg : legs) {
+                    fprintf(stderr, "  %s\n", leg->stats().c_str());
+                }
+            }
+        }
+        fprintf(stderr, "received %llu bytes\n", static_cast<unsigned long long>(meter.totalBytes()));
+    }
+
+    if (receiver) {
+        Receiver::destroy(receiver);
+    }
+    legs.clear();
+    CMXSSDK::uninit();
+    return ret;
+}
@@ -0,0 +1,298 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * cmxs-send: send a TS file or stdin on a CMXS stream, paced by its PCR.
+ *
+ * The datagrams between two PCRs of the first PCR PID are sent evenly spread between
+ * the times of these PCRs, so the stream goes out at its own rate instead of at the
+ * speed of the disk. The datagrams before the first PCR go at once. A PCR going back or
+ * jumping by more than a second starts a new timeline, e.g. when looping the file.
+ *
+ * Stats: the rate, the lateness of the sends after their scheduled time,
+ * and the duration of the Sender::send calls.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cmxssdk/cmxssdk.h>
+
+#include "cmxs_tool.h"
+#include "cmxs_ts.h"
+
+using namespace cmxs_tools;
+
+static const char * kUsage =
+    "usage: cmxs-send -s server -d device -k key [-f file|-] [-l datagram_size] [-L]\n"
+    "                 [-i stats_interval_s] [-t duration_s] [-c connect_timeout_ms] [-v]\n"
+    "  the TS is read from stdin by default, -L restarts the file at its end.\n";
+
+// Max datagrams waiting for the next PCR, the PCR interval is 100ms at most in a valid TS.
+static constexpr size_t kMaxPendingDatagrams = 4096;
+
+class PcrPacer {
+ public:
+    PcrPacer(Sender * sender, const ToolOptions & options)
+        : mSender(sender),
+        mMeter(options.statsInterval),
+        mPcrPid(-1),
+        mHasBase(false),
+        mBasePcrUs(0),
+        mBaseUs(0),
+        mLastPcrUs(0),
+        mLastUs(0),
+        mFailed(false) {
+    }
+
+    bool failed() const { return mFailed; }
+    uint64_t totalBytes() const { return mMeter.totalBytes(); }
+
+    // Queue a datagram, the ones before it are sent if it has a PCR.
+    void push(std::vector<uint8_t> && datagram) {
+        int64_t pcrUs = 0;
+        bool discontinuity = false;
+        if (!findPcr(datagram, pcrUs, discontinuity)) {
+            mPending.push_back(std::move(datagram));
+            if (mPending.size() >= kMaxPendingDatagrams) {
+                // no PCR for too long, not a stream to pace.
+                sendPending(nowUs(), nowUs());
+            }
+            return;
+        }
+
+        int64_t now = nowUs();
+        if (discontinuity || !mHasBase || pcrUs < mLastPcrUs || pcrUs - mLastPcrUs > 1000000) {
+            // a new timeline, continuing from the last scheduled time.
+            mHasBase = true;
+            mBasePcrUs = pcrUs;
+            mBaseUs = std::max(now, mLastUs);
+            mLastPcrUs = pcrUs;
+            mLastUs = mBaseUs;
+        }
+        int64_t at = mBaseUs + (pcrUs - mBasePcrUs);
+        mPending.push_back(std::move(datagram));
+        sendPending(mLastUs, at);
+        mLastPcrUs = pcrUs;
+        mLastUs = at;
+    }
+
+    // Send what is left, at once.
+    void flush() {
+        sendPending(nowUs(), nowUs());
+    }
+
+ private:
+    bool findPcr(const std::vector<uint8_t> & datagram, int64_t & pcrUs, bool & discontinuity) {
+        for (size_t offset = 0; offset + cmxs_common::kTsPacketSize <= datagram.size();
+            offset += cmxs_common::kTsPacketSize) {
+            cmxs_common::TsPacket pkt;
+            if (!cmxs_common::parseTsPacket(datagram.data() + offset, pkt) || !pkt.hasPcr) {
+                continue;
+            }
+            if (mPcrPid < 0) {
+                mPcrPid = pkt.pid;
+            }
+            if (pkt.pid == mPcrPid) {
+                pcrUs = static_cast<int64_t>(pkt.pcr / 27);
+                discontinuity = pkt.discontinuity;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Send the pending datagrams evenly from fromUs to toUs, the last one at toUs.
+    void sendPending(int64_t fromUs, int64_t toUs) {
+        size_t count = mPending.size();
+        for (size_t i = 0; i < count && !mFailed && !quitRequested(); ++i) {
+            int64_t at = fromUs + (toUs - fromUs) * static_cast<int64_t>(i + 1) / static_cast<int64_t>(count);
+            int64_t now = nowUs();
+            if (at > now) {
+                std::this_thread::sleep_for(std::chrono::microseconds(at - now));
+                now = nowUs();
+            }
+            mLate.add(now - at > 0 ? now - at : 0);
+            send(mPending[i]);
+        }
+        mPending.clear();
+    }
+
+    void send(const std::vector<uint8_t> & datagram) {
+        int64_t begin = nowUs();
+        CMXSErr err;
+        do {
+            err = mSender->send(datagram.data(), static_cast<uint32_t>(datagram.size()), 100);
+        } while (err == CMXSERR_Again && !quitRequested());
+        int64_t end = nowUs();
+        mSendCall.add(end - begin);
+        if (err != CMXSERR_OK) {
+            if (err != CMXSERR_Again) {
+                fprintf(stderr, "send: %d(%s)\n", err, cmxssdk_error_str(err));
+                mFailed = true;
+            }
+            return;
+        }
+        mMeter.add(datagram.size());
+        if (mMeter.due(end)) {
+            fprintf(stderr, "send: %s, late(ms) %s, send call(ms) %s\n",
+                mMeter.rate().c_str(), mLate.msString().c_str(), mSendCall.msString().c_str());
+            mLate.reset();
+            mSendCall.reset();
+        }
+    }
+
+    Sender * mSender;
+    RateMeter mMeter;
+    IntervalStat mLate;
+    IntervalStat mSendCall;
+    std::vector<std::vector<uint8_t>> mPending;
+    int mPcrPid;
+    bool mHasBase;
+    // the PCR time mBasePcrUs is sent at the steady time mBaseUs.
+    int64_t mBasePcrUs;
+    int64_t mBaseUs;
+    int64_t mLastPcrUs;
+    int64_t mLastUs;
+    bool mFailed;
+};
+
+// Read exactly size bytes, less only at the end of the input.
+static ssize_t readFull(int fd, uint8_t * buf, size_t size) {
+    size_t done = 0;
+    while (done < size && !quitRequested()) {
+        ssize_t n = read(fd, buf + done, size - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return static_cast<ssize_t>(done);
+}
+
+int main(int argc, char * argv[]) {
+    ToolOptions options;
+    if (!parseOptions(argc, argv, "f:L", [&options](int opt, const char * arg) {
+            if (opt == 'L') {
+                options.loop = true;
+            } else {
+                options.path = arg;
+            }
+            return true;
+        }, kUsage, options)) {
+        return 2;
+    }
+    setupSignals();
+    setupLog(options.verbose);
+    if (options.datagramSize % cmxs_common::kTsPacketSize) {
+        fprintf(stderr, "the datagram size should be a multiple of %zu, the PCR are not found otherwise\n",
+            cmxs_common::kTsPacketSize);
+    }
+
+    int fd = STDIN_FILENO;
+    if (options.path != "-") {
+        fd = open(options.path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "cannot open %s: %s\n", options.path.c_str(), strerror(errno));
+            return 1;
+        }
+    } else if (options.loop) {
+        fprintf(stderr, "-L needs a file\n");
+        return 2;
+    }
+
+    CMXSConfig_t cmxsCfg;
+    cmxsCfg.mServer = options.server.c_str();
+    cmxsCfg.mDeviceId = options.device.c_str();
+    CMXSErr err = CMXSSDK::init(&cmxsCfg, nullptr);
+    if (err != CMXSERR_OK) {
+        fprintf(stderr, "CMXSSDK::init failed: %d(%s)\n", err, cmxssdk_error_str(err));
+        return 1;
+    }
+
+    ToolListener listener;
+    CMXSStreamParam_t streamCfg;
+    memset(&streamCfg, 0, sizeof(CMXSStreamParam_t));
+    streamCfg.mStreamkey = options.key.c_str();
+    Sender * sender = Sender::create(&streamCfg, &listener);
+    if (!sender) {
+        fprintf(stderr, "Failed to create sender\n");
+        CMXSSDK::uninit();
+        return 1;
+    }
+
+    int ret = 0;
+    if (!listener.waitConnected(options.connectTimeoutMs)) {
+        fprintf(stderr, "not connected\n");
+        ret = 1;
+    } else {
+        fprintf(stderr, "connected, sending %s\n", options.path.c_str());
+        PcrPacer pacer(sender, options);
+        const int64_t endUs = options.duration ? nowUs() + options.duration * 1000000LL : 0;
+        // an empty file is not looped forever.
+        bool readSinceStart = false;
+        while (!quitRequested() && !pacer.failed() && (!endUs || nowUs() < endUs)) {
+            std::vector<uint8_t> datagram(options.datagramSize);
+            ssize_t size = readFull(fd, datagram.data(), datagram.size());
+            if (size < 0) {
+                fprintf(stderr, "read failed: %s\n", strerror(errno));
+                ret = 1;
+                break;
+            }
+            if (size > 0) {
+                readSinceStart = true;
+                datagram.resize(static_cast<size_t>(size));
+                pacer.push(std::move(datagram));
+            }
+            if (static_cast<size_t>(size) < options.datagramSize) {
+                if (!options.loop || !readSinceStart || lseek(fd, 0, SEEK_SET) != 0) {
+                    break;
+                }
+                readSinceStart = false;
+            }
+        }
+        pacer.flush();
+        fprintf(stderr, "sent %llu bytes\n", static_cast<unsigned long long>(pacer.totalBytes()));
+    }
+
+    Sender::destroy(sender);
+    CMXSSDK::uninit();
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    return ret;
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include "cmxs_tool.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace cmxs_tools {
+
+static std::atomic<bool> sQuit(false);
+static bool sVerbose = false;
+
+static void onQuitSignal(int) {
+    sQuit = true;
+}
+
+bool parseOptions(int argc, char * argv[], const char * toolOptstring,
+    const std::function<bool(int opt, const char * arg)> & toolOption,
+    const char * usage, ToolOptions & options) {
+    static const char * kCommonOptstring = "s:d:k:l:i:t:c:vh";
+    std::string optstring = kCommonOptstring;
+    optstring += toolOptstring;
+    int opt;
+    while ((opt = getopt(argc, argv, optstring.c_str())) != -1) {
+        if (opt != '?' && opt != ':' && strchr(toolOptstring, opt)) {
+            if (!toolOption(opt, optarg)) {
+                fprintf(stderr, "%s", usage);
+                return false;
+            }
+            continue;
+        }
+        switch (opt) {
+            case 's':
+                options.server = optarg;
+                break;
+            case 'd':
+                options.device = optarg;
+                break;
+            case 'k':
+                options.key = optarg;
+                break;
+            case 'l':
+                options.datagramSize = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+                break;
+            case 'i':
+                options.statsInterval = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+                break;
+            case 't':
+                options.duration = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+                break;
+            case 'c':
+                options.connectTimeoutMs = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+                break;
+            case 'v':
+                options.verbose = true;
+                break;
+            default:
+                fprintf(stderr, "%s", usage);
+                return false;
+        }
+    }
+    if (options.server.empty() || options.device.empty() || options.key.empty() || !options.datagramSize) {
+        fprintf(stderr, "%s", usage);
+        return false;
+    }
+    return true;
+}
+
+static void logCallback(int level, const char * format, ...) {
+    if (level > CMXSLOG_LEVEL_W && !sVerbose) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void setupLog(bool verbose) {
+    sVerbose = verbose;
+    cmxssdk_set_log_callback(logCallback);
+}
+
+void setupSignals() {
+    struct sigaction action = {};
+    action.sa_handler = onQuitSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+}
+
+bool quitRequested() {
+    return sQuit;
+}
+
+int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool ToolListener::waitConnected(uint32_t timeoutMs) {
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    std::unique_lock<std::mutex> locker(mMtx);
+    // by steps, to see the quit signals.
+    while (!mState && !sQuit && std::chrono::steady_clock::now() < deadline) {
+        mCond.wait_for(locker, std::chrono::milliseconds(100));
+    }
+    return mState == 1 && !sQuit;
+}
+
+void ToolListener::onMessage(uint32_t message, uint32_t param1, const void * param2) noexcept {
+    switch (message) {
+        case CMXSMSG_ServerConnected:
+            {
+                std::unique_lock<std::mutex> locker(mMtx);
+                mState = 1;
+                mCond.notify_all();
+            }
+            break;
+        case CMXSMSG_ServerConnectFailed:
+            {
+                const CMXSServerConnectFailedMsgData_t * data =
+                    reinterpret_cast<const CMXSServerConnectFailedMsgData_t *>(param2);
+                fprintf(stderr, "connect failed: %s\n", data && data->mErrorInfo ? data->mErrorInfo : "");
+                std::unique_lock<std::mutex> locker(mMtx);
+                mState = -1;
+                mCond.notify_all();
+            }
+            break;
+        case CMXSMSG_ERROR:
+            fprintf(stderr, "error: %u(%s)\n", param1, cmxssdk_error_str(param1));
+            break;
+        case CMXSMSG_WARNING:
+            fprintf(stderr, "warning: %u(%s)\n", param1, cmxssdk_error_str(param1));
+            break;
+        default:
+            break;
+    }
+}
+
+void IntervalStat::add(int64_t value) {
+    if (!mCount || value < mMin) {
+        mMin = value;
+    }
+    if (!mCount || value > mMax) {
+        mMax = value;
+    }
+    mSum += value;
+    ++mCount;
+}
+
+void IntervalStat::reset() {
+    mMin = 0;
+    mMax = 0;
+    mSum = 0;
+    mCount = 0;
+}
+
+std::string IntervalStat::msString() const {
+    if (!mCount) {
+        return "-";
+    }
+    char str[64];
+    snprintf(str, sizeof(str), "%.2f/%.2f/%.2f", mMin / 1000.0, mSum / 1000.0 / mCount, mMax / 1000.0);
+    return str;
+}
+
+RateMeter::RateMeter(uint32_t intervalSeconds)
+    : mIntervalUs(static_cast<int64_t>(intervalSeconds) * 1000000),
+    mStartUs(nowUs()),
+    mBytes(0),
+    mDatagrams(0),
+    mBitsPerSecond(0),
+    mDatagramsPerSecond(0),
+    mTotalBytes(0) {
+}
+
+bool RateMeter::due(int64_t nowUs) {
+    if (!mIntervalUs || nowUs - mStartUs < mIntervalUs) {
+        return false;
+    }
+    take(nowUs);
+    return true;
+}
+
+void RateMeter::take(int64_t nowUs) {
+    double seconds = std::max<int64_t>(nowUs - mStartUs, 1) / 1000000.0;
+    mBitsPerSecond = mBytes * 8 / seconds;
+    mDatagramsPerSecond = mDatagrams / seconds;
+    mTotalBytes += mBytes;
+    mBytes = 0;
+    mDatagrams = 0;
+    mStartUs = nowUs;
+}
+
+std::string RateMeter::rate() const {
+    char str[64];
+    snprintf(str, sizeof(str), "%.2f Mbit/s, %.0f datagrams/s", mBitsPerSecond / 1000000, mDatagramsPerSecond);
+    return str;
+}
+
+}  // namespace cmxs_tools
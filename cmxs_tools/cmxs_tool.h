@@ -0,0 +1,140 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * Shared parts of the headless tools cmxs-recv and cmxs-send:
+ * the command line options, the SDK log, the connection wait and the statistics.
+ */
+
+#ifndef CMXS_TOOL_H
+#define CMXS_TOOL_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include <cmxssdk/cmxssdk.h>
+
+namespace cmxs_tools {
+
+using namespace caton::cmxs;
+
+// The options of both tools.
+struct ToolOptions {
+    std::string server;
+    std::string device;
+    std::string key;
+    // the file to read or write, "-" for stdin or stdout.
+    std::string path = "-";
+    // datagram size: max received size of cmxs-recv, sent size of cmxs-send.
+    uint32_t datagramSize = 1316;
+    // stats print interval in seconds, 0 for none.
+    uint32_t statsInterval = 5;
+    // stop after this number of seconds, 0 for never.
+    uint32_t duration = 0;
+    uint32_t connectTimeoutMs = 10000;
+    // cmxs-send -L: restart from the beginning of the file at its end.
+    bool loop = false;
+    bool verbose = false;
+};
+
+// Parse argv, prints the usage and returns false on errors or -h.
+// The options of toolOptstring (getopt syntax) are given to toolOption, which returns false if invalid.
+bool parseOptions(int argc, char * argv[], const char * toolOptstring,
+    const std::function<bool(int opt, const char * arg)> & toolOption,
+    const char * usage, ToolOptions & options);
+
+// The SDK log goes to stderr, only the warnings and errors unless verbose.
+void setupLog(bool verbose);
+
+// SIGINT and SIGTERM stop the tool, SIGPIPE is ignored (write returns EPIPE).
+void setupSignals();
+bool quitRequested();
+
+// Microseconds of the steady clock.
+int64_t nowUs();
+
+// Listener of a sender or a receiver, waits for its connection.
+class ToolListener : public CMXSListener {
+ public:
+    ToolListener() : mState(0) {}
+
+    // Returns false if the connection failed, timed out, or quit was requested.
+    bool waitConnected(uint32_t timeoutMs);
+
+ private:
+    void onMessage(uint32_t message, uint32_t param1, const void * param2) noexcept override;
+
+    std::mutex mMtx;
+    std::condition_variable mCond;
+    // 1: connected, -1: failed.
+    int mState;
+};
+
+// Min, average and max of a value over an interval.
+class IntervalStat {
+ public:
+    IntervalStat() { reset(); }
+    void add(int64_t value);
+    void reset();
+    bool empty() const { return mCount == 0; }
+    // "min/avg/max" in ms of values in us, "-" if empty.
+    std::string msString() const;
+
+ private:
+    int64_t mMin;
+    int64_t mMax;
+    int64_t mSum;
+    uint64_t mCount;
+};
+
+// Counts the bytes and datagrams, and tells when the stats are due.
+class RateMeter {
+ public:
+    explicit RateMeter(uint32_t intervalSeconds);
+    void add(size_t bytes) {
+        mBytes += bytes;
+        ++mDatagrams;
+    }
+    // True once every interval, then rate() covers the interval and the counters restart.
+    bool due(int64_t nowUs);
+    // Same as due() returning true, whatever the time since the last one.
+    void take(int64_t nowUs);
+    // "x.xx Mbit/s, n datagrams/s" of the last interval.
+    std::string rate() const;
+    uint64_t totalBytes() const { return mTotalBytes + mBytes; }
+
+ private:
+    const int64_t mIntervalUs;
+    int64_t mStartUs;
+    uint64_t mBytes;
+    uint64_t mDatagrams;
+    double mBitsPerSecond;
+    double mDatagramsPerSecond;
+    uint64_t mTotalBytes;
+};
+
+}  // namespace cmxs_tools
+
+#endif  // CMXS_TOOL_H
@@ -0,0 +1,308 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Capture files of received CMXS datagrams, for replaying real traffic (see the mock SDK).
+ *
+ * Layout, all numbers are little endian:
+ *   header   "CMXSCAP" + version(1 byte)
+ *   records  time(u64, ns since the capture started) size(u32) data(size bytes)
+ *   index    time(u64) offset(u64) of the first record of every kCaptureIndexIntervalNs
+ *   footer   index offset(u64) index entries(u64) "CMXSIDX" + version(1 byte)
+ *
+ * The index and the footer are written by close(). A capture without them,
+ * e.g. when the process was killed, is still read to its last complete record.
+ */
+
+#ifndef CMXS_COMMON_CAPTURE_H
+#define CMXS_COMMON_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace cmxs_common {
+
+static constexpr char kCaptureMagic[8] = {'C', 'M', 'X', 'S', 'C', 'A', 'P', 1};
+static constexpr char kCaptureIndexMagic[8] = {'C', 'M', 'X', 'S', 'I', 'D', 'X', 1};
+static constexpr uint64_t kCaptureIndexIntervalNs = 100000000ULL;
+static constexpr size_t kCaptureRecordHeaderSize = 12;
+static constexpr size_t kCaptureFooterSize = 24;
+// Larger records are taken for a corrupted file.
+static constexpr uint32_t kCaptureMaxRecordSize = 16 * 1024 * 1024;
+
+// 64-bit offsets, long is 32 bits on Windows and the captures of long recordings pass 2 GB.
+inline bool seekCapture(FILE * file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+inline uint64_t captureSize(FILE * file) {
+#ifdef _WIN32
+    _fseeki64(file, 0, SEEK_END);
+    __int64 size = _ftelli64(file);
+#else
+    fseeko(file, 0, SEEK_END);
+    off_t size = ftello(file);
+#endif
+    return size > 0 ? static_cast<uint64_t>(size) : 0;
+}
+
+inline void putCaptureU64(uint8_t * p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+inline uint64_t getCaptureU64(const uint8_t * p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+inline void putCaptureU32(uint8_t * p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+inline uint32_t getCaptureU32(const uint8_t * p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+        (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Writes the datagrams of one receiver. Not thread safe, it is used by the receiving thread.
+class CaptureWriter {
+ public:
+    CaptureWriter() : mFile(nullptr), mOffset(0), mNextIndexNs(0), mRecords(0), mFailed(false) {}
+    ~CaptureWriter() { close(); }
+
+    CaptureWriter(const CaptureWriter &) = delete;
+    CaptureWriter & operator=(const CaptureWriter &) = delete;
+
+    bool open(const std::string & path) {
+        close();
+        mFile = fopen(path.c_str(), "wb");
+        if (!mFile) {
+            return false;
+        }
+        // the datagrams are small, write them by large blocks.
+        setvbuf(mFile, nullptr, _IOFBF, 1024 * 1024);
+        mFailed = fwrite(kCaptureMagic, sizeof(kCaptureMagic), 1, mFile) != 1;
+        mOffset = sizeof(kCaptureMagic);
+        mIndex.clear();
+        mNextIndexNs = 0;
+        mRecords = 0;
+        mStart = std::chrono::steady_clock::now();
+        return !mFailed;
+    }
+
+    bool isOpen() const { return mFile != nullptr; }
+    // A write failed, e.g. the disk is full, the next datagrams are not written.
+    bool failed() const { return mFailed; }
+    uint64_t records() const { return mRecords; }
+
+    // Write a datagram received now.
+    void write(const void * data, uint32_t size) {
+        write(data, size, std::chrono::steady_clock::now());
+    }
+
+    void write(const void * data, uint32_t size, std::chrono::steady_clock::time_point arrival) {
+        if (!mFile || mFailed) {
+            return;
+        }
+        uint64_t timeNs = arrival > mStart ? static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(arrival - mStart).count()) : 0;
+        if (timeNs >= mNextIndexNs) {
+            mIndex.push_back(IndexEntry{timeNs, mOffset});
+            mNextIndexNs = (timeNs / kCaptureIndexIntervalNs + 1) * kCaptureIndexIntervalNs;
+        }
+        uint8_t header[kCaptureRecordHeaderSize];
+        putCaptureU64(header, timeNs);
+        putCaptureU32(header + 8, size);
+        if (fwrite(header, sizeof(header), 1, mFile) != 1 || (size && fwrite(data, size, 1, mFile) != 1)) {
+            mFailed = true;
+            return;
+        }
+        mOffset += sizeof(header) + size;
+        ++mRecords;
+    }
+
+    // Write the index and close the file.
+    void close() {
+        if (!mFile) {
+            return;
+        }
+        if (!mFailed) {
+            std::vector<uint8_t> tail(mIndex.size() * 16 + kCaptureFooterSize);
+            uint8_t * p = tail.data();
+            for (const IndexEntry & entry : mIndex) {
+                putCaptureU64(p, entry.timeNs);
+                putCaptureU64(p + 8, entry.offset);
+                p += 16;
+            }
+            putCaptureU64(p, mOffset);
+            putCaptureU64(p + 8, mIndex.size());
+            memcpy(p + 16, kCaptureIndexMagic, sizeof(kCaptureIndexMagic));
+            fwrite(tail.data(), tail.size(), 1, mFile);
+        }
+        fclose(mFile);
+        mFile = nullptr;
+    }
+
+ private:
+    struct IndexEntry {
+        uint64_t timeNs;
+        uint64_t offset;
+    };
+
+    FILE * mFile;
+    std::chrono::steady_clock::time_point mStart;
+    uint64_t mOffset;
+    uint64_t mNextIndexNs;
+    uint64_t mRecords;
+    bool mFailed;
+    std::vector<IndexEntry> mIndex;
+};
+
+// Reads a capture in order, or from a time with the index.
+class CaptureReader {
+ public:
+    CaptureReader() : mFile(nullptr), mEnd(0), mOffset(0) {}
+    ~CaptureReader() { close(); }
+
+    CaptureReader(const CaptureReader &) = delete;
+    CaptureReader & operator=(const CaptureReader &) = delete;
+
+    bool open(const std::string & path) {
+        close();
+        mFile = fopen(path.c_str(), "rb");
+        if (!mFile) {
+            return false;
+        }
+        char magic[sizeof(kCaptureMagic)];
+        if (fread(magic, sizeof(magic), 1, mFile) != 1 || memcmp(magic, kCaptureMagic, sizeof(magic)) != 0) {
+            close();
+            return false;
+        }
+        mEnd = captureSize(mFile);
+        readIndex();
+        mOffset = sizeof(kCaptureMagic);
+        seekCapture(mFile, mOffset);
+        return true;
+    }
+
+    void close() {
+        if (mFile) {
+            fclose(mFile);
+            mFile = nullptr;
+        }
+        mIndex.clear();
+    }
+
+    // False if the capture has no index, seekTo() then starts from the beginning.
+    bool indexed() const { return !mIndex.empty(); }
+
+    // Next datagram, false at the end of the capture.
+    bool next(std::vector<uint8_t> & data, uint64_t & timeNs) {
+        if (!mFile || mOffset + kCaptureRecordHeaderSize > mEnd) {
+            return false;
+        }
+        uint8_t header[kCaptureRecordHeaderSize];
+        if (fread(header, sizeof(header), 1, mFile) != 1) {
+            return false;
+        }
+        timeNs = getCaptureU64(header);
+        uint32_t size = getCaptureU32(header + 8);
+        if (size > kCaptureMaxRecordSize || mOffset + sizeof(header) + size > mEnd) {
+            // truncated or corrupted, stop here.
+            mOffset = mEnd;
+            return false;
+        }
+        data.resize(size);
+        if (size && fread(data.data(), size, 1, mFile) != 1) {
+            mOffset = mEnd;
+            return false;
+        }
+        mOffset += sizeof(header) + size;
+        return true;
+    }
+
+    // Continue from the last indexed record at or before timeNs.
+    void seekTo(uint64_t timeNs) {
+        if (!mFile) {
+            return;
+        }
+        uint64_t offset = sizeof(kCaptureMagic);
+        std::vector<std::pair<uint64_t, uint64_t>>::const_iterator entry = std::upper_bound(
+            mIndex.begin(), mIndex.end(), std::make_pair(timeNs, UINT64_MAX));
+        if (entry != mIndex.begin()) {
+            offset = (entry - 1)->second;
+        }
+        mOffset = offset;
+        seekCapture(mFile, mOffset);
+    }
+
+ private:
+    void readIndex() {
+        if (mEnd < sizeof(kCaptureMagic) + kCaptureFooterSize) {
+            return;
+        }
+        uint8_t footer[kCaptureFooterSize];
+        if (!seekCapture(mFile, mEnd - kCaptureFooterSize) || fread(footer, sizeof(footer), 1, mFile) != 1 ||
+            memcmp(footer + 16, kCaptureIndexMagic, sizeof(kCaptureIndexMagic)) != 0) {
+            return;
+        }
+        uint64_t indexOffset = getCaptureU64(footer);
+        uint64_t count = getCaptureU64(footer + 8);
+        if (indexOffset < sizeof(kCaptureMagic) || indexOffset + count * 16 + kCaptureFooterSize != mEnd) {
+            return;
+        }
+        std::vector<uint8_t> index(count * 16);
+        if (!seekCapture(mFile, indexOffset) || (count && fread(index.data(), index.size(), 1, mFile) != 1)) {
+            return;
+        }
+        for (uint64_t i = 0; i < count; ++i) {
+            mIndex.push_back(std::make_pair(getCaptureU64(&index[i * 16]), getCaptureU64(&index[i * 16 + 8])));
+        }
+        // the records end where the index starts.
+        mEnd = indexOffset;
+    }
+
+    FILE * mFile;
+    uint64_t mEnd;
+    uint64_t mOffset;
+    // time, offset
+    std::vector<std::pair<uint64_t, uint64_t>> mIndex;
+};
+
+}  // namespace cmxs_common
+
+#endif  // CMXS_COMMON_CAPTURE_H
@@ -0,0 +1,321 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * Glass-to-glass latency: the sender puts its wallclock time into the video,
+ * the receivers compare it with their own wallclock.
+ *
+ * The time is an SEI user_data_unregistered message (payload type 5) with kLatencyUuid,
+ * followed by the capture time in microseconds since 1970, 8 bytes big endian.
+ * It is a NAL unit of its own, right in front of the first slice of the access unit: after the
+ * AUD, the parameter sets and the buffering period or picture timing SEI, which the strict
+ * parsers expect first. The receivers look for it in the NAL units before the first slice.
+ *
+ * The clocks of the sender and the receiver must be synchronized (NTP/PTP),
+ * the offset between them is added to every measure.
+ */
+
+#ifndef CMXS_COMMON_LATENCY_H
+#define CMXS_COMMON_LATENCY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "cmxs_nal.h"
+#include "cmxs_ts.h"
+
+namespace cmxs_common {
+
+static constexpr uint8_t kLatencyUuid[16] = {
+    0x63, 0x6D, 0x78, 0x73, 0x2D, 0x6C, 0x61, 0x74, 0x65, 0x6E, 0x63, 0x79, 0x2D, 0x76, 0x31, 0x00,
+};
+static constexpr uint8_t kSeiUserDataUnregistered = 5;
+static constexpr size_t kLatencyPayloadSize = sizeof(kLatencyUuid) + 8;
+
+inline uint64_t wallclockUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+inline bool isVclNal(VideoCodec codec, uint8_t header) {
+    int type = nalType(codec, header);
+    return codec == VideoCodec::HEVC ? type <= 31 : type >= 1 && type <= 5;
+}
+
+inline bool isSeiNal(VideoCodec codec, uint8_t header) {
+    // HEVC: prefix SEI
+    return nalType(codec, header) == (codec == VideoCodec::HEVC ? 39 : 6);
+}
+
+inline bool isAudNal(VideoCodec codec, uint8_t header) {
+    return nalType(codec, header) == (codec == VideoCodec::HEVC ? 35 : 9);
+}
+
+// The first slice of data, end if there is none.
+inline const uint8_t * firstVclNal(VideoCodec codec, const uint8_t * data, const uint8_t * end) {
+    for (const uint8_t * p = nextNal(data, end); p < end; p = nextNal(p, end)) {
+        if (isVclNal(codec, *p)) {
+            return p;
+        }
+    }
+    return end;
+}
+
+// The Annex B SEI NAL unit carrying captureUs.
+inline void makeLatencySei(VideoCodec codec, uint64_t captureUs, std::vector<uint8_t> & nal) {
+    uint8_t rbsp[2 + kLatencyPayloadSize + 1];
+    rbsp[0] = kSeiUserDataUnregistered;
+    rbsp[1] = static_cast<uint8_t>(kLatencyPayloadSize);
+    memcpy(rbsp + 2, kLatencyUuid, sizeof(kLatencyUuid));
+    for (int i = 0; i < 8; ++i) {
+        rbsp[2 + sizeof(kLatencyUuid) + i] = static_cast<uint8_t>(captureUs >> (56 - 8 * i));
+    }
+    rbsp[sizeof(rbsp) - 1] = 0x80;  // rbsp_trailing_bits
+
+    nal.assign({0, 0, 0, 1});
+    if (codec == VideoCodec::HEVC) {
+        nal.push_back(39 << 1);
+        nal.push_back(1);
+    } else {
+        nal.push_back(6);
+    }
+    int zeros = 0;
+    for (uint8_t b : rbsp) {
+        if (zeros >= 2 && b <= 3) {
+            nal.push_back(3);  // emulation prevention
+            zeros = 0;
+        }
+        nal.push_back(b);
+        zeros = b ? 0 : zeros + 1;
+    }
+}
+
+// Copy the access unit into out with the latency SEI right before its first slice.
+inline void insertLatencySei(VideoCodec codec, uint64_t captureUs, const uint8_t * data, size_t size,
+    std::vector<uint8_t> & out) {
+    const uint8_t * end = data + size;
+    size_t at = size;
+    const uint8_t * slice = firstVclNal(codec, data, end);
+    if (slice < end) {
+        // the start code of the slice, 3 or 4 bytes.
+        at = static_cast<size_t>(slice - 3 - data);
+        if (at > 0 && data[at - 1] == 0) {
+            --at;
+        }
+    }
+    makeLatencySei(codec, captureUs, out);
+    out.insert(out.begin(), data, data + at);
+    out.insert(out.end(), data + at, end);
+}
+
+// Reads an escaped NAL unit payload byte by byte, without the emulation prevention bytes.
+class RbspReader {
+ public:
+    RbspReader(const uint8_t * p, const uint8_t * end) : mP(p), mEnd(end), mZeros(0) {}
+
+    bool read(uint8_t & b) {
+        if (mP < mEnd && mZeros >= 2 && *mP == 3) {
+            ++mP;
+            mZeros = 0;
+        }
+        if (mP >= mEnd) {
+            return false;
+        }
+        b = *mP++;
+        mZeros = b ? 0 : mZeros + 1;
+        return true;
+    }
+
+    // true if only the rbsp trailing bits are left.
+    bool atTrailing() const {
+        return mP >= mEnd || (*mP == 0x80 && (mP + 1 >= mEnd || mP[1] == 0));
+    }
+
+ private:
+    const uint8_t * mP;
+    const uint8_t * mEnd;
+    int mZeros;
+};
+
+// Looks for the latency SEI in the NAL units in front of the first picture slice.
+// data may be cut, e.g. the first TS packet of a PES packet.
+inline bool findLatencySei(VideoCodec codec, const uint8_t * data, size_t size, uint64_t & captureUs) {
+    const uint8_t * end = data + size;
+    const size_t headerSize = codec == VideoCodec::HEVC ? 2 : 1;
+    for (const uint8_t * p = nextNal(data, end); p < end; p = nextNal(p, end)) {
+        if (isVclNal(codec, *p)) {
+            return false;
+        }
+        if (!isSeiNal(codec, *p) || p + headerSize >= end) {
+            continue;
+        }
+        RbspReader reader(p + headerSize, nextNal(p, end));
+        while (!reader.atTrailing()) {
+            uint32_t type = 0;
+            uint32_t payloadSize = 0;
+            uint8_t b = 0xFF;
+            while (b == 0xFF) {
+                if (!reader.read(b)) {
+                    break;
+                }
+                type += b;
+            }
+            b = 0xFF;
+            while (b == 0xFF) {
+                if (!reader.read(b)) {
+                    break;
+                }
+                payloadSize += b;
+            }
+            if (b == 0xFF) {
+                break;  // cut
+            }
+            uint8_t payload[kLatencyPayloadSize];
+            uint32_t i = 0;
+            for (; i < payloadSize; ++i) {
+                if (!reader.read(b)) {
+                    break;
+                }
+                if (i < sizeof(payload)) {
+                    payload[i] = b;
+                }
+            }
+            if (i < payloadSize) {
+                break;
+            }
+            if (type == kSeiUserDataUnregistered && payloadSize >= kLatencyPayloadSize &&
+                memcmp(payload, kLatencyUuid, sizeof(kLatencyUuid)) == 0) {
+                captureUs = 0;
+                for (size_t j = sizeof(kLatencyUuid); j < kLatencyPayloadSize; ++j) {
+                    captureUs = (captureUs << 8) | payload[j];
+                }
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Finds the latency SEI in received TS data, in the NAL units before the first slice of every
+// video PES packet: the TS packets are gathered until the slice starts.
+class TsLatencyScanner {
+ public:
+    TsLatencyScanner() : mScanning(false) {}
+
+    // onStamp(captureUs) is called for every timestamp found in data.
+    template <typename F>
+    void feed(const uint8_t * data, size_t size, F onStamp) {
+        for (size_t offset = 0; offset + kTsPacketSize <= size; offset += kTsPacketSize) {
+            TsPacket pkt;
+            if (!parseTsPacket(data + offset, pkt)) {
+                continue;
+            }
+            mTs.feed(pkt);
+            if (pkt.pid != mTs.videoPid() || !pkt.hasPayload) {
+                continue;
+            }
+            if (pkt.pusi) {
+                size_t es = pesPayloadOffset(pkt.payload, pkt.payloadSize);
+                mScanning = es != 0;
+                mHead.clear();
+                if (mScanning) {
+                    mHead.assign(pkt.payload + es, pkt.payload + pkt.payloadSize);
+                }
+            } else if (mScanning) {
+                mHead.insert(mHead.end(), pkt.payload, pkt.payload + pkt.payloadSize);
+            }
+            if (!mScanning) {
+                continue;
+            }
+            const VideoCodec codec = mTs.videoCodec();
+            uint64_t captureUs = 0;
+            if (findLatencySei(codec, mHead.data(), mHead.size(), captureUs)) {
+                mScanning = false;
+                onStamp(captureUs);
+            } else if (mHead.size() >= kMaxHead || firstVclNal(codec, mHead.data(), mHead.data() + mHead.size()) <
+                mHead.data() + mHead.size()) {
+                mScanning = false;
+            }
+        }
+    }
+
+ private:
+    // the parameter sets and SEI of an access unit are smaller, e.g. the x264 settings SEI.
+    static constexpr size_t kMaxHead = 8 * 1024;
+
+    TsProgramTracker mTs;
+    // the start of the current video PES payload, while the first slice is not in it
+    std::vector<uint8_t> mHead;
+    bool mScanning;
+};
+
+// Latency percentiles over a log period. Not thread safe.
+class LatencyStats {
+ public:
+    LatencyStats() : mTotal(0) {}
+
+    void add(int64_t latencyUs) {
+        ++mTotal;
+        // bounded, the percentiles of a long period are still right enough.
+        if (mSamples.size() < kMaxSamples) {
+            mSamples.push_back(latencyUs);
+        }
+    }
+
+    bool empty() const { return mSamples.empty(); }
+    uint64_t total() const { return mTotal; }
+
+    // "count=120 p50_ms=85.2 p95_ms=110.0 p99_ms=130.4 max_ms=140.1", then starts a new period.
+    std::string take() {
+        char text[160];
+        if (mSamples.empty()) {
+            snprintf(text, sizeof(text), "count=0");
+            return text;
+        }
+        std::sort(mSamples.begin(), mSamples.end());
+        snprintf(text, sizeof(text), "count=%zu p50_ms=%.1f p95_ms=%.1f p99_ms=%.1f max_ms=%.1f",
+            mSamples.size(), percentile(50) / 1000.0, percentile(95) / 1000.0, percentile(99) / 1000.0,
+            mSamples.back() / 1000.0);
+        mSamples.clear();
+        return text;
+    }
+
+ private:
+    static constexpr size_t kMaxSamples = 100000;
+
+    int64_t percentile(size_t p) const {
+        return mSamples[(mSamples.size() - 1) * p / 100];
+    }
+
+    std::vector<int64_t> mSamples;
+    uint64_t mTotal;
+};
+
+}  // namespace cmxs_common
+
+#endif  // CMXS_COMMON_LATENCY_H
@@ -0,0 +1,130 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Minimal H.264/HEVC Annex B helpers shared by the examples.
+ */
+
+#ifndef CMXS_COMMON_NAL_H
+#define CMXS_COMMON_NAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace cmxs_common {
+
+enum class VideoCodec {
+    Unknown,
+    H264,
+    HEVC,
+};
+
+// Find the next 00 00 01 start code in [p, end).
+// Returns the first byte after the start code, or end if there is none.
+inline const uint8_t * nextNal(const uint8_t * p, const uint8_t * end) {
+    while (p + 3 <= end) {
+        if (p[2] > 1) {
+            p += 3;
+        } else if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+            return p + 3;
+        } else {
+            ++p;
+        }
+    }
+    return end;
+}
+
+inline int nalType(VideoCodec codec, uint8_t header) {
+    return codec == VideoCodec::HEVC ? (header >> 1) & 0x3F : header & 0x1F;
+}
+
+// IDR/IRAP pictures and the parameter sets sent in front of them.
+inline bool isRandomAccessNal(VideoCodec codec, uint8_t header) {
+    int type = nalType(codec, header);
+    switch (codec) {
+        case VideoCodec::H264:
+            return type == 5 || type == 7;
+        case VideoCodec::HEVC:
+            return (type >= 16 && type <= 23) || (type >= 32 && type <= 34);
+        default:
+            return false;
+    }
+}
+
+// Slices and the other NAL units of the picture data.
+inline bool isPictureNal(VideoCodec codec, uint8_t header) {
+    int type = nalType(codec, header);
+    switch (codec) {
+        case VideoCodec::H264:
+            return type >= 1 && type <= 5;
+        case VideoCodec::HEVC:
+            return type < 32;
+        default:
+            return false;
+    }
+}
+
+// Returns true if the Annex B data contains a random access NAL unit.
+inline bool containsRandomAccess(VideoCodec codec, const uint8_t * data, size_t size) {
+    const uint8_t * end = data + size;
+    for (const uint8_t * p = nextNal(data, end); p < end; p = nextNal(p, end)) {
+        if (isRandomAccessNal(codec, *p)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns true if no other picture refers to the picture of an access unit, so it can be skipped:
+// nal_ref_idc 0 for H.264, a sub-layer non-reference NAL unit type for HEVC (as AVDISCARD_NONREF).
+inline bool isNonReferencePicture(VideoCodec codec, const uint8_t * data, size_t size) {
+    const uint8_t * end = data + size;
+    for (const uint8_t * p = nextNal(data, end); p < end; p = nextNal(p, end)) {
+        if (!isPictureNal(codec, *p)) {
+            continue;
+        }
+        if (codec == VideoCodec::H264) {
+            return (*p & 0x60) == 0;
+        }
+        int type = nalType(codec, *p);
+        return type <= 14 && type % 2 == 0;
+    }
+    return false;
+}
+
+// Returns true if an access unit is a random access point. Only the NAL units in front of
+// its first picture NAL unit are looked at, not the picture data.
+inline bool startsRandomAccess(VideoCodec codec, const uint8_t * data, size_t size) {
+    const uint8_t * end = data + size;
+    for (const uint8_t * p = nextNal(data, end); p < end; p = nextNal(p, end)) {
+        if (isRandomAccessNal(codec, *p)) {
+            return true;
+        }
+        if (isPictureNal(codec, *p)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+}  // namespace cmxs_common
+
+#endif  // CMXS_COMMON_NAL_H
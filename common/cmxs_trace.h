@@ -0,0 +1,232 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * Chrome trace event files (chrome://tracing, https://ui.perfetto.dev) of the CMXS pipelines.
+ *
+ * Every span is a complete event ("ph":"X") tagged with the stream key and the pts when it has one.
+ * The file is a JSON array, its closing bracket is written by close(), and
+ * the viewers read a file without it, e.g. when the process was killed.
+ */
+
+#ifndef CMXS_COMMON_TRACE_H
+#define CMXS_COMMON_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace cmxs_common {
+
+// Name of the calling thread in the traces it writes to without calling TraceWriter::setThreadName(),
+// e.g. a pool thread running the stages of several pipelines. Set once by the thread.
+inline const char *& traceThreadName() {
+    static thread_local const char * name = nullptr;
+    return name;
+}
+
+// Written by several threads, the spans are buffered and written by blocks, out of the lock of the spans.
+class TraceWriter {
+ public:
+    TraceWriter() : mFile(nullptr), mOpen(false), mEvents(0), mStart(std::chrono::steady_clock::now()), mNextTid(1) {}
+    ~TraceWriter() { close(); }
+
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter & operator=(const TraceWriter &) = delete;
+
+    // processName names the pipeline in the viewer, key tags every span.
+    bool open(const std::string & path, const std::string & processName, const std::string & key) {
+        close();
+        std::unique_lock<std::mutex> locker(mMtx);
+        mFile = fopen(path.c_str(), "wb");
+        if (!mFile) {
+            return false;
+        }
+        mKey = escape(key);
+        mEvents = 0;
+        mThreads.clear();
+        mNextTid = 1;
+        mBuffer = "[\n";
+        mBuffer += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"" +
+            escape(processName) + "\"}}";
+        mOpen = true;
+        return true;
+    }
+
+    // Cheap check for the traced paths, the spans of a closed writer are dropped anyway.
+    bool isOpen() const { return mOpen; }
+    uint64_t events() const { return mEvents; }
+
+    void close() {
+        std::unique_lock<std::mutex> locker(mMtx);
+        if (!mFile) {
+            return;
+        }
+        // after the block being written.
+        std::unique_lock<std::mutex> fileLocker(mFileMtx);
+        mOpen = false;
+        mBuffer += "\n]\n";
+        fwrite(mBuffer.data(), 1, mBuffer.size(), mFile);
+        mBuffer.clear();
+        fclose(mFile);
+        mFile = nullptr;
+    }
+
+    // Microseconds since the writer was created, the time base of the spans: a span started
+    // before a reopen still ends after its start.
+    uint64_t nowUs() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - mStart).count());
+    }
+
+    // Name the calling thread in the viewer.
+    void setThreadName(const char * name) {
+        std::unique_lock<std::mutex> locker(mMtx);
+        if (!mFile) {
+            return;
+        }
+        appendThreadName(threadId(), name);
+    }
+
+    // A span of the calling thread, from startUs to endUs. A negative pts is not written.
+    void span(const char * name, uint64_t startUs, uint64_t endUs, int64_t pts) {
+        if (!mOpen) {
+            return;
+        }
+        char event[256];
+        std::unique_lock<std::mutex> locker(mMtx);
+        if (!mFile) {
+            return;
+        }
+        int len = snprintf(event, sizeof(event),
+            ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%llu,\"args\":{\"key\":\"",
+            name, threadId(), static_cast<unsigned long long>(startUs),
+            static_cast<unsigned long long>(endUs > startUs ? endUs - startUs : 0));
+        mBuffer.append(event, static_cast<size_t>(len));
+        mBuffer += mKey;
+        if (pts >= 0) {
+            len = snprintf(event, sizeof(event), "\",\"pts\":%lld}}", static_cast<long long>(pts));
+        } else {
+            len = snprintf(event, sizeof(event), "\"}}");
+        }
+        mBuffer.append(event, static_cast<size_t>(len));
+        ++mEvents;
+        if (mBuffer.size() >= kFlushSize) {
+            // taken before the lock of the spans is released, the blocks are written in order.
+            std::string block;
+            block.swap(mBuffer);
+            std::unique_lock<std::mutex> fileLocker(mFileMtx);
+            FILE * file = mFile;
+            locker.unlock();
+            fwrite(block.data(), 1, block.size(), file);
+        }
+    }
+
+ private:
+    static constexpr size_t kFlushSize = 64 * 1024;
+
+    // mMtx is held.
+    int threadId() {
+        std::map<std::thread::id, int>::iterator it = mThreads.find(std::this_thread::get_id());
+        if (it == mThreads.end()) {
+            it = mThreads.insert(std::make_pair(std::this_thread::get_id(), mNextTid++)).first;
+            if (traceThreadName()) {
+                appendThreadName(it->second, traceThreadName());
+            }
+        }
+        return it->second;
+    }
+
+    // mMtx is held.
+    void appendThreadName(int tid, const char * name) {
+        char event[256];
+        snprintf(event, sizeof(event), ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}", tid, name);
+        mBuffer += event;
+    }
+
+    static std::string escape(const std::string & s) {
+        std::string out;
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char hex[8];
+                snprintf(hex, sizeof(hex), "\\u%04x", c);
+                out += hex;
+            } else {
+                out += c;
+            }
+        }
+        return out;
+    }
+
+    std::mutex mMtx;
+    // held while a block is written, after mMtx
+    std::mutex mFileMtx;
+    FILE * mFile;
+    std::atomic<bool> mOpen;
+    std::atomic<uint64_t> mEvents;
+    const std::chrono::steady_clock::time_point mStart;
+    std::string mKey;
+    std::string mBuffer;
+    std::map<std::thread::id, int> mThreads;
+    int mNextTid;
+};
+
+// Traces the scope it lives in, nothing when the writer is null or closed.
+class TraceSpan {
+ public:
+    TraceSpan(TraceWriter * writer, const char * name, int64_t pts = -1)
+        : mWriter(writer && writer->isOpen() ? writer : nullptr),
+        mName(name),
+        mPts(pts),
+        mStartUs(mWriter ? mWriter->nowUs() : 0) {}
+
+    ~TraceSpan() {
+        if (mWriter) {
+            mWriter->span(mName, mStartUs, mWriter->nowUs(), mPts);
+        }
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan & operator=(const TraceSpan &) = delete;
+
+    // The pts is often known at the end, e.g. of a demuxed packet.
+    void setPts(int64_t pts) { mPts = pts; }
+
+ private:
+    TraceWriter * mWriter;
+    const char * mName;
+    int64_t mPts;
+    uint64_t mStartUs;
+};
+
+}  // namespace cmxs_common
+
+#endif  // CMXS_COMMON_TRACE_H
@@ -0,0 +1,293 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Minimal MPEG-TS helpers shared by the examples.
+ *
+ * The CMXS streams in these examples are single program transport streams
+ * (one H.264/HEVC video PID plus AAC PIDs), as written by the OBS output.
+ * PAT and PMT are expected to fit in one TS packet, which is the case for such streams.
+ */
+
+#ifndef CMXS_COMMON_TS_H
+#define CMXS_COMMON_TS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "cmxs_nal.h"
+
+namespace cmxs_common {
+
+static constexpr size_t kTsPacketSize = 188;
+static constexpr uint8_t kTsSyncByte = 0x47;
+static constexpr uint16_t kTsPidPat = 0x0000;
+static constexpr uint16_t kTsPidNull = 0x1FFF;
+
+static constexpr uint8_t kTsStreamTypeAAC = 0x0F;
+static constexpr uint8_t kTsStreamTypeH264 = 0x1B;
+static constexpr uint8_t kTsStreamTypeHEVC = 0x24;
+
+struct TsPacket {
+    uint16_t pid;
+    uint8_t cc;
+    bool tei;                   // transport error indicator
+    bool pusi;                  // payload unit start indicator
+    bool hasPayload;
+    bool discontinuity;         // adaptation field discontinuity indicator
+    bool randomAccess;          // adaptation field random access indicator
+    bool hasPcr;
+    uint64_t pcr;               // 27MHz
+    const uint8_t * payload;
+    size_t payloadSize;
+};
+
+// Parse the header of one 188 bytes TS packet. Returns false if it is not a valid packet.
+inline bool parseTsPacket(const uint8_t * p, TsPacket & pkt) {
+    if (p[0] != kTsSyncByte) {
+        return false;
+    }
+    pkt.tei = (p[1] & 0x80) != 0;
+    pkt.pusi = (p[1] & 0x40) != 0;
+    pkt.pid = static_cast<uint16_t>(((p[1] & 0x1F) << 8) | p[2]);
+    pkt.cc = p[3] & 0x0F;
+    pkt.hasPayload = (p[3] & 0x10) != 0;
+    pkt.discontinuity = false;
+    pkt.randomAccess = false;
+    pkt.hasPcr = false;
+    pkt.pcr = 0;
+
+    size_t offset = 4;
+    if (p[3] & 0x20) {
+        size_t afLen = p[4];
+        if (afLen > kTsPacketSize - 5) {
+            return false;
+        }
+        if (afLen > 0) {
+            const uint8_t flags = p[5];
+            pkt.discontinuity = (flags & 0x80) != 0;
+            pkt.randomAccess = (flags & 0x40) != 0;
+            if ((flags & 0x10) && afLen >= 7) {
+                const uint8_t * b = p + 6;
+                uint64_t base = (static_cast<uint64_t>(b[0]) << 25) |
+                    (static_cast<uint64_t>(b[1]) << 17) |
+                    (static_cast<uint64_t>(b[2]) << 9) |
+                    (static_cast<uint64_t>(b[3]) << 1) |
+                    (b[4] >> 7);
+                uint64_t ext = (static_cast<uint64_t>(b[4] & 0x01) << 8) | b[5];
+                pkt.hasPcr = true;
+                pkt.pcr = base * 300 + ext;
+            }
+        }
+        offset += 1 + afLen;
+    }
+    if (!pkt.hasPayload || offset >= kTsPacketSize) {
+        pkt.hasPayload = false;
+        pkt.payload = nullptr;
+        pkt.payloadSize = 0;
+    } else {
+        pkt.payload = p + offset;
+        pkt.payloadSize = kTsPacketSize - offset;
+    }
+    return true;
+}
+
+// Returns the offset of the elementary stream data in a PES packet start, or 0 if it is not a PES header.
+inline size_t pesPayloadOffset(const uint8_t * payload, size_t size) {
+    if (size < 9 || payload[0] != 0 || payload[1] != 0 || payload[2] != 1) {
+        return 0;
+    }
+    size_t offset = 9 + static_cast<size_t>(payload[8]);
+    return offset <= size ? offset : 0;
+}
+
+// Read a 33 bits PTS or DTS field of a PES header, in 90KHz.
+inline int64_t pesTimestamp(const uint8_t * b) {
+    return (static_cast<int64_t>(b[0] & 0x0E) << 29) |
+        (static_cast<int64_t>(b[1]) << 22) |
+        (static_cast<int64_t>(b[2] & 0xFE) << 14) |
+        (static_cast<int64_t>(b[3]) << 7) |
+        (b[4] >> 1);
+}
+
+// Read the PTS of a PES packet start, in 90KHz. Returns false if there is no PTS.
+inline bool pesPts(const uint8_t * payload, size_t size, int64_t & pts) {
+    if (size < 14 || payload[0] != 0 || payload[1] != 0 || payload[2] != 1 || !(payload[7] & 0x80)) {
+        return false;
+    }
+    pts = pesTimestamp(payload + 9);
+    return true;
+}
+
+struct TsStreamInfo {
+    uint16_t pid;
+    uint8_t streamType;
+};
+
+// Follows PAT and PMT of a single program stream.
+class TsProgramTracker {
+ public:
+    TsProgramTracker() : mPmtPid(kTsPidNull), mPcrPid(kTsPidNull), mVideoPid(kTsPidNull),
+        mVideoCodec(VideoCodec::Unknown), mVersion(0) {}
+
+    // Feed one parsed TS packet. Returns true if the PMT changed.
+    bool feed(const TsPacket & pkt) {
+        if (!pkt.pusi || !pkt.hasPayload) {
+            return false;
+        }
+        if (pkt.pid == kTsPidPat) {
+            parsePat(pkt.payload, pkt.payloadSize);
+            return false;
+        }
+        if (pkt.pid == mPmtPid) {
+            return parsePmt(pkt.payload, pkt.payloadSize);
+        }
+        return false;
+    }
+
+    // Forget the program, version() keeps increasing from where it is.
+    void reset() {
+        const uint32_t version = mVersion;
+        *this = TsProgramTracker();
+        mVersion = version;
+    }
+
+    uint16_t pmtPid() const { return mPmtPid; }
+    uint16_t pcrPid() const { return mPcrPid; }
+    uint16_t videoPid() const { return mVideoPid; }
+    VideoCodec videoCodec() const { return mVideoCodec; }
+    const std::vector<TsStreamInfo> & streams() const { return mStreams; }
+    // Increased every time the PMT content changes.
+    uint32_t version() const { return mVersion; }
+
+    bool isPsi(uint16_t pid) const { return pid == kTsPidPat || pid == mPmtPid; }
+
+ private:
+    // Returns the section start and its length (without CRC), or nullptr.
+    static const uint8_t * section(const uint8_t * payload, size_t size, uint8_t tableId, size_t & len) {
+        if (size < 1) {
+            return nullptr;
+        }
+        size_t pointer = payload[0];
+        if (1 + pointer + 3 > size) {
+            return nullptr;
+        }
+        const uint8_t * s = payload + 1 + pointer;
+        size -= 1 + pointer;
+        if (s[0] != tableId) {
+            return nullptr;
+        }
+        size_t sectionLen = static_cast<size_t>(((s[1] & 0x0F) << 8) | s[2]);
+        if (sectionLen < 9 || 3 + sectionLen > size) {
+            return nullptr;
+        }
+        len = 3 + sectionLen - 4;
+        return s;
+    }
+
+    void parsePat(const uint8_t * payload, size_t size) {
+        size_t len = 0;
+        const uint8_t * s = section(payload, size, 0x00, len);
+        if (!s) {
+            return;
+        }
+        for (size_t i = 8; i + 4 <= len; i += 4) {
+            uint16_t program = static_cast<uint16_t>((s[i] << 8) | s[i + 1]);
+            if (program == 0) {
+                continue;  // network PID
+            }
+            mPmtPid = static_cast<uint16_t>(((s[i + 2] & 0x1F) << 8) | s[i + 3]);
+            return;
+        }
+    }
+
+    bool parsePmt(const uint8_t * payload, size_t size) {
+        size_t len = 0;
+        const uint8_t * s = section(payload, size, 0x02, len);
+        if (!s || len < 12) {
+            return false;
+        }
+        uint16_t pcrPid = static_cast<uint16_t>(((s[8] & 0x1F) << 8) | s[9]);
+        size_t infoLen = static_cast<size_t>(((s[10] & 0x0F) << 8) | s[11]);
+        std::vector<TsStreamInfo> streams;
+        uint16_t videoPid = kTsPidNull;
+        VideoCodec videoCodec = VideoCodec::Unknown;
+        for (size_t i = 12 + infoLen; i + 5 <= len;) {
+            TsStreamInfo info;
+            info.streamType = s[i];
+            info.pid = static_cast<uint16_t>(((s[i + 1] & 0x1F) << 8) | s[i + 2]);
+            size_t esInfoLen = static_cast<size_t>(((s[i + 3] & 0x0F) << 8) | s[i + 4]);
+            streams.push_back(info);
+            if (videoPid == kTsPidNull) {
+                if (info.streamType == kTsStreamTypeH264) {
+                    videoPid = info.pid;
+                    videoCodec = VideoCodec::H264;
+                } else if (info.streamType == kTsStreamTypeHEVC) {
+                    videoPid = info.pid;
+                    videoCodec = VideoCodec::HEVC;
+                }
+            }
+            i += 5 + esInfoLen;
+        }
+
+        bool changed = pcrPid != mPcrPid || videoPid != mVideoPid || streams.size() != mStreams.size();
+        for (size_t i = 0; !changed && i < streams.size(); ++i) {
+            changed = streams[i].pid != mStreams[i].pid || streams[i].streamType != mStreams[i].streamType;
+        }
+        if (!changed) {
+            return false;
+        }
+        mPcrPid = pcrPid;
+        mVideoPid = videoPid;
+        mVideoCodec = videoCodec;
+        mStreams.swap(streams);
+        ++mVersion;
+        return true;
+    }
+
+    uint16_t mPmtPid;
+    uint16_t mPcrPid;
+    uint16_t mVideoPid;
+    VideoCodec mVideoCodec;
+    uint32_t mVersion;
+    std::vector<TsStreamInfo> mStreams;
+};
+
+// Returns true if the TS packet starts a video access unit that can be decoded on its own.
+// The random access indicator is used when present, else the first NAL units are checked.
+inline bool tsPacketStartsKeyframe(const TsPacket & pkt, VideoCodec codec) {
+    if (!pkt.pusi || !pkt.hasPayload) {
+        return false;
+    }
+    if (pkt.randomAccess) {
+        return true;
+    }
+    size_t offset = pesPayloadOffset(pkt.payload, pkt.payloadSize);
+    if (!offset) {
+        return false;
+    }
+    return containsRandomAccess(codec, pkt.payload + offset, pkt.payloadSize - offset);
+}
+
+}  // namespace cmxs_common
+
+#endif  // CMXS_COMMON_TS_H
@@ -0,0 +1,392 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * Streaming demuxer of the CMXS transport streams, in place of libavformat for the receivers.
+ *
+ * It is fed with the datagrams as they are received, follows PAT and PMT with TsProgramTracker,
+ * and reassembles the PES packets of the H.264/HEVC and AAC streams into frames; the other
+ * streams are skipped. There is no probing: a frame is out as soon as its PES is complete.
+ *
+ * The payloads are gathered once, into a buffer the frame can hand over: the consumer takes it
+ * with TsFrame::release(), e.g. into an AVBufferRef, without another copy. Else it is reused.
+ *
+ * The transport quality of every PID is tracked with TsQuality: a frame missing some of its
+ * data is flagged corrupt, a duplicated TS packet is skipped.
+ *
+ * Every datagram holds whole TS packets, as the CMXS datagrams do (7 x 188 bytes).
+ */
+
+#ifndef CMXS_COMMON_TS_DEMUX_H
+#define CMXS_COMMON_TS_DEMUX_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "cmxs_nal.h"
+#include "cmxs_ts.h"
+#include "cmxs_ts_quality.h"
+
+namespace cmxs_common {
+
+static constexpr int64_t kTsNoTimestamp = INT64_MIN;
+static constexpr int64_t kTsTimestampWrap = 1LL << 33;
+// AAC frames have 1024 samples.
+static constexpr int kAacFrameSamples = 1024;
+
+// Duration of an AAC frame in 90KHz, rounded.
+inline int64_t aacFrameDuration(int sampleRate) {
+    return (static_cast<int64_t>(kAacFrameSamples) * 90000 + sampleRate / 2) / sampleRate;
+}
+
+inline bool isTsVideoStreamType(uint8_t streamType) {
+    return streamType == kTsStreamTypeH264 || streamType == kTsStreamTypeHEVC;
+}
+
+inline bool isTsDemuxedStreamType(uint8_t streamType) {
+    return isTsVideoStreamType(streamType) || streamType == kTsStreamTypeAAC;
+}
+
+// The timestamp ts (33 bits) closest to last, so they keep increasing across the wrap.
+inline int64_t unwrapTsTimestamp(int64_t ts, int64_t last) {
+    if (last == kTsNoTimestamp) {
+        return ts;
+    }
+    int64_t value = (last & ~(kTsTimestampWrap - 1)) + ts;
+    if (value - last > kTsTimestampWrap / 2) {
+        value -= kTsTimestampWrap;
+    } else if (last - value > kTsTimestampWrap / 2) {
+        value += kTsTimestampWrap;
+    }
+    return value;
+}
+
+struct AdtsHeader {
+    size_t frameSize;           // with the header
+    int sampleRate;
+    int channels;
+};
+
+// Parse the ADTS header at data. Returns false if there is none, or the frame is not complete.
+inline bool parseAdtsHeader(const uint8_t * data, size_t size, AdtsHeader & header) {
+    static const int kSampleRates[16] = {
+        96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350, 0, 0, 0
+    };
+    if (size < 7 || data[0] != 0xFF || (data[1] & 0xF6) != 0xF0) {
+        return false;
+    }
+    header.sampleRate = kSampleRates[(data[2] >> 2) & 0x0F];
+    header.channels = ((data[2] & 0x01) << 2) | (data[3] >> 6);
+    header.frameSize = (static_cast<size_t>(data[3] & 0x03) << 11) | (static_cast<size_t>(data[4]) << 3) |
+        (data[5] >> 5);
+    return header.sampleRate && header.frameSize >= 7 && header.frameSize <= size;
+}
+
+// One PES packet of an elementary stream: an access unit of the video, some AAC frames of the audio.
+struct TsFrame {
+    TsFrame() : pid(kTsPidNull), streamType(0), pts(kTsNoTimestamp), dts(kTsNoTimestamp),
+        keyframe(false), corrupt(false), data(nullptr), size(0), capacity(0) {}
+    ~TsFrame() { free(data); }
+
+    TsFrame(const TsFrame &) = delete;
+    TsFrame & operator=(const TsFrame &) = delete;
+
+    // Take the data, it is then freed with free() by the caller. It is followed by the padding
+    // of the demuxer, zeroed, and capacity() bytes long.
+    uint8_t * release() {
+        uint8_t * released = data;
+        data = nullptr;
+        capacity = 0;
+        return released;
+    }
+
+    uint16_t pid;
+    uint8_t streamType;
+    // 90KHz, unwrapped so they keep increasing, or kTsNoTimestamp.
+    int64_t pts;
+    int64_t dts;
+    // a video random access point, always set for the audio.
+    bool keyframe;
+    // some TS packets are lost (continuity counter), or have their transport error indicator set.
+    bool corrupt;
+    uint8_t * data;
+    size_t size;
+    size_t capacity;
+};
+
+struct TsDemuxStats {
+    uint64_t packets = 0;
+    uint64_t frames = 0;
+    // frames flagged corrupt, and PES starts which could not be parsed
+    uint64_t corruptFrames = 0;
+    // a datagram did not start with a TS packet, or lost the sync in it
+    uint64_t syncLosses = 0;
+};
+
+class TsDemuxer {
+ public:
+    // padding: zeroed bytes after the data of every frame, e.g. AV_INPUT_BUFFER_PADDING_SIZE.
+    explicit TsDemuxer(size_t padding = 0) : mPadding(padding), mLast(nullptr) {}
+
+    TsDemuxer(const TsDemuxer &) = delete;
+    TsDemuxer & operator=(const TsDemuxer &) = delete;
+
+    // Demux a datagram, onFrame(TsFrame &) is called for every frame it completes.
+    template <typename OnFrame>
+    void feed(const uint8_t * data, size_t size, OnFrame && onFrame) {
+        feed(data, size, 0, onFrame);
+    }
+
+    // Same, the datagram arrived at arrivalUs (any steady clock), for the PCR jitter.
+    template <typename OnFrame>
+    void feed(const uint8_t * data, size_t size, int64_t arrivalUs, OnFrame && onFrame) {
+        const uint8_t * p = data;
+        const uint8_t * end = data + size;
+        bool inSync = true;
+        while (p + kTsPacketSize <= end) {
+            if (p[0] != kTsSyncByte) {
+                if (inSync) {
+                    ++mStats.syncLosses;
+                    inSync = false;
+                }
+                ++p;
+                continue;
+            }
+            inSync = true;
+            TsPacket pkt;
+            if (parseTsPacket(p, pkt)) {
+                ++mStats.packets;
+                onPacket(pkt, arrivalUs, onFrame);
+            }
+            p += kTsPacketSize;
+        }
+    }
+
+    // Complete the frames in progress, e.g. at the end of a file.
+    template <typename OnFrame>
+    void flush(OnFrame && onFrame) {
+        for (std::unique_ptr<Stream> & stream : mStreams) {
+            if (stream->inFrame) {
+                emit(*stream, onFrame);
+            }
+        }
+    }
+
+    // Forget the program and the frames in progress, the stats and the quality are kept.
+    void reset() {
+        mProgram.reset();
+        mStreams.clear();
+        mLast = nullptr;
+    }
+
+    const TsProgramTracker & program() const { return mProgram; }
+    const TsDemuxStats & stats() const { return mStats; }
+    TsQuality & quality() { return mQuality; }
+    const TsQuality & quality() const { return mQuality; }
+
+ private:
+    struct Stream {
+        uint16_t pid;
+        uint8_t streamType;
+        bool inFrame = false;
+        // size of the PES payload, 0 if unbounded: the frame ends with the next PES start.
+        size_t expected = 0;
+        int64_t lastTimestamp = kTsNoTimestamp;
+        // capacity of the next buffer, from the last frame
+        size_t sizeHint = 0;
+        TsFrame frame;
+    };
+
+    Stream * find(uint16_t pid) {
+        if (mLast && mLast->pid == pid) {
+            return mLast;
+        }
+        for (std::unique_ptr<Stream> & stream : mStreams) {
+            if (stream->pid == pid) {
+                mLast = stream.get();
+                return mLast;
+            }
+        }
+        return nullptr;
+    }
+
+    // Keep the streams which are still in the PMT, with their frame in progress.
+    void updateStreams() {
+        std::vector<std::unique_ptr<Stream>> streams;
+        for (const TsStreamInfo & info : mProgram.streams()) {
+            if (!isTsDemuxedStreamType(info.streamType)) {
+                continue;
+            }
+            std::unique_ptr<Stream> stream;
+            for (std::unique_ptr<Stream> & old : mStreams) {
+                if (old && old->pid == info.pid && old->streamType == info.streamType) {
+                    stream.swap(old);
+                    break;
+                }
+            }
+            if (!stream) {
+                stream.reset(new Stream());
+                stream->pid = info.pid;
+                stream->streamType = info.streamType;
+            }
+            streams.push_back(std::move(stream));
+        }
+        mStreams.swap(streams);
+        mLast = nullptr;
+    }
+
+    template <typename OnFrame>
+    void onPacket(const TsPacket & pkt, int64_t arrivalUs, OnFrame & onFrame) {
+        if (pkt.pid == kTsPidNull) {
+            return;
+        }
+        const TsQuality::Continuity continuity = mQuality.add(pkt, arrivalUs);
+        if (continuity == TsQuality::Duplicate) {
+            return;
+        }
+        if (mProgram.isPsi(pkt.pid)) {
+            if (mProgram.feed(pkt)) {
+                updateStreams();
+            }
+            return;
+        }
+        Stream * stream = find(pkt.pid);
+        if (!stream) {
+            return;
+        }
+        if (continuity == TsQuality::Lost) {
+            // the frame in progress, or the previous one if this packet starts another.
+            stream->frame.corrupt = true;
+        }
+        if (!pkt.hasPayload) {
+            return;
+        }
+        if (pkt.pusi) {
+            if (stream->inFrame) {
+                emit(*stream, onFrame);
+            }
+            start(*stream, pkt);
+        } else if (stream->inFrame) {
+            stream->frame.corrupt |= pkt.tei;
+            append(*stream, pkt.payload, pkt.payloadSize);
+        }
+        if (stream->inFrame && stream->expected && stream->frame.size >= stream->expected) {
+            stream->frame.size = stream->expected;
+            emit(*stream, onFrame);
+        }
+    }
+
+    void start(Stream & stream, const TsPacket & pkt) {
+        TsFrame & frame = stream.frame;
+        const uint8_t * payload = pkt.payload;
+        const size_t size = pkt.payloadSize;
+        frame.size = 0;
+        frame.corrupt = pkt.tei;
+        // The PES header fits in the first TS packet of the streams this is for.
+        size_t headerSize = size >= 9 ? 9 + static_cast<size_t>(payload[8]) : 0;
+        if (size < 9 || payload[0] != 0 || payload[1] != 0 || payload[2] != 1 || headerSize > size) {
+            ++mStats.corruptFrames;
+            stream.inFrame = false;
+            return;
+        }
+        size_t pesLength = (static_cast<size_t>(payload[4]) << 8) | payload[5];
+        if (pesLength && pesLength + 6 < headerSize) {
+            ++mStats.corruptFrames;
+            stream.inFrame = false;
+            return;
+        }
+        stream.expected = pesLength ? pesLength + 6 - headerSize : 0;
+        const uint8_t flags = payload[7] >> 6;
+        frame.pts = kTsNoTimestamp;
+        frame.dts = kTsNoTimestamp;
+        if ((flags & 0x02) && headerSize >= 14) {
+            frame.pts = unwrapTsTimestamp(pesTimestamp(payload + 9), stream.lastTimestamp);
+            frame.dts = frame.pts;
+            if (flags == 0x03 && headerSize >= 19) {
+                frame.dts = unwrapTsTimestamp(pesTimestamp(payload + 14), frame.pts);
+            }
+            stream.lastTimestamp = frame.dts;
+        }
+        frame.keyframe = pkt.randomAccess;
+        stream.inFrame = true;
+        append(stream, payload + headerSize, size - headerSize);
+    }
+
+    void append(Stream & stream, const uint8_t * data, size_t size) {
+        TsFrame & frame = stream.frame;
+        size_t needed = frame.size + size + mPadding;
+        if (needed > frame.capacity) {
+            size_t capacity = std::max(needed, std::max(frame.capacity * 2, stream.sizeHint));
+            uint8_t * grown = static_cast<uint8_t *>(realloc(frame.data, capacity));
+            if (!grown) {
+                // out of memory, the frame goes out truncated.
+                frame.corrupt = true;
+                return;
+            }
+            frame.data = grown;
+            frame.capacity = capacity;
+        }
+        memcpy(frame.data + frame.size, data, size);
+        frame.size += size;
+    }
+
+    template <typename OnFrame>
+    void emit(Stream & stream, OnFrame & onFrame) {
+        TsFrame & frame = stream.frame;
+        stream.inFrame = false;
+        if (!frame.data) {
+            return;
+        }
+        memset(frame.data + frame.size, 0, mPadding);
+        frame.pid = stream.pid;
+        frame.streamType = stream.streamType;
+        if (stream.streamType == kTsStreamTypeAAC) {
+            frame.keyframe = true;
+        } else if (!frame.keyframe) {
+            frame.keyframe = startsRandomAccess(stream.streamType == kTsStreamTypeHEVC ?
+                VideoCodec::HEVC : VideoCodec::H264, frame.data, frame.size);
+        }
+        ++mStats.frames;
+        if (frame.corrupt) {
+            ++mStats.corruptFrames;
+        }
+        stream.sizeHint = frame.size + mPadding;
+        onFrame(frame);
+        frame.size = 0;
+        frame.corrupt = false;
+    }
+
+    const size_t mPadding;
+    TsProgramTracker mProgram;
+    std::vector<std::unique_ptr<Stream>> mStreams;
+    Stream * mLast;
+    TsDemuxStats mStats;
+    TsQuality mQuality;
+};
+
+}  // namespace cmxs_common
+
+#endif  // CMXS_COMMON_TS_DEMUX_H
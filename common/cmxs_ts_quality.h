@@ -0,0 +1,258 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * Transport quality of a received TS, per PID, for the paths which want to tell network loss
+ * from encoder or decoder trouble:
+ *
+ *   continuity counter errors, and the TS packets they lose (modulo 16, so at least that many)
+ *   duplicated TS packets, transport error indicators
+ *   discontinuity indicators, and the PCR jumps without one (backwards, or more than 1s ahead)
+ *   the PCR arrival jitter: how much later than the earliest one a PCR arrived, on the clock of
+ *   the receiver; the max over a window, see endWindow(). The earliest one is taken from the
+ *   last window, so the drift of the sender and receiver clocks does not add up.
+ *   the PES units damaged by the above, counted when they end
+ *
+ * Not thread safe, it is used by the receiving thread.
+ */
+
+#ifndef CMXS_COMMON_TS_QUALITY_H
+#define CMXS_COMMON_TS_QUALITY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+
+#include "cmxs_ts.h"
+
+namespace cmxs_common {
+
+// The PCR interval is at most 100ms, a gap of 1s is another timeline.
+static constexpr int64_t kTsPcrMaxGapUs = 1000000;
+// PIDs tracked, the next ones are not.
+static constexpr size_t kTsQualityMaxPids = 32;
+
+struct TsPidQuality {
+    uint16_t pid = kTsPidNull;
+    uint64_t packets = 0;
+    uint64_t ccErrors = 0;
+    uint64_t lostPackets = 0;
+    uint64_t duplicates = 0;
+    uint64_t transportErrors = 0;
+    uint64_t discontinuities = 0;
+    uint64_t pcrJumps = 0;
+    uint64_t pcrs = 0;
+    // max PCR arrival jitter of the last window
+    int64_t pcrJitterUs = 0;
+    uint64_t corruptPes = 0;
+};
+
+class TsQuality {
+ public:
+    enum Continuity {
+        Continuous,
+        // the same TS packet again, to skip
+        Duplicate,
+        // some TS packets are missing before this one
+        Lost,
+    };
+
+    TsQuality() : mLast(nullptr) {
+        // the states do not move, mLast stays valid.
+        mPids.reserve(kTsQualityMaxPids);
+    }
+
+    // Account a TS packet which arrived at arrivalUs (any steady clock, 0 for no PCR jitter).
+    Continuity add(const TsPacket & pkt, int64_t arrivalUs) {
+        if (pkt.pid == kTsPidNull) {
+            return Continuous;
+        }
+        PidState * state = find(pkt.pid);
+        if (!state) {
+            return Continuous;
+        }
+        TsPidQuality & q = state->quality;
+        ++q.packets;
+        Continuity continuity = Continuous;
+        if (pkt.discontinuity) {
+            ++q.discontinuities;
+        } else if (state->cc >= 0) {
+            // the counter only increases with a payload.
+            const int expected = pkt.hasPayload ? (state->cc + 1) & 0x0F : state->cc;
+            if (pkt.hasPayload && pkt.cc == state->cc) {
+                ++q.duplicates;
+                return Duplicate;
+            }
+            if (pkt.cc != expected) {
+                ++q.ccErrors;
+                q.lostPackets += (pkt.cc - expected) & 0x0F;
+                continuity = Lost;
+            }
+        }
+        state->cc = pkt.cc;
+        if (pkt.tei) {
+            ++q.transportErrors;
+        }
+        if (pkt.hasPcr) {
+            addPcr(*state, pkt, arrivalUs);
+        }
+        if ((continuity == Lost || pkt.tei) && state->inPes) {
+            state->pesDamaged = true;
+        }
+        if (pkt.pusi && pkt.hasPayload) {
+            if (state->inPes && state->pesDamaged) {
+                ++q.corruptPes;
+            }
+            state->inPes = true;
+            state->pesDamaged = pkt.tei;
+        }
+        return continuity;
+    }
+
+    // Account the TS packets of a datagram, for the paths which do not demux it.
+    void addDatagram(const uint8_t * data, size_t size, int64_t arrivalUs) {
+        for (size_t offset = 0; offset + kTsPacketSize <= size; offset += kTsPacketSize) {
+            TsPacket pkt;
+            if (parseTsPacket(data + offset, pkt)) {
+                add(pkt, arrivalUs);
+            }
+        }
+    }
+
+    // The max PCR jitter of the window which ends goes into TsPidQuality::pcrJitterUs.
+    // The next window measures from the earliest PCR of this one.
+    void endWindow() {
+        for (PidState & state : mPids) {
+            state.quality.pcrJitterUs = state.windowJitterUs;
+            state.windowJitterUs = 0;
+            if (state.hasWindowDelay) {
+                state.minDelayUs = state.windowMinDelayUs;
+                state.hasWindowDelay = false;
+            }
+        }
+    }
+
+    std::vector<TsPidQuality> pids() const {
+        std::vector<TsPidQuality> pids;
+        for (const PidState & state : mPids) {
+            pids.push_back(state.quality);
+        }
+        std::sort(pids.begin(), pids.end(), [](const TsPidQuality & a, const TsPidQuality & b) {
+            return a.pid < b.pid;
+        });
+        return pids;
+    }
+
+    // The counters of all the PIDs, and the max jitter of the PCR PIDs.
+    TsPidQuality total() const {
+        TsPidQuality total;
+        for (const PidState & state : mPids) {
+            const TsPidQuality & q = state.quality;
+            total.packets += q.packets;
+            total.ccErrors += q.ccErrors;
+            total.lostPackets += q.lostPackets;
+            total.duplicates += q.duplicates;
+            total.transportErrors += q.transportErrors;
+            total.discontinuities += q.discontinuities;
+            total.pcrJumps += q.pcrJumps;
+            total.pcrs += q.pcrs;
+            total.pcrJitterUs = std::max(total.pcrJitterUs, q.pcrJitterUs);
+            total.corruptPes += q.corruptPes;
+        }
+        return total;
+    }
+
+    void reset() {
+        mPids.clear();
+        mLast = nullptr;
+    }
+
+ private:
+    struct PidState {
+        TsPidQuality quality;
+        // last continuity counter, -1 before the first TS packet
+        int cc = -1;
+        bool inPes = false;
+        bool pesDamaged = false;
+        bool hasPcr = false;
+        bool hasDelayBase = false;
+        int64_t minDelayUs = 0;
+        // the earliest PCR of the current window, the base of the next one
+        bool hasWindowDelay = false;
+        int64_t windowMinDelayUs = 0;
+        int64_t lastPcrUs = 0;
+        int64_t windowJitterUs = 0;
+    };
+
+    PidState * find(uint16_t pid) {
+        if (mLast && mLast->quality.pid == pid) {
+            return mLast;
+        }
+        for (PidState & state : mPids) {
+            if (state.quality.pid == pid) {
+                mLast = &state;
+                return mLast;
+            }
+        }
+        if (mPids.size() >= kTsQualityMaxPids) {
+            return nullptr;
+        }
+        mPids.push_back(PidState());
+        mLast = &mPids.back();
+        mLast->quality.pid = pid;
+        return mLast;
+    }
+
+    void addPcr(PidState & state, const TsPacket & pkt, int64_t arrivalUs) {
+        ++state.quality.pcrs;
+        const int64_t pcrUs = static_cast<int64_t>(pkt.pcr / 27);
+        const bool jump = state.hasPcr &&
+            (pcrUs < state.lastPcrUs || pcrUs - state.lastPcrUs > kTsPcrMaxGapUs);
+        if (jump && !pkt.discontinuity) {
+            ++state.quality.pcrJumps;
+        }
+        state.hasPcr = true;
+        state.lastPcrUs = pcrUs;
+        if (!arrivalUs) {
+            return;
+        }
+        const int64_t delayUs = arrivalUs - pcrUs;
+        if (!state.hasDelayBase || jump || pkt.discontinuity) {
+            // a new timeline, e.g. the sender restarted or the PCR wrapped.
+            state.hasDelayBase = true;
+            state.minDelayUs = delayUs;
+            state.hasWindowDelay = false;
+        }
+        state.minDelayUs = std::min(state.minDelayUs, delayUs);
+        state.windowMinDelayUs = state.hasWindowDelay ? std::min(state.windowMinDelayUs, delayUs) : delayUs;
+        state.hasWindowDelay = true;
+        state.windowJitterUs = std::max(state.windowJitterUs, delayUs - state.minDelayUs);
+    }
+
+    std::vector<PidState> mPids;
+    PidState * mLast;
+};
+
+}  // namespace cmxs_common
+
+#endif  // CMXS_COMMON_TS_QUALITY_H
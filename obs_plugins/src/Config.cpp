@@ -32,6 +32,9 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #define PARAM_GLOBAL_HOST "GlobalHost"
 #define PARAM_STREAM_NAME "StreamName"
 #define PARAM_STREAM_KEY "StreamKey"
+#define PARAM_LATENCY_STAMP "LatencyStamp"
+#define PARAM_TRACE_PATH "TracePath"
+#define PARAM_METRICS_PORT "MetricsPort"
 
 
 Config *Config::_instance = nullptr;
@@ -39,6 +42,8 @@ Config *Config::_instance = nullptr;
 Config::Config() {
         isConnected = false;
         isStart = false;
+        latencyStamp = false;
+        metricsPort = 0;
 }
 
 void Config::Load() {
@@ -54,6 +59,15 @@ void Config::Load() {
 
         streamKey = config_get_string(
             obs_config, SECTION_NAME, PARAM_STREAM_KEY);
+
+        latencyStamp = config_get_bool(
+            obs_config, SECTION_NAME, PARAM_LATENCY_STAMP);
+
+        tracePath = config_get_string(
+            obs_config, SECTION_NAME, PARAM_TRACE_PATH);
+
+        metricsPort = static_cast<int>(config_get_int(
+            obs_config, SECTION_NAME, PARAM_METRICS_PORT));
     }
 }
 
@@ -74,6 +88,16 @@ void Config::Save() {
                 PARAM_STREAM_KEY,
                 streamKey.toUtf8().constData());
 
+        config_set_bool(obs_config, SECTION_NAME,
+                PARAM_LATENCY_STAMP, latencyStamp);
+
+        config_set_string(obs_config, SECTION_NAME,
+                PARAM_TRACE_PATH,
+                tracePath.toUtf8().constData());
+
+        config_set_int(obs_config, SECTION_NAME,
+                PARAM_METRICS_PORT, metricsPort);
+
         config_save(obs_config);
     }
 }
@@ -40,8 +40,11 @@ class Config {
     QString deviceId;
     QString streamName;
     QString streamKey;
+    QString tracePath;  // Chrome trace file of the output, empty for none
     std::unordered_map<std::string, CMXSLinkDeviceType_t> mSelectedNic;
+    int metricsPort;  // port of the metrics endpoint on 127.0.0.1, 0 for none
     bool isStart;      // enable streaming checked
+    bool latencyStamp;  // put the capture time into the video, see cmxs_latency.h
     bool isConnected;   // cmxs connected
  private:
     static Config *_instance;
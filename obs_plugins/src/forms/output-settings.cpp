@@ -25,6 +25,7 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 
 #include "../Config.h"
 #include "../main-output.h"
+#include "../obs-cmxs-metrics.h"
 #include <QCheckBox>
 #include <iostream>
 #ifndef _WIN32
@@ -40,8 +41,8 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #ifdef __APPLE__
 #include <CoreFoundation/CoreFoundation.h>
 #include <SystemConfiguration/SystemConfiguration.h>
-#include "../obs-cmxs-tool.h"
 #endif
+#include "../obs-cmxs-tool.h"
 #include <cstring>
 #include <cmxssdk/cmxs_type.h>
 
@@ -53,13 +54,13 @@ OutputSettings::OutputSettings(QWidget *parent)
 
     ui->setupUi(this);
 
-    #ifdef __APPLE__
+    #ifdef CMXS_NIC_SELECTION
     QVBoxLayout* dynamicInputsLayout = ui->dynamicInputsLayout;
     std::unordered_map<std::string, std::string>   nics;
     getNetworkInterfacesInfo(nics);
     for (const auto& entry : nics) {
-        bool nicIsWifi = false;
-        if (!getNicType(entry.first, nicIsWifi)) {
+        CMXSLinkDeviceType_t nicType = kCMXSLinkDeviceTypeUnknown;
+        if (!getNicLinkType(entry.first, nicType)) {
             continue;
         }
         const int labelWidth = 200;
@@ -73,8 +74,10 @@ OutputSettings::OutputSettings(QWidget *parent)
         comboBox->addItem(obs_module_text("CMXSPlugin.wifi"));
         comboBox->addItem(obs_module_text("CMXSPlugin.cable"));
         comboBox->addItem(obs_module_text("CMXSPlugin.cellular"));
-        if (nicIsWifi) {
+        if (nicType == kCMXSLinkDeviceTypeWiFi) {
             comboBox->setCurrentIndex(comboBox->findText(obs_module_text("CMXSPlugin.wifi")));
+        } else if (nicType == kCMXSLinkDeviceTypeCellular) {
+            comboBox->setCurrentIndex(comboBox->findText(obs_module_text("CMXSPlugin.cellular")));
         } else {
             comboBox->setCurrentIndex(comboBox->findText(obs_module_text("CMXSPlugin.cable")));
         }
@@ -102,7 +105,10 @@ void OutputSettings::onFormAccepted() {
     conf->deviceId = ui->GlobalDeviceId->text();
 
     conf->streamKey = ui->StreamKey->text();
-    #ifdef __APPLE__
+    conf->latencyStamp = ui->latencyStampCheckbox->isChecked();
+    conf->tracePath = ui->TracePath->text();
+    conf->metricsPort = ui->MetricsPort->value();
+    #ifdef CMXS_NIC_SELECTION
     conf->mSelectedNic.clear();
     for (const auto& pair : mLabelWidgetMap) {
         std::string label = pair.first;
@@ -125,6 +131,7 @@ void OutputSettings::onFormAccepted() {
     }
     #endif
     conf->Save();
+    MetricsServer::instance().setPort(conf->metricsPort);
     main_output_gbl_init();
     conf->isStart = ui->enableStreamingCheckbox->isChecked();
     blog(LOG_INFO,
@@ -156,6 +163,9 @@ void OutputSettings::showEvent(QShowEvent *event) {
         ui->net_interface->setVisible(false);
     #endif
     ui->StreamKey->setText(conf->streamKey);
+    ui->latencyStampCheckbox->setChecked(conf->latencyStamp);
+    ui->TracePath->setText(conf->tracePath);
+    ui->MetricsPort->setValue(conf->metricsPort);
     ui->enableStreamingCheckbox->setChecked(conf->isStart);
     const char* copyrightInfo = "Copyright © 2023 Caton Technology. All rights reserved.";
     const char* versionString = cmxssdk_version();
@@ -177,7 +187,7 @@ void OutputSettings::ToggleShowHide() {
 }
 
 OutputSettings::~OutputSettings() {
-    #ifdef __APPLE__
+    #ifdef CMXS_NIC_SELECTION
     for (const auto& pair : mLabelWidgetMap) {
         delete pair.second.first;  // QCheckBox
         delete pair.second.second;  // QComboBox
@@ -28,7 +28,7 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include <unordered_map>
 #include <QComboBox>
 
-
+#include "../obs-cmxs-tool.h"
 #include "ui_output-settings.h"
 using WidgetPair = std::pair<QCheckBox*, QComboBox*>;
 
@@ -40,7 +40,7 @@ class OutputSettings : public QDialog {
     void showEvent(QShowEvent *event);
     void ToggleShowHide();
     void setStatusIndicatorColor(const QColor &color);
-    #ifdef __APPLE__
+    #ifdef CMXS_NIC_SELECTION
     std::unordered_map<std::string, WidgetPair> mLabelWidgetMap;
     #endif
  private slots:
@@ -0,0 +1,94 @@
+/*
+Plugin Name obs-cmxs
+Copyright (C) <2024> <Caton> <c3@catontechnology.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+/*
+ * This is a simple example of showing how to use CMXSSDK on OBS.
+ * This file tells when a CMXS sender or receiver is connected: the listener
+ * sets the result from the SDK messages, and the plugin waits for it or is called back.
+ * You can use CMake to generate makefile and make it.
+ */
+
+#ifndef OBSCMXS_CONNECT_H
+#define OBSCMXS_CONNECT_H
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+// Margin over CMXSStreamParam_t::mConnectTimeOut, in case the SDK reports nothing.
+static constexpr uint32_t CONNECT_WAIT_MARGIN_MS = 2000;
+
+class ConnectWait {
+ public:
+    enum State {
+        Connecting,
+        Connected,
+        Failed,
+    };
+
+    ConnectWait() : mState(Connecting) {}
+
+    ConnectWait(const ConnectWait&) = delete;
+    ConnectWait& operator=(const ConnectWait&) = delete;
+
+    // From the listener. Only the first result counts, e.g. a later failure of a connected
+    // sender is not a connect failure.
+    void set(State state) {
+        std::function<void()> cb;
+        {
+            std::unique_lock<std::mutex> locker(mMtx);
+            if (mState != Connecting || state == Connecting) {
+                return;
+            }
+            mState = state;
+            cb = mDone;
+        }
+        mCond.notify_all();
+        if (cb) {
+            cb();
+        }
+    }
+
+    State state() {
+        std::unique_lock<std::mutex> locker(mMtx);
+        return mState;
+    }
+
+    // Wait for the result up to timeoutMs. Returns Connecting on timeout.
+    State wait(uint32_t timeoutMs) {
+        std::unique_lock<std::mutex> locker(mMtx);
+        mCond.wait_for(locker, std::chrono::milliseconds(timeoutMs), [this]() { return mState != Connecting; });
+        return mState;
+    }
+
+    // cb is called from the thread of set() when the result comes, for the callers which
+    // cannot block. Set it before the sender or receiver is created.
+    void onDone(std::function<void()> cb) {
+        std::unique_lock<std::mutex> locker(mMtx);
+        mDone = std::move(cb);
+    }
+
+ private:
+    std::mutex mMtx;
+    std::condition_variable mCond;
+    State mState;
+    std::function<void()> mDone;
+};
+
+#endif  // OBSCMXS_CONNECT_H
@@ -0,0 +1,239 @@
+/*
+Plugin Name obs-cmxs
+Copyright (C) <2024> <Caton> <c3@catontechnology.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+/*
+ * This is a simple example of showing how to use CMXSSDK on OBS.
+ * This file runs the pipeline stages of the CMXS sources.
+ * You can use CMake to generate makefile and make it.
+ */
+#include "obs-cmxs-executor.h"
+
+#include <obs-module.h>
+#include <algorithm>
+#include "cmxs_trace.h"
+
+// the worker running on the calling thread, -1 for the other threads
+static thread_local int sCurrentWorker = -1;
+
+Executor& Executor::instance() {
+    static Executor sExecutor;
+    return sExecutor;
+}
+
+Executor::Executor()
+    : mNextWorker(0),
+    mQueued(0),
+    mTimerSeq(0),
+    mQuit(false) {
+    size_t count = std::max(2u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < count; ++i) {
+        mWorkers.emplace_back(new Worker());
+        mWorkers.back()->name = "cmxs worker " + std::to_string(i);
+    }
+    // all the queues exist before a worker can steal.
+    for (size_t i = 0; i < count; ++i) {
+        mWorkers[i]->thread = std::thread(&Executor::run, this, i);
+    }
+    mTimerThread = std::thread(&Executor::runTimers, this);
+    blog(LOG_INFO, "executor: %zu workers", count);
+}
+
+Executor::~Executor() {
+    // nothing left to join when the module shut it down.
+    shutdown();
+}
+
+void Executor::shutdown() {
+    std::unique_lock<std::mutex> shutdownLocker(mShutdownMtx);
+    if (!mTimerThread.joinable()) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> locker(mIdleMtx);
+        std::unique_lock<std::mutex> timerLocker(mTimerMtx);
+        mQuit = true;
+    }
+    mIdleCond.notify_all();
+    mTimerCond.notify_all();
+    mTimerThread.join();
+    for (auto& worker : mWorkers) {
+        worker->thread.join();
+    }
+    size_t timers = mTimers.size();
+    mTimers.clear();
+    blog(LOG_INFO, "executor: shut down, %zu timers dropped", timers);
+}
+
+void Executor::post(Task task) {
+    size_t worker = sCurrentWorker >= 0 ? static_cast<size_t>(sCurrentWorker) :
+        mNextWorker++ % mWorkers.size();
+    push(worker, std::move(task));
+}
+
+void Executor::postAfter(uint32_t delayMs, Task task) {
+    {
+        std::unique_lock<std::mutex> locker(mTimerMtx);
+        mTimers.push_back(Timer{std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs),
+            mTimerSeq++, std::move(task)});
+        std::push_heap(mTimers.begin(), mTimers.end());
+    }
+    mTimerCond.notify_one();
+}
+
+void Executor::push(size_t worker, Task task) {
+    {
+        // with the task, pop() cannot take it before it is counted.
+        std::unique_lock<std::mutex> locker(mWorkers[worker]->mtx);
+        mWorkers[worker]->tasks.push_back(std::move(task));
+        ++mQueued;
+    }
+    {
+        // a worker going to sleep has checked mQueued, or sees it now.
+        std::unique_lock<std::mutex> locker(mIdleMtx);
+    }
+    mIdleCond.notify_one();
+}
+
+bool Executor::pop(size_t self, Task& task) {
+    for (size_t i = 0; i < mWorkers.size(); ++i) {
+        Worker& worker = *mWorkers[(self + i) % mWorkers.size()];
+        std::unique_lock<std::mutex> locker(worker.mtx);
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            --mQueued;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Executor::run(size_t self) {
+    sCurrentWorker = static_cast<int>(self);
+    cmxs_common::traceThreadName() = mWorkers[self]->name.c_str();
+    Task task;
+    while (true) {
+        if (pop(self, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> locker(mIdleMtx);
+        mIdleCond.wait(locker, [this]() { return mQueued > 0 || mQuit; });
+        // the queued tasks run before it quits.
+        if (mQuit && mQueued == 0) {
+            break;
+        }
+    }
+}
+
+void Executor::runTimers() {
+    std::unique_lock<std::mutex> locker(mTimerMtx);
+    while (!mQuit) {
+        if (mTimers.empty()) {
+            mTimerCond.wait(locker);
+            continue;
+        }
+        // a copy: postAfter() may grow the heap while it waits unlocked.
+        std::chrono::steady_clock::time_point at = mTimers.front().at;
+        if (at > std::chrono::steady_clock::now()) {
+            mTimerCond.wait_until(locker, at);
+            continue;
+        }
+        std::pop_heap(mTimers.begin(), mTimers.end());
+        Task task = std::move(mTimers.back().task);
+        mTimers.pop_back();
+        locker.unlock();
+        post(std::move(task));
+        locker.lock();
+    }
+}
+
+SerialTask::SerialTask(std::function<void()> fn)
+    : mFn(std::move(fn)),
+    mScheduled(false),
+    mRunning(false),
+    mAgain(false),
+    mTimerLink(std::make_shared<TimerLink>(this)),
+    mTimers(0) {}
+
+SerialTask::~SerialTask() {
+    wait();
+}
+
+void SerialTask::schedule() {
+    std::unique_lock<std::mutex> locker(mMtx);
+    scheduleLocked();
+}
+
+void SerialTask::scheduleAfter(uint32_t delayMs) {
+    std::unique_lock<std::mutex> locker(mMtx);
+    ++mTimers;
+    std::shared_ptr<TimerLink> link = mTimerLink;
+    Executor::instance().postAfter(delayMs, [link]() {
+        // wait() cuts the link under this lock, the task is not used after.
+        std::unique_lock<std::mutex> locker(link->mtx);
+        if (link->task) {
+            link->task->schedule();
+        }
+    });
+}
+
+void SerialTask::wait() {
+    for (;;) {
+        std::shared_ptr<TimerLink> link;
+        {
+            std::unique_lock<std::mutex> locker(mMtx);
+            mCond.wait(locker, [this]() { return !mScheduled && !mRunning; });
+            if (mTimers == 0) {
+                return;
+            }
+            link = mTimerLink;
+            mTimerLink = std::make_shared<TimerLink>(this);
+            mTimers = 0;
+        }
+        // A timer firing now schedules the task once more, it is waited for by the next turn.
+        // The ones left in the executor then do nothing, a long timer does not hold the stop.
+        std::unique_lock<std::mutex> locker(link->mtx);
+        link->task = nullptr;
+    }
+}
+
+void SerialTask::scheduleLocked() {
+    if (mRunning) {
+        mAgain = true;
+    } else if (!mScheduled) {
+        mScheduled = true;
+        Executor::instance().post([this]() { run(); });
+    }
+}
+
+void SerialTask::run() {
+    {
+        std::unique_lock<std::mutex> locker(mMtx);
+        mScheduled = false;
+        mRunning = true;
+    }
+    mFn();
+    std::unique_lock<std::mutex> locker(mMtx);
+    mRunning = false;
+    if (mAgain) {
+        mAgain = false;
+        scheduleLocked();
+    }
+    mCond.notify_all();
+}
@@ -0,0 +1,142 @@
+/*
+Plugin Name obs-cmxs
+Copyright (C) <2024> <Caton> <c3@catontechnology.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+/*
+ * This is a simple example of showing how to use CMXSSDK on OBS.
+ * This file runs the pipeline stages of all the CMXS sources on one pool of
+ * threads, one per core, instead of threads per source.
+ * You can use CMake to generate makefile and make it.
+ */
+
+#ifndef OBSCMXS_EXECUTOR_H
+#define OBSCMXS_EXECUTOR_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Work stealing pool: every worker runs its own queue in order, and takes the
+// oldest tasks of the others when it is empty.
+class Executor {
+ public:
+    typedef std::function<void()> Task;
+
+    static Executor& instance();
+
+    // Run task on a worker. From a worker, it goes to the queue of this worker.
+    void post(Task task);
+    // Run task in delayMs, from the timer thread which then posts it.
+    void postAfter(uint32_t delayMs, Task task);
+    // Run the queued tasks, drop the timers and join the threads; nothing runs after.
+    // From obs_module_unload: the static destructor runs under the loader lock on Windows,
+    // where joining the threads may deadlock.
+    void shutdown();
+
+    size_t workers() const { return mWorkers.size(); }
+
+ private:
+    struct Worker {
+        std::mutex mtx;
+        std::deque<Task> tasks;
+        std::thread thread;
+        std::string name;
+    };
+    struct Timer {
+        std::chrono::steady_clock::time_point at;
+        uint64_t seq;
+        Task task;
+        // the earliest first, in order of postAfter() for the same time
+        bool operator<(const Timer& other) const {
+            return at != other.at ? at > other.at : seq > other.seq;
+        }
+    };
+
+    Executor();
+    ~Executor();
+
+    void push(size_t worker, Task task);
+    // own queue first, then steal.
+    bool pop(size_t self, Task& task);
+    void run(size_t self);
+    void runTimers();
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::atomic<size_t> mNextWorker;
+    // the idle workers wait for mQueued
+    std::mutex mIdleMtx;
+    std::condition_variable mIdleCond;
+    // tasks in the queues, changed under the lock of the queue: it is counted before it is taken.
+    std::atomic<size_t> mQueued;
+    std::mutex mTimerMtx;
+    std::condition_variable mTimerCond;
+    std::vector<Timer> mTimers;
+    uint64_t mTimerSeq;
+    std::thread mTimerThread;
+    bool mQuit;
+    std::mutex mShutdownMtx;
+};
+
+// A function run on the executor, never concurrently with itself: a pipeline stage of a source.
+// schedule() while it runs makes it run once more after, so the work queued meanwhile is not missed.
+class SerialTask {
+ public:
+    explicit SerialTask(std::function<void()> fn);
+    // wait() must have returned.
+    ~SerialTask();
+
+    SerialTask(const SerialTask&) = delete;
+    SerialTask& operator=(const SerialTask&) = delete;
+
+    void schedule();
+    void scheduleAfter(uint32_t delayMs);
+    // Until it is neither scheduled nor running, its pending timers are cancelled: it does not wait
+    // for them. The function must not schedule it again by then, e.g. it checks a running flag
+    // cleared before.
+    void wait();
+
+ private:
+    // What the timers of scheduleAfter() schedule, nothing once wait() cut it.
+    struct TimerLink {
+        explicit TimerLink(SerialTask *t) : task(t) {}
+        std::mutex mtx;
+        SerialTask *task;
+    };
+
+    // mMtx is held.
+    void scheduleLocked();
+    void run();
+
+    std::function<void()> mFn;
+    std::mutex mMtx;
+    std::condition_variable mCond;
+    bool mScheduled;
+    bool mRunning;
+    bool mAgain;
+    std::shared_ptr<TimerLink> mTimerLink;
+    // timers posted through mTimerLink
+    int mTimers;
+};
+
+#endif  // OBSCMXS_EXECUTOR_H
@@ -0,0 +1,150 @@
+/*
+Plugin Name obs-cmxs
+Copyright (C) <2024> <Caton> <c3@catontechnology.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+/*
+ * This is a simple example of showing how to use CMXSSDK on OBS.
+ * This file limits the logs of the per-packet paths: under a fault they would
+ * be written for every packet, flooding the log and taking the CPU of the pipeline.
+ * You can use CMake to generate makefile and make it.
+ */
+
+#ifndef OBSCMXS_LOG_H
+#define OBSCMXS_LOG_H
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The limited logs of one source or output: every call site logs at most once per interval,
+// the next log tells how many times it happened since. One instance per source or output,
+// so a faulty one does not hide the messages of the others.
+class LogLimiters {
+ public:
+    explicit LogLimiters(uint64_t intervalMs = 5000)
+        : mIntervalNs(intervalMs * 1000000), mNextFlushNs(UINT64_MAX) {}
+    ~LogLimiters() { flush(); }
+
+    LogLimiters(const LogLimiters &) = delete;
+    LogLimiters &operator=(const LogLimiters &) = delete;
+
+    // site tells the call sites apart, see blog_limited().
+    void log(const void *site, int level, const char *format, ...) {
+        uint64_t now = os_gettime_ns();
+        uint64_t count = 0;
+        uint64_t elapsedNs = 0;
+        char message[512];
+        {
+            std::unique_lock<std::mutex> locker(mMtx);
+            Site &entry = mSites[site];
+            if (entry.lastLogNs && now - entry.lastLogNs < mIntervalNs) {
+                ++entry.suppressed;
+                mNextFlushNs = std::min(mNextFlushNs, entry.lastLogNs + mIntervalNs);
+                return;
+            }
+            count = entry.suppressed + 1;
+            elapsedNs = entry.lastLogNs ? now - entry.lastLogNs : 0;
+            entry.suppressed = 0;
+            entry.lastLogNs = now;
+            entry.level = level;
+            // only formatted when logged, and kept for the count of the next ones if they are flushed.
+            va_list args;
+            va_start(args, format);
+            vsnprintf(message, sizeof(message), format, args);
+            va_end(args);
+            entry.message = message;
+        }
+        if (elapsedNs && count > 1) {
+            blog(level, "%s (%llu occurrences in the last %.0f s)", message,
+                static_cast<unsigned long long>(count), elapsedNs / 1e9);
+        } else {
+            blog(level, "%s", message);
+        }
+    }
+
+    // Log the counts of the call sites which stayed silent for their interval since they were
+    // suppressed, e.g. the last burst before a fault cleared. Cheap when there is nothing to log.
+    void flushExpired() { flush(false); }
+
+    // Log all the counts not logged yet, e.g. when stopping.
+    void flush() { flush(true); }
+
+ private:
+    struct Site {
+        int level = LOG_INFO;
+        uint64_t lastLogNs = 0;
+        // occurrences since the last log
+        uint64_t suppressed = 0;
+        // the last one logged
+        std::string message;
+    };
+    struct Pending {
+        int level;
+        std::string message;
+        uint64_t count;
+        uint64_t elapsedNs;
+    };
+
+    void flush(bool all) {
+        uint64_t now = os_gettime_ns();
+        std::vector<Pending> pending;
+        {
+            std::unique_lock<std::mutex> locker(mMtx);
+            if (!all && now < mNextFlushNs) {
+                return;
+            }
+            mNextFlushNs = UINT64_MAX;
+            for (auto &entry : mSites) {
+                Site &site = entry.second;
+                if (!site.suppressed) {
+                    continue;
+                }
+                if (!all && now - site.lastLogNs < mIntervalNs) {
+                    mNextFlushNs = std::min(mNextFlushNs, site.lastLogNs + mIntervalNs);
+                    continue;
+                }
+                pending.push_back(Pending{site.level, site.message, site.suppressed, now - site.lastLogNs});
+                site.suppressed = 0;
+                site.lastLogNs = now;
+            }
+        }
+        for (const Pending &p : pending) {
+            blog(p.level, "%s (%llu more occurrences in the last %.0f s)", p.message.c_str(),
+                static_cast<unsigned long long>(p.count), p.elapsedNs / 1e9);
+        }
+    }
+
+    std::mutex mMtx;
+    const uint64_t mIntervalNs;
+    // when a suppressed count is due, UINT64_MAX for none
+    uint64_t mNextFlushNs;
+    std::unordered_map<const void *, Site> mSites;
+};
+
+// blog() for the per-packet paths of a source or output, limited by its LogLimiters.
+#define blog_limited(limiters, level, ...) do { \
+        static const char cmxs_log_site = 0; \
+        (limiters)->log(&cmxs_log_site, level, __VA_ARGS__); \
+    } while (0)
+
+#endif  // OBSCMXS_LOG_H
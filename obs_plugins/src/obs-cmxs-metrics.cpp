@@ -0,0 +1,224 @@
+/*
+Plugin Name obs-cmxs
+Copyright (C) <2024> <Caton> <c3@catontechnology.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+/*
+ * This is a simple example of showing how to use CMXSSDK on OBS.
+ * This file serves the metrics of the CMXS sources and output.
+ * You can use CMake to generate makefile and make it.
+ */
+#include "obs-cmxs-metrics.h"
+
+#include <obs-module.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET metrics_socket_t;
+#define METRICS_CLOSE closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int metrics_socket_t;
+#define INVALID_SOCKET (-1)
+#define METRICS_CLOSE close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// how long stopping the server can take
+static constexpr int METRICS_POLL_MS = 100;
+static constexpr int METRICS_REQUEST_TIMEOUT_MS = 1000;
+static constexpr size_t METRICS_MAX_REQUEST = 4096;
+
+void MetricsText::add(const char *name, const char *type, const char *help, const std::string &labels,
+                      double value) {
+    Family &family = mFamilies[name];
+    family.type = type;
+    family.help = help;
+    char number[32];
+    snprintf(number, sizeof(number), "%.17g", value);
+    family.samples += name;
+    if (!labels.empty()) {
+        family.samples += "{" + labels + "}";
+    }
+    family.samples += " ";
+    family.samples += number;
+    family.samples += "\n";
+}
+
+std::string MetricsText::str() const {
+    std::string text;
+    for (const auto &family : mFamilies) {
+        text += "# HELP " + family.first + " " + family.second.help + "\n";
+        text += "# TYPE " + family.first + " " + family.second.type + "\n";
+        text += family.second.samples;
+    }
+    return text;
+}
+
+std::string metricLabel(const char *name, const std::string &value) {
+    std::string label = name;
+    label += "=\"";
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            label += '\\';
+            label += c;
+        } else if (c == '\n') {
+            label += "\\n";
+        } else {
+            label += c;
+        }
+    }
+    label += "\"";
+    return label;
+}
+
+MetricsServer& MetricsServer::instance() {
+    static MetricsServer sServer;
+    return sServer;
+}
+
+MetricsServer::MetricsServer()
+    : mNextId(1),
+    mQuit(false),
+    mPort(0) {}
+
+MetricsServer::~MetricsServer() {
+    setPort(0);
+}
+
+int MetricsServer::subscribe(Collector cb) {
+    std::unique_lock<std::mutex> locker(mMtx);
+    int id = mNextId++;
+    mCollectors[id] = std::move(cb);
+    return id;
+}
+
+void MetricsServer::unsubscribe(int id) {
+    std::unique_lock<std::mutex> locker(mMtx);
+    mCollectors.erase(id);
+}
+
+void MetricsServer::setPort(int port) {
+    std::unique_lock<std::mutex> startLocker(mStartMtx);
+    if (port == mPort) {
+        return;
+    }
+    if (mThread.joinable()) {
+        mQuit = true;
+        mThread.join();
+    }
+    mPort = port;
+    if (port > 0 && port < 65536) {
+        mQuit = false;
+        mThread = std::thread(&MetricsServer::run, this, port);
+    }
+}
+
+std::string MetricsServer::scrape() {
+    MetricsText text;
+    std::unique_lock<std::mutex> locker(mMtx);
+    for (const auto &collector : mCollectors) {
+        collector.second(text);
+    }
+    locker.unlock();
+    return text.str();
+}
+
+static void sendAll(metrics_socket_t fd, const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        int n = send(fd, data.data() + sent, static_cast<int>(data.size() - sent), MSG_NOSIGNAL);
+        if (n <= 0) {
+            return;
+        }
+        sent += static_cast<size_t>(n);
+    }
+}
+
+void MetricsServer::run(int port) {
+    metrics_socket_t fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET) {
+        blog(LOG_WARNING, "metrics: socket failed");
+        return;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&reuse), sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+        blog(LOG_WARNING, "metrics: cannot listen on 127.0.0.1:%d", port);
+        METRICS_CLOSE(fd);
+        return;
+    }
+    blog(LOG_INFO, "metrics: serving http://127.0.0.1:%d/metrics", port);
+
+    while (!mQuit) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(fd, &readable);
+        struct timeval timeout = {0, METRICS_POLL_MS * 1000};
+        if (select(static_cast<int>(fd + 1), &readable, nullptr, nullptr, &timeout) <= 0) {
+            continue;
+        }
+        metrics_socket_t client = accept(fd, nullptr, nullptr);
+        if (client == INVALID_SOCKET) {
+            continue;
+        }
+#ifdef _WIN32
+        DWORD requestTimeout = METRICS_REQUEST_TIMEOUT_MS;
+#else
+        struct timeval requestTimeout = {METRICS_REQUEST_TIMEOUT_MS / 1000, 0};
+#endif
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char *>(&requestTimeout),
+                   sizeof(requestTimeout));
+#ifdef SO_NOSIGPIPE
+        int noSigPipe = 1;
+        setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+        // only the request line is used, read up to the end of the headers.
+        std::string request;
+        char buf[1024];
+        while (request.size() < METRICS_MAX_REQUEST && request.find("\r\n\r\n") == std::string::npos) {
+            int n = recv(client, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                break;
+            }
+            request.append(buf, static_cast<size_t>(n));
+        }
+        std::string response;
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+            std::string body = scrape();
+            response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        } else {
+            response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        }
+        sendAll(client, response);
+        METRICS_CLOSE(client);
+    }
+    METRICS_CLOSE(fd);
+    blog(LOG_INFO, "metrics: stopped serving on 127.0.0.1:%d", port);
+}
@@ -0,0 +1,87 @@
+/*
+Plugin Name obs-cmxs
+Copyright (C) <2024> <Caton> <c3@catontechnology.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+/*
+ * This is a simple example of showing how to use CMXSSDK on OBS.
+ * This file serves the counters of the CMXS sources and output on
+ * http://127.0.0.1:port/metrics, in the Prometheus text format.
+ * You can use CMake to generate makefile and make it.
+ */
+
+#ifndef OBSCMXS_METRICS_H
+#define OBSCMXS_METRICS_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// The samples of one scrape, grouped by metric as the format needs.
+class MetricsText {
+ public:
+    // type is "counter" or "gauge", labels is 'name="value",...' (see metricLabel()).
+    void add(const char *name, const char *type, const char *help, const std::string &labels, double value);
+    std::string str() const;
+
+ private:
+    struct Family {
+        const char *type;
+        const char *help;
+        std::string samples;
+    };
+    std::map<std::string, Family> mFamilies;
+};
+
+// name="value" with value escaped.
+std::string metricLabel(const char *name, const std::string &value);
+
+class MetricsServer {
+ public:
+    typedef std::function<void(MetricsText&)> Collector;
+
+    static MetricsServer& instance();
+
+    // cb adds the samples of a source or an output to every scrape, from the server thread.
+    // Returns the id for unsubscribe().
+    int subscribe(Collector cb);
+    // cb is not running anymore when it returns.
+    void unsubscribe(int id);
+
+    // Serve on 127.0.0.1:port, 0 stops serving.
+    void setPort(int port);
+
+ private:
+    MetricsServer();
+    ~MetricsServer();
+
+    void run(int port);
+    std::string scrape();
+
+    // held while the collectors run
+    std::mutex mMtx;
+    std::map<int, Collector> mCollectors;
+    int mNextId;
+    // serializes starting and stopping the thread
+    std::mutex mStartMtx;
+    std::thread mThread;
+    std::atomic<bool> mQuit;
+    int mPort;
+};
+
+#endif  // OBSCMXS_METRICS_H
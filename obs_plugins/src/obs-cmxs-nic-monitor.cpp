@@ -0,0 +1,251 @@
+/*
+Plugin Name obs-cmxs
+Copyright (C) <2024> <Caton> <c3@catontechnology.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+/*
+ * This is a simple example of showing how to use CMXSSDK on OBS.
+ * This file watches the network interfaces.
+ * You can use CMake to generate makefile and make it.
+ */
+#include "obs-cmxs-nic-monitor.h"
+#include "obs-cmxs-tool.h"
+
+#include <chrono>
+#include <vector>
+#include <obs-module.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+#endif
+
+// An interface coming up sends several events (link, then addresses), wait for the last one.
+static constexpr int64_t NIC_QUIET_PERIOD_MS = 500;
+static constexpr int NIC_POLL_MS = 100;
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+NicMonitor& NicMonitor::instance() {
+    static NicMonitor sMonitor;
+    return sMonitor;
+}
+
+NicMonitor::NicMonitor()
+    : mNextId(1),
+    mQuit(false),
+    mDeadline(0),
+    mGeneration(0) {}
+
+NicMonitor::~NicMonitor() {
+    stop();
+}
+
+int NicMonitor::subscribe(Callback cb) {
+    std::unique_lock<std::mutex> startLocker(mStartMtx);
+    std::unique_lock<std::mutex> locker(mMtx);
+    int id = mNextId++;
+    mCallbacks[id] = std::move(cb);
+    if (!mThread.joinable()) {
+        mQuit = false;
+        mDeadline = 0;
+        mThread = std::thread(&NicMonitor::run, this);
+    }
+    return id;
+}
+
+void NicMonitor::unsubscribe(int id) {
+    bool last = false;
+    {
+        std::unique_lock<std::mutex> notifyLocker(mNotifyMtx);
+        std::unique_lock<std::mutex> locker(mMtx);
+        mCallbacks.erase(id);
+        last = mCallbacks.empty();
+    }
+    if (last) {
+        stop();
+    }
+}
+
+void NicMonitor::stop() {
+    std::unique_lock<std::mutex> startLocker(mStartMtx);
+    {
+        std::unique_lock<std::mutex> locker(mMtx);
+        if (!mThread.joinable() || !mCallbacks.empty()) {
+            return;
+        }
+        mQuit = true;
+    }
+    mCond.notify_all();
+    mThread.join();
+}
+
+void NicMonitor::onChange() {
+    std::unique_lock<std::mutex> locker(mMtx);
+    mDeadline = nowMs() + NIC_QUIET_PERIOD_MS;
+    mCond.notify_all();
+}
+
+void NicMonitor::notify() {
+    std::unique_lock<std::mutex> notifyLocker(mNotifyMtx);
+    std::vector<Callback> callbacks;
+    {
+        std::unique_lock<std::mutex> locker(mMtx);
+        for (const auto& entry : mCallbacks) {
+            callbacks.push_back(entry.second);
+        }
+    }
+    ++mGeneration;
+    blog(LOG_INFO, "[obs-cmxs] network interfaces changed");
+    for (const auto& cb : callbacks) {
+        if (cb) {
+            cb();
+        }
+    }
+}
+
+void NicMonitor::run() {
+#ifdef __linux__
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd >= 0) {
+        struct sockaddr_nl addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+        if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+            blog(LOG_WARNING, "[obs-cmxs] netlink bind failed, network interfaces are not watched");
+            close(fd);
+            fd = -1;
+        }
+    }
+#endif
+#ifdef __APPLE__
+    // Reachability of any address changes with the interfaces and their routes.
+    struct sockaddr_in zeroAddr;
+    memset(&zeroAddr, 0, sizeof(zeroAddr));
+    zeroAddr.sin_len = sizeof(zeroAddr);
+    zeroAddr.sin_family = AF_INET;
+    SCNetworkReachabilityRef reachability = SCNetworkReachabilityCreateWithAddress(kCFAllocatorDefault,
+        reinterpret_cast<const struct sockaddr*>(&zeroAddr));
+    dispatch_queue_t queue = dispatch_queue_create("obs-cmxs.nic-monitor", DISPATCH_QUEUE_SERIAL);
+    if (reachability) {
+        SCNetworkReachabilityContext context = {0, this, nullptr, nullptr, nullptr};
+        SCNetworkReachabilitySetCallback(reachability,
+            [](SCNetworkReachabilityRef, SCNetworkReachabilityFlags, void* info) {
+                static_cast<NicMonitor*>(info)->onChange();
+            }, &context);
+        SCNetworkReachabilitySetDispatchQueue(reachability, queue);
+    }
+#endif
+
+    std::unique_lock<std::mutex> locker(mMtx);
+    while (!mQuit) {
+#ifdef __linux__
+        if (fd >= 0) {
+            locker.unlock();
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, NIC_POLL_MS) > 0 && (pfd.revents & POLLIN)) {
+                char buf[8192];
+                ssize_t len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+                bool changed = false;
+                for (struct nlmsghdr* nh = reinterpret_cast<struct nlmsghdr*>(buf);
+                     len > 0 && NLMSG_OK(nh, static_cast<size_t>(len)); nh = NLMSG_NEXT(nh, len)) {
+                    switch (nh->nlmsg_type) {
+                    case RTM_NEWLINK:
+                    case RTM_DELLINK:
+                    case RTM_NEWADDR:
+                    case RTM_DELADDR:
+                        changed = true;
+                        break;
+                    default:
+                        break;
+                    }
+                }
+                if (changed) {
+                    onChange();
+                }
+            }
+            locker.lock();
+        } else {
+            mCond.wait_for(locker, std::chrono::milliseconds(NIC_POLL_MS));
+        }
+#else
+        mCond.wait_for(locker, std::chrono::milliseconds(NIC_POLL_MS));
+#endif
+        if (mDeadline && nowMs() >= mDeadline) {
+            mDeadline = 0;
+            locker.unlock();
+            notify();
+            locker.lock();
+        }
+    }
+    locker.unlock();
+
+#ifdef __linux__
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+#ifdef __APPLE__
+    if (reachability) {
+        SCNetworkReachabilitySetDispatchQueue(reachability, nullptr);
+        SCNetworkReachabilitySetCallback(reachability, nullptr, nullptr);
+        CFRelease(reachability);
+    }
+    dispatch_release(queue);
+#endif
+}
+
+void getActiveLinks(const std::unordered_map<std::string, CMXSLinkDeviceType_t>& selected,
+                    std::unordered_map<std::string, CMXSLinkDeviceType_t>& active) {
+    active.clear();
+#ifdef CMXS_NIC_SELECTION
+    if (selected.empty()) {
+        return;
+    }
+    struct ifaddrs *ifap = nullptr;
+    if (getifaddrs(&ifap) == -1) {
+        active = selected;
+        return;
+    }
+    for (struct ifaddrs *interface = ifap; interface; interface = interface->ifa_next) {
+        const unsigned int upFlags = IFF_UP | IFF_RUNNING;
+        if ((interface->ifa_flags & upFlags) != upFlags || !interface->ifa_addr) {
+            continue;
+        }
+        if (interface->ifa_addr->sa_family != AF_INET && interface->ifa_addr->sa_family != AF_INET6) {
+            continue;
+        }
+        auto found = selected.find(interface->ifa_name);
+        if (found != selected.end()) {
+            active[found->first] = found->second;
+        }
+    }
+    freeifaddrs(ifap);
+    if (active.empty()) {
+        blog(LOG_INFO, "[obs-cmxs] none of the selected network interfaces is up");
+    }
+#else
+    active = selected;
+#endif
+}
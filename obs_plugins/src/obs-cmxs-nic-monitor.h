@@ -0,0 +1,85 @@
+/*
+Plugin Name obs-cmxs
+Copyright (C) <2024> <Caton> <c3@catontechnology.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+/*
+ * This is a simple example of showing how to use CMXSSDK on OBS.
+ * This file watches the network interfaces, so the sender and the receivers
+ * can follow the selected links going down and up (netlink on Linux,
+ * SCNetworkReachability on macOS).
+ * You can use CMake to generate makefile and make it.
+ */
+
+#ifndef OBSCMXS_NIC_MONITOR_H
+#define OBSCMXS_NIC_MONITOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <cmxssdk/cmxs_type.h>
+
+class NicMonitor {
+ public:
+    typedef std::function<void()> Callback;
+
+    static NicMonitor& instance();
+
+    // Call cb from the monitor thread when an interface goes up or down, or changes
+    // its address. Changes are coalesced, cb is called once per burst.
+    // The monitor runs while it has subscribers. Returns the id for unsubscribe().
+    int subscribe(Callback cb);
+    // cb is not running anymore when it returns, so it must not be called from cb.
+    void unsubscribe(int id);
+
+    // Incremented on each notified change, for the loops which poll.
+    uint64_t generation() const { return mGeneration; }
+
+ private:
+    NicMonitor();
+    ~NicMonitor();
+
+    void stop();
+    void run();
+    // A change is seen, notify after the quiet period.
+    void onChange();
+    void notify();
+
+    std::mutex mMtx;
+    std::condition_variable mCond;
+    std::map<int, Callback> mCallbacks;
+    int mNextId;
+    std::thread mThread;
+    bool mQuit;
+    // when to notify, 0 when nothing is pending (steady clock, ms)
+    int64_t mDeadline;
+    // held while the callbacks run
+    std::mutex mNotifyMtx;
+    std::atomic<uint64_t> mGeneration;
+    // serializes starting and stopping the thread
+    std::mutex mStartMtx;
+};
+
+// The selected links which are usable now: up, running and with an address.
+// When none of them is, the result is empty and the SDK uses the default route.
+void getActiveLinks(const std::unordered_map<std::string, CMXSLinkDeviceType_t>& selected,
+                    std::unordered_map<std::string, CMXSLinkDeviceType_t>& active);
+
+#endif
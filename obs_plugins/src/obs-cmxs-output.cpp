@@ -37,6 +37,12 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include "util/config-file.h"
 #include <obs-frontend-api.h>
 #include "obs-cmxs-tool.h"
+#include "obs-cmxs-nic-monitor.h"
+#include "obs-cmxs-log.h"
+#include "obs-cmxs-connect.h"
+#include "obs-cmxs-metrics.h"
+#include "cmxs_latency.h"
+#include "cmxs_trace.h"
 #include "Config.h"
 #include "main-output.h"
 #include <QDir>
@@ -50,42 +56,81 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include <QStringList>
 #include "obs-output.h"
 #include <util/dstr.h>
+#include <atomic>
 #include <chrono>
 #include <iomanip>
+#include <map>
+#include <mutex>
+#include <new>
 #ifdef _WIN32
 #include <windows.h>
 #else
 #include <unistd.h>
 #endif
 
-static int s_g_connecting_state = 0;
 extern int s_g_cmxs_init;
-#ifdef _WINDOWS
-#define MY_SLEEP(_t) Sleep((_t) * 1000)
-#else
-#define MY_SLEEP sleep
-#endif
+
+// Scopes of the OBS profiler, it keys them by the name pointer.
+static const char *cmxs_write_packet_name = "cmxs_write_packet";
+static const char *av_interleaved_write_frame_name = "av_interleaved_write_frame";
+static const char *write_buffer_name = "cmxs_write_buffer";
+static const char *sender_send_name = "Sender::send";
+
+static constexpr uint32_t CONNECT_TIMEOUT_MS = 3000;
+// a link change is given up between these, when the output stops.
+static constexpr uint32_t CONNECT_WAIT_SLICE_MS = 100;
+
+// Counters of the output for the metrics endpoint.
+struct cmxs_output_metrics {
+    std::atomic<uint64_t> sentBytes{0};
+    std::atomic<uint64_t> sends{0};
+    // time blocked in Sender::send
+    std::atomic<uint64_t> sendNs{0};
+    std::atomic<uint64_t> sendFailures{0};
+    // CMXSMSG_WARNING and CMXSMSG_ERROR of the senders, the congestion reports of the SDK.
+    std::atomic<uint64_t> warnings{0};
+    std::atomic<uint64_t> errors{0};
+    std::mutex linksMtx;
+    // last CMXSMSG_DataServerLinkState per device
+    std::map<std::string, uint32_t> linkStates;
+    int collectorId = 0;
+};
+
 class MySendListener : public CMXSListener {
  public:
+    explicit MySendListener(cmxs_output_metrics *metrics) : mMetrics(metrics) {}
     void onMessage(uint32_t message,
         uint32_t param1,
         const void * param2) noexcept override {
-        (void)param2;
         switch (message) {
         case CMXSMSG_ServerConnected:
             {
-                s_g_connecting_state = 0;
+                connect.set(ConnectWait::Connected);
             }
             break;
         case CMXSMSG_ServerConnectFailed:
             {
                 blog(LOG_INFO, "platform report output failed: %u(%s)\n", param1, cmxssdk_error_str(param1));
-                s_g_connecting_state = -1;
+                connect.set(ConnectWait::Failed);
+            }
+            break;
+        case CMXSMSG_DataServerLinkState:
+            {
+                const CMXSDataServerLinkStateMsgData_t *data =
+                    static_cast<const CMXSDataServerLinkStateMsgData_t *>(param2);
+                if (data && data->mNetDevice) {
+                    std::unique_lock<std::mutex> locker(mMetrics->linksMtx);
+                    mMetrics->linkStates[data->mNetDevice] = data->mDataServerConnectState;
+                }
             }
             break;
-        case CMXSMSG_Stat:
         case CMXSMSG_ERROR:
+            mMetrics->errors++;
+            break;
         case CMXSMSG_WARNING:
+            mMetrics->warnings++;
+            break;
+        case CMXSMSG_Stat:
             break;
         case CMXSMSG_StreamParamChanged:
             blog(LOG_INFO, "Received CMXSMSG_StreamParamChanged\n");
@@ -94,6 +139,11 @@ class MySendListener : public CMXSListener {
             break;
         }
     }
+    // Each sender has its own listener, the old and the new ones are alive while switching links.
+    ConnectWait connect;
+
+ private:
+    cmxs_output_metrics *mMetrics;
 };
 
 MySendListener * s_g_mySendListener;
@@ -106,6 +156,15 @@ void myLogCallback(int level, const char * format, ...) {
     va_end(args);
         blog(LOG_INFO, "%s", buffer);
 }
+// The links of the sender, it is re-created when they go up or down.
+struct cmxs_output_links {
+    // held while the sender is used or switched
+    std::mutex sender_mtx;
+    std::unordered_map<std::string, CMXSLinkDeviceType_t> selected;
+    std::unordered_map<std::string, CMXSLinkDeviceType_t> applied;
+    int monitorId = 0;
+};
+
 struct ffmpeg_audio_info {
     AVStream *stream;
     AVCodecContext *ctx;
@@ -122,6 +181,7 @@ struct cmxs_output {
     const char *deviceId;
 
     Sender *sender;
+    struct cmxs_output_links *links;
     AVStream *video;
     AVCodecContext *video_ctx;
     struct ffmpeg_audio_info *audio_infos;
@@ -139,6 +199,15 @@ struct cmxs_output {
     DARRAY(AVPacket *) packets;
     bool got_headers;
     bool adv_out;
+    // put the capture time into every video frame, for measuring the latency.
+    bool latency_stamp;
+    // the spans of the pipeline are traced into it when the trace path is set.
+    cmxs_common::TraceWriter *trace;
+    // pts of the packet being muxed, the send spans are tagged with it.
+    int64_t trace_pts;
+    cmxs_output_metrics *metrics;
+    // the limiters of blog_limited()
+    LogLimiters *logs;
 };
 
 const char *cmxs_output_getname(void *) {
@@ -151,12 +220,31 @@ int write_buffer(void *opaque, const uint8_t *buf, int buf_size) {
 #endif
     struct cmxs_output *stream = static_cast<struct cmxs_output *>(opaque);
 
+    // includes the wait for the sender switched by the NIC monitor.
+    profile_start(write_buffer_name);
+    std::unique_lock<std::mutex> locker(stream->links->sender_mtx);
+    if (!stream->sender) {
+        profile_end(write_buffer_name);
+        return 0;
+    }
+    profile_start(sender_send_name);
+    uint64_t sendStartUs = stream->trace->nowUs();
+    uint64_t sendStartNs = os_gettime_ns();
     CMXSErr err = stream->sender->send(buf, buf_size, -1);
+    stream->metrics->sendNs += os_gettime_ns() - sendStartNs;
+    stream->metrics->sends++;
+    // the muxer may send the data of earlier packets while writing this one.
+    stream->trace->span("send", sendStartUs, stream->trace->nowUs(), stream->trace_pts);
+    profile_end(sender_send_name);
     if (err != CMXSERR_OK) {
-        blog(LOG_INFO, "sent failed");
+        blog_limited(stream->logs, LOG_INFO, "sent failed: %u(%s)", err, cmxssdk_error_str(err));
+        stream->metrics->sendFailures++;
+        profile_end(write_buffer_name);
         return 0;
     }
+    stream->metrics->sentBytes += buf_size;
 
+    profile_end(write_buffer_name);
     return buf_size;
 }
 
@@ -369,6 +457,57 @@ void CreateAudioEncoder(void *data) {
 
 
 
+// Called by the NIC monitor: re-create the sender on the selected links which are up now.
+// The new sender is connected before the old one is destroyed, the output keeps running.
+static void cmxs_output_apply_links(struct cmxs_output *stream) {
+    std::unordered_map<std::string, CMXSLinkDeviceType_t> active;
+    getActiveLinks(stream->links->selected, active);
+    if (active == stream->links->applied || !stream->active) {
+        return;
+    }
+    blog(LOG_INFO, "links changed, %zu -> %zu, re-create the sender",
+        stream->links->applied.size(), active.size());
+
+    MySendListener* listener = new (std::nothrow) MySendListener(stream->metrics);
+    if (!listener) {
+        return;
+    }
+    CMXSStreamParam_t streamCfg;
+    memset(&streamCfg, 0, sizeof(CMXSStreamParam_t));
+    streamCfg.mStreamkey = stream->streamKey;
+    streamCfg.mConnectTimeOut = CONNECT_TIMEOUT_MS;
+    fillStreamParam(active, streamCfg);
+    Sender* sender = Sender::create(&streamCfg, listener);
+    ConnectWait::State state = ConnectWait::Connecting;
+    uint64_t deadlineNs = os_gettime_ns() + (CONNECT_TIMEOUT_MS + CONNECT_WAIT_MARGIN_MS) * 1000000ULL;
+    while (sender && stream->active && os_gettime_ns() < deadlineNs) {
+        state = listener->connect.wait(CONNECT_WAIT_SLICE_MS);
+        if (state != ConnectWait::Connecting) {
+            break;
+        }
+    }
+    releaseStreamParamMemory(streamCfg);
+    if (!sender || state != ConnectWait::Connected) {
+        blog(LOG_INFO, "re-create sender failed, keep the current links");
+        if (sender) {
+            Sender::destroy(sender);
+        }
+        delete listener;
+        return;
+    }
+
+    Sender* old = nullptr;
+    {
+        std::unique_lock<std::mutex> locker(stream->links->sender_mtx);
+        old = stream->sender;
+        stream->sender = sender;
+    }
+    Sender::destroy(old);
+    delete s_g_mySendListener;
+    s_g_mySendListener = listener;
+    stream->links->applied = active;
+}
+
 static bool cmxs_output_start(void *data) {
     // struct cmxs_output *stream = data;
     blog(LOG_INFO,
@@ -396,6 +535,19 @@ static bool cmxs_output_start(void *data) {
         return false;
     }
     stream->adv_out = astrcmpi(mode, "Advanced") == 0;
+    stream->latency_stamp = conf->latencyStamp;
+    if (stream->latency_stamp) {
+        blog(LOG_INFO, "cmxs_output_start: latency timestamps enabled");
+    }
+    stream->trace_pts = -1;
+    if (!conf->tracePath.isEmpty()) {
+        const std::string tracePath = conf->tracePath.toStdString();
+        if (stream->trace->open(tracePath, "cmxs output", conf->streamKey.toStdString())) {
+            blog(LOG_INFO, "cmxs_output_start: trace the pipeline to %s", tracePath.c_str());
+        } else {
+            blog(LOG_WARNING, "cmxs_output_start: cannot create the trace file %s", tracePath.c_str());
+        }
+    }
 
     obs_data_t *settings = obs_output_get_settings(stream->output);
 
@@ -456,18 +608,20 @@ static bool cmxs_output_start(void *data) {
          stream->streamKey);
 
     streamCfg.mStreamkey = stream->streamKey;
-    streamCfg.mConnectTimeOut = 3000;
+    streamCfg.mConnectTimeOut = CONNECT_TIMEOUT_MS;
 
     s_g_mySendListener = nullptr;
     try {
-        s_g_mySendListener = new MySendListener();
+        s_g_mySendListener = new MySendListener(stream->metrics);
     } catch (...) {
         blog(LOG_INFO, "No mem\n");
         return false;
     }
 
-    fillStreamParam(conf->mSelectedNic, streamCfg);
-    s_g_connecting_state = 1;
+    // only the selected links which are up, the others are added when they come up.
+    stream->links->selected = conf->mSelectedNic;
+    getActiveLinks(stream->links->selected, stream->links->applied);
+    fillStreamParam(stream->links->applied, streamCfg);
     blog(LOG_INFO, "cmxs_output_start: fillStreamParam done");
     stream->sender = Sender::create(&streamCfg, s_g_mySendListener);
     if (!stream->sender) {
@@ -477,11 +631,10 @@ static bool cmxs_output_start(void *data) {
     }
     blog(LOG_INFO, "cmxs_output_start: Sender::create done");
 
-    while (s_g_connecting_state == 1) {
-        MY_SLEEP(1);
-    }
-    if (s_g_connecting_state != 0) {
-        blog(LOG_INFO, "Connect failed\n");
+    uint64_t connectStartNs = os_gettime_ns();
+    ConnectWait::State state = s_g_mySendListener->connect.wait(CONNECT_TIMEOUT_MS + CONNECT_WAIT_MARGIN_MS);
+    if (state != ConnectWait::Connected) {
+        blog(LOG_INFO, "Connect failed%s\n", state == ConnectWait::Connecting ? ", no result in time" : "");
         Sender::destroy(stream->sender);
         releaseStreamParamMemory(streamCfg);
         stream->sender = nullptr;
@@ -490,6 +643,13 @@ static bool cmxs_output_start(void *data) {
         return false;
     }
     releaseStreamParamMemory(streamCfg);
+    blog(LOG_INFO, "cmxs_output_start: connected in %llu ms",
+        static_cast<unsigned long long>((os_gettime_ns() - connectStartNs) / 1000000));
+    if (!stream->links->selected.empty()) {
+        stream->links->monitorId = NicMonitor::instance().subscribe([stream]() {
+            cmxs_output_apply_links(stream);
+        });
+    }
     unsigned char* outbuffer = nullptr;
     outbuffer = (unsigned char*)av_malloc(1316);
     stream->cmxs_ffmpeg_output->pb = avio_alloc_context(outbuffer, 1316,
@@ -520,22 +680,36 @@ static void cmxs_output_stop(void *data, uint64_t ts) {
     stream->stop_ts = ts / 1000;
     os_atomic_set_bool(&stream->stopping, true);
 
+    if (stream->links->monitorId) {
+        NicMonitor::instance().unsubscribe(stream->links->monitorId);
+        stream->links->monitorId = 0;
+    }
+
     free(const_cast<char*>(stream->streamKey));
     stream->streamKey = nullptr;
 
-    Sender::destroy(stream->sender);
-    s_g_connecting_state = 1;
+    {
+        std::unique_lock<std::mutex> locker(stream->links->sender_mtx);
+        Sender::destroy(stream->sender);
+        stream->sender = nullptr;
+    }
     if (s_g_mySendListener) {
         delete s_g_mySendListener;
         s_g_mySendListener = nullptr;
     }
+    // the counts of the last faults are not lost.
+    stream->logs->flush();
+    if (stream->trace->isOpen()) {
+        blog(LOG_INFO, "cmxs_output_stop: %llu spans traced",
+            static_cast<unsigned long long>(stream->trace->events()));
+        stream->trace->close();
+    }
     Config *conf = Config::Current();
     if (!conf) {
         blog(LOG_INFO, "conf is null");
         return;
     }
     conf->isConnected = false;
-    stream->sender = nullptr;
 }
 static AVCodecContext *get_codec_context(cmxs_output *ffm,
                      struct encoder_packet *encpacket) {
@@ -590,7 +764,20 @@ void cmxs_write_packet(struct cmxs_output *stream,
     }
 
     uint8_t* pData;
-    if (is_video) {
+    if (is_video && stream->latency_stamp) {
+        // the wallclock time the frame was rendered: its system time is dts based, add the reordering delay.
+        int64_t ptsOffsetUs = (encpacket->pts - encpacket->dts) * 1000000 * encpacket->timebase_num /
+            encpacket->timebase_den;
+        int64_t ageUs = static_cast<int64_t>(os_gettime_ns() / 1000) - (encpacket->sys_dts_usec + ptsOffsetUs);
+        cmxs_common::VideoCodec codec = avstream->codecpar->codec_id == AV_CODEC_ID_HEVC ?
+            cmxs_common::VideoCodec::HEVC : cmxs_common::VideoCodec::H264;
+        std::vector<uint8_t> stamped;
+        cmxs_common::insertLatencySei(codec, cmxs_common::wallclockUs() - ageUs, encpacket->data, encpacket->size,
+            stamped);
+        packet->data = static_cast<uint8_t *>(av_memdup(stamped.data(), stamped.size()));
+        packet->size = static_cast<int>(stamped.size());
+        pData = packet->data;
+    } else if (is_video) {
         packet->data = static_cast<uint8_t *>(av_memdup(encpacket->data, static_cast<int>(encpacket->size)));
         packet->size = static_cast<int>(encpacket->size);
         pData = packet->data;
@@ -641,7 +828,20 @@ void cmxs_write_packet(struct cmxs_output *stream,
 
     if (encpacket->keyframe)
         packet->flags = AV_PKT_FLAG_KEY;
-    ret = av_interleaved_write_frame(stream->cmxs_ffmpeg_output, packet);
+    if (stream->trace->isOpen()) {
+        // from the time the frame or the samples were rendered to the encoded packet.
+        int64_t ageUs = static_cast<int64_t>(os_gettime_ns() / 1000) - encpacket->sys_dts_usec;
+        uint64_t nowUs = stream->trace->nowUs();
+        stream->trace->span(is_video ? "video encode" : "audio encode",
+            ageUs > 0 && static_cast<uint64_t>(ageUs) < nowUs ? nowUs - ageUs : nowUs, nowUs, packet->pts);
+    }
+    stream->trace_pts = packet->pts;
+    profile_start(av_interleaved_write_frame_name);
+    {
+        cmxs_common::TraceSpan span(stream->trace, "mux", packet->pts);
+        ret = av_interleaved_write_frame(stream->cmxs_ffmpeg_output, packet);
+    }
+    profile_end(av_interleaved_write_frame_name);
     if (0 != ret) {
         blog(LOG_INFO, "av_interleaved_write_frame failed");
     }
@@ -652,12 +852,41 @@ void cmxs_write_packet(struct cmxs_output *stream,
     return;
 }
 
+static void cmxs_output_collect_metrics(struct cmxs_output *stream, MetricsText &text) {
+    const std::string labels = metricLabel("output", obs_output_get_name(stream->output));
+    cmxs_output_metrics &m = *stream->metrics;
+    text.add("cmxs_output_active", "gauge", "1 while the output is streaming.", labels, stream->active ? 1 : 0);
+    text.add("cmxs_output_sent_bytes_total", "counter", "Bytes sent to CMXS.", labels,
+        static_cast<double>(m.sentBytes));
+    text.add("cmxs_output_sends_total", "counter", "Sender::send calls.", labels, static_cast<double>(m.sends));
+    text.add("cmxs_output_send_blocked_seconds_total", "counter", "Time blocked in Sender::send.", labels,
+        m.sendNs / 1e9);
+    text.add("cmxs_output_send_failures_total", "counter", "Sender::send calls which failed, the data is lost.",
+        labels, static_cast<double>(m.sendFailures));
+    text.add("cmxs_output_warnings_total", "counter", "Warnings of the sender, e.g. congestion.", labels,
+        static_cast<double>(m.warnings));
+    text.add("cmxs_output_errors_total", "counter", "Errors of the sender.", labels,
+        static_cast<double>(m.errors));
+    std::unique_lock<std::mutex> locker(m.linksMtx);
+    for (const auto &link : m.linkStates) {
+        text.add("cmxs_output_link_state", "gauge", "Last data server state of each link.",
+            labels + "," + metricLabel("device", link.first), link.second);
+    }
+}
+
 static void *cmxs_output_create(obs_data_t *settings, obs_output_t *output) {
     blog(LOG_INFO,
          "cmxs_output_create: starting CMXS main output");
     (void)settings;
     struct cmxs_output *stream = static_cast<struct cmxs_output *>(bzalloc(sizeof(struct cmxs_output)));
     stream->output = output;
+    stream->links = new cmxs_output_links();
+    stream->trace = new cmxs_common::TraceWriter();
+    stream->metrics = new cmxs_output_metrics();
+    stream->logs = new LogLimiters();
+    stream->metrics->collectorId = MetricsServer::instance().subscribe([stream](MetricsText &text) {
+        cmxs_output_collect_metrics(stream, text);
+    });
     #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 9, 100)
         av_register_all();
     #endif
@@ -678,12 +907,16 @@ static void cmxs_output_data(void *data, struct encoder_packet *packet) {
         goto fail;
     }
     if (stream->stopping) {
-        blog(LOG_INFO, "cmxs_output_data, stream->stopping");
+        blog_limited(stream->logs, LOG_INFO, "cmxs_output_data, stream->stopping");
         if (packet->sys_dts_usec >= (int64_t)stream->stop_ts) {
             return;
         }
     }
+    // a fault which stopped still has its count logged.
+    stream->logs->flushExpired();
+    profile_start(cmxs_write_packet_name);
     cmxs_write_packet(stream, packet);
+    profile_end(cmxs_write_packet_name);
     return;
 fail:
     obs_output_signal_stop(stream->output, code);
@@ -699,6 +932,16 @@ obs_properties_t *cmxs_properties_callback(void *data) {
     return props;
 }
 static void cmxs_output_destroy(void *data) {
+    struct cmxs_output *stream = static_cast<struct cmxs_output *>(data);
+    MetricsServer::instance().unsubscribe(stream->metrics->collectorId);
+    delete stream->metrics;
+    stream->metrics = nullptr;
+    delete stream->links;
+    stream->links = nullptr;
+    delete stream->trace;
+    stream->trace = nullptr;
+    delete stream->logs;
+    stream->logs = nullptr;
     bfree(data);
 }
 obs_output_info create_cmxs_output_info() {
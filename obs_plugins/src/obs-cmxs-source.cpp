@@ -31,6 +31,15 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include "plugin-main.h"
 #include "main-output.h"
 #include "obs-cmxs-tool.h"
+#include "obs-cmxs-nic-monitor.h"
+#include "obs-cmxs-log.h"
+#include "obs-cmxs-connect.h"
+#include "obs-cmxs-executor.h"
+#include "obs-cmxs-metrics.h"
+#include "cmxs_capture.h"
+#include "cmxs_latency.h"
+#include "cmxs_trace.h"
+#include "cmxs_ts_demux.h"
 #include "Config.h"
 #include "plugin-support.h"
 #include "obs.h"
@@ -50,8 +59,12 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include <QStringList>
 #include "obs-output.h"
 #include <util/dstr.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iomanip>
+#include <map>
+#include <new>
 #ifdef _WIN32
 #include <ws2tcpip.h>
 #include <winsock2.h>
@@ -63,7 +76,6 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include <arpa/inet.h>
 #include <sys/time.h>
 #endif
-#include <pthread.h>
 #include <cstring>
 
 
@@ -72,29 +84,67 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #define PROP_KEY "cmxs_streamKey_pull"
 #define PROP_NETINTERFACES "net_interfaces"
 #define PROP_START_PULL "cmxs_startpulling"
-#define PROP_START_INTPORT "cmxs_intport"
 #define PROP_HOST "host"
 #define PROP_DEVICEID "device"
+#define PROP_CAPTURE "cmxs_capture_path"
+#define PROP_TRACE "cmxs_trace_path"
+#define PROP_DROP_CORRUPT "cmxs_drop_corrupt"
+#define PROP_KEYFRAME_AFTER_LOSS "cmxs_keyframe_after_loss"
+#define PROP_PREVIEW "cmxs_preview_mode"
+#define PROP_PREVIEW_FPS "cmxs_preview_max_fps"
+#define PROP_MATCH_CANVAS "cmxs_match_canvas_fps"
 
 
 // static int s_g_connecting_state = 0;
 static constexpr uint32_t MAX_PACKET_SIZE = 1316;
+// Scopes of the OBS profiler, it keys them by the name pointer.
+// One video_decode root per packet on the decoding thread.
+static const char *video_decode_name = "cmxs_video_decode";
+static const char *send_packet_name = "avcodec_send_packet";
+static const char *receive_frame_name = "avcodec_receive_frame";
+static const char *output_video_name = "obs_source_output_video";
+static constexpr uint64_t LATENCY_LOG_INTERVAL_NS = 10000000000ULL;
+// frames waiting for their output with a latency timestamp, the older ones are forgotten.
+static constexpr size_t MAX_LATENCY_STAMPS = 300;
+// The receive stage takes the datagrams which are there, and polls again in RECEIVE_POLL_MS
+// when there are none, so it does not hold a worker of the executor. Without data for
+// RECEIVE_BACKOFF_NS, e.g. connecting or disconnected, the poll backs off to RECEIVE_POLL_MAX_MS:
+// the idle sources do not cost CPU by their count.
+static constexpr uint32_t RECEIVE_POLL_MS = 2;
+static constexpr uint32_t RECEIVE_POLL_MAX_MS = 50;
+static constexpr uint64_t RECEIVE_BACKOFF_NS = 100000000ULL;
+static constexpr uint32_t CONNECT_TIMEOUT_MS = 3000;
+// A stop holding the UI longer than this is logged: it waits for a run of each stage at most.
+static constexpr uint64_t STOP_SLOW_MS = 100;
+// No datagram for this long after the data arrived: the link is taken for down, and the receiver
+// is re-created while the demux and the decoders keep their state.
+static constexpr uint64_t RECOVER_IDLE_NS = 2000000000ULL;
+// datagrams per run of the receive stage, then the other tasks get their turn.
+static constexpr int RECEIVE_BUDGET = 64;
+// The preview mode of a source, e.g. for the tiles of a multiview: less of the video is decoded.
+enum cmxs_preview_mode {
+    CMXS_PREVIEW_OFF = 0,
+    // the non-reference frames are skipped above the max fps
+    CMXS_PREVIEW_REFERENCE = 1,
+    // only the keyframes are decoded, up to the max fps
+    CMXS_PREVIEW_KEYFRAMES = 2,
+};
+static constexpr int PREVIEW_DEFAULT_FPS = 5;
+// 1/4 of the size in preview, for the decoders which can (not the H.264 and HEVC ones of FFmpeg).
+static constexpr int PREVIEW_LOWRES = 2;
+// The frame rate of the OBS canvas is read again every second, it changes with a video reset.
+static constexpr uint64_t CANVAS_CHECK_INTERVAL_NS = 1000000000ULL;
+// The TS quality is copied for the metrics every second, and logged when a window had errors.
+static constexpr uint64_t QUALITY_SNAPSHOT_INTERVAL_NS = 1000000000ULL;
+static constexpr uint64_t QUALITY_WINDOW_NS = 10000000000ULL;
 extern int s_g_cmxs_init;
 
 const char* s_g_host = nullptr;
 const char* s_g_deviceId = nullptr;
 
-#define OBS_FFMPEG_INTERNAL_PORT 11001
-#ifdef _WINDOWS
-#define MY_SLEEP(_t) Sleep((_t) * 1000)
-#define usleep(_t) Sleep((_t)/1000)
-#else
-#define MY_SLEEP sleep
-#endif
-
 class MyRecvListener : public CMXSListener {
  public:
-    MyRecvListener() : connecting_state(0) {}
+    MyRecvListener() {}
     void onMessage(uint32_t message,
         uint32_t param1,
         const void * param2) noexcept override {
@@ -102,13 +152,13 @@ class MyRecvListener : public CMXSListener {
         switch (message) {
         case CMXSMSG_ServerConnected:
             {
-                connecting_state = 0;
+                connect.set(ConnectWait::Connected);
             }
             break;
         case CMXSMSG_ServerConnectFailed:
             {
                 blog(LOG_INFO, "platform report connect failed%u(%s)", param1, cmxssdk_error_str(param1));
-                connecting_state = -1;
+                connect.set(ConnectWait::Failed);
             }
             break;
         case CMXSMSG_Stat:
@@ -117,24 +167,116 @@ class MyRecvListener : public CMXSListener {
             break;
         case CMXSMSG_StreamParamChanged:
             blog(LOG_INFO, "Received CMXSMSG_StreamParamChanged\n");
+            paramChanged = true;
             break;
         default:
             break;
         }
     }
-    int connecting_state;
+    ConnectWait connect;
+    // the receive stage re-creates the receiver.
+    std::atomic<bool> paramChanged{false};
+};
+
+// A demuxed packet, and when it was queued (os_gettime_ns) for the metrics and the trace of its wait.
+// params is set on the first packet of a stream after its codec parameters changed, the decoding
+// stage then reopens its decoder if they differ from what it is opened with.
+// gateStartNs is set on the keyframe which ends a wait for one (see cmxs_source_gate_video()):
+// when the wait started, for the time to the first clean frame.
+struct queued_packet {
+    AVPacket *packet;
+    uint64_t queuedNs;
+    AVCodecParameters *params;
+    uint64_t gateStartNs;
+};
+
+// What a decoder depends on. The other changes, e.g. of the SPS, are followed by the decoder itself.
+struct cmxs_codec_key {
+    AVCodecID codecId;
+    int sampleRate;
+    int channels;
+
+    bool operator==(const cmxs_codec_key& other) const {
+        return codecId == other.codecId && sampleRate == other.sampleRate && channels == other.channels;
+    }
+    bool operator!=(const cmxs_codec_key& other) const { return !(*this == other); }
 };
 
-typedef std::list<AVPacket *> packet_queue_t;
+static cmxs_codec_key codecKey(const AVCodecParameters *par) {
+    return cmxs_codec_key{par->codec_id, par->sample_rate, par->ch_layout.nb_channels};
+}
+
+static cmxs_codec_key codecKey(const AVCodecContext *ctx) {
+    return cmxs_codec_key{ctx->codec_id, ctx->sample_rate, ctx->ch_layout.nb_channels};
+}
+
+static void freeQueuedPacket(queued_packet &queued) {
+    av_packet_free(&queued.packet);
+    avcodec_parameters_free(&queued.params);
+}
+typedef std::list<queued_packet> packet_queue_t;
+
+// Limits the video frames decoded per second of stream time, by skipping the ones which can be.
+// A token bucket of one frame: the frames which cannot be skipped go on and take their credit,
+// the skippable ones get what is left of the rate.
+struct cmxs_decode_rate {
+    int64_t lastDts = cmxs_common::kTsNoTimestamp;
+    int64_t credit = 0;
+
+    // dts and interval, the min time between the frames, in 90 kHz. interval 0 for no limit.
+    bool pass(int64_t dts, int64_t interval, bool skippable) {
+        if (interval <= 0 || dts == cmxs_common::kTsNoTimestamp) {
+            return true;
+        }
+        if (lastDts == cmxs_common::kTsNoTimestamp || dts < lastDts || dts - lastDts > 90000) {
+            // the start, or another timeline.
+            credit = interval;
+        } else {
+            credit = std::min(interval, credit + dts - lastDts);
+        }
+        lastDts = dts;
+        if (skippable && credit <= 0) {
+            return false;
+        }
+        credit = std::max(credit - interval, -interval);
+        return true;
+    }
+};
+typedef std::unordered_map<std::string, CMXSLinkDeviceType_t> link_list_t;
+struct cmxs_pipeline;
+
+// Counters of a source for the metrics endpoint, updated by the pipeline threads.
+struct cmxs_source_metrics {
+    std::atomic<uint64_t> receivedBytes{0};
+    std::atomic<uint64_t> receivedDatagrams{0};
+    std::atomic<uint64_t> dequeuedPackets{0};
+    std::atomic<uint64_t> queueDelayNs{0};
+    std::atomic<uint64_t> decodedPackets{0};
+    std::atomic<uint64_t> decodeNs{0};
+    std::atomic<uint64_t> outputFrames{0};
+    // packets the decoder rejected, or failed to decode
+    std::atomic<uint64_t> droppedFrames{0};
+    // demuxed frames with lost TS packets, dropped before their decoder (see dropCorrupt)
+    std::atomic<uint64_t> corruptFramesDropped{0};
+    // waits for a keyframe, the video frames they discarded, and the time to the first
+    // frame output after the last one
+    std::atomic<uint64_t> keyframeWaits{0};
+    std::atomic<uint64_t> keyframeWaitFrames{0};
+    std::atomic<uint64_t> firstCleanFrameNs{0};
+    // video frames not decoded for the preview mode or the canvas frame rate
+    std::atomic<uint64_t> skippedFrames{0};
+    // the TS quality per PID, a copy of the one of the demux
+    std::mutex qualityMtx;
+    std::vector<cmxs_common::TsPidQuality> quality;
+    int collectorId = 0;
+};
 typedef struct cmxs_source {
     obs_source_t *obs_source;
     volatile bool active;
-    AVFormatContext *cmxs_ffmpeg_source;
     // const char *host;
     const char *streamKey;
 
     Receiver *receiver;
-    uint32_t internalPort;
     bool running;
     bool dataArrived;
     packet_queue_t* audioQ;
@@ -144,17 +286,130 @@ typedef struct cmxs_source {
     // bool connecting;
 
     void* listener;
-    pthread_t av_thread;
-    pthread_t cmxs_thread;
-    pthread_t video_thread;
-    pthread_t audio_thread;
+    // the stages, from the start to the stop of the pulling.
+    cmxs_pipeline* pipeline;
     std::unordered_map<std::string, CMXSLinkDeviceType_t>* netDeviceList;
+    // the received datagrams are recorded into it when not empty.
+    std::string* capturePath;
+    // the spans of the pipeline are traced into it when not empty.
+    std::string* tracePath;
+    cmxs_common::TraceWriter* trace;
+    cmxs_source_metrics* metrics;
+    // the limiters of blog_limited()
+    LogLimiters* logs;
+    // the frames with lost TS packets are dropped instead of decoded.
+    volatile bool dropCorrupt;
+    // the video waits for the next keyframe after a frame with lost TS packets.
+    volatile bool keyframeAfterLoss;
+    // shown in a scene of the program, the preview or a projector. Hidden, only the keyframes are decoded.
+    volatile bool showing;
+    // cmxs_preview_mode, and the max video frames decoded per second in preview
+    volatile int previewMode;
+    volatile int previewMaxFps;
+    // the non-reference frames over the frame rate of the canvas are skipped, OBS would drop them.
+    volatile bool matchCanvas;
+    // The decoders are opened by their stage on the first packet of their stream, and live until
+    // the pulling stops: a new receiver, e.g. after a link loss, does not reopen them.
     AVCodecContext *videoCodecContext;
+    // the PID of the decoded video, used by the receive stage only
     int videoStreamIndex;
     std::unordered_map<int, AVCodecContext*>* audioCodecContextMap;
     std::list<int>* audioStreamIndices;
 } cmxs_source_t;
 
+static void cmxs_source_receive(cmxs_source_t *s);
+static void cmxs_source_decode_video(cmxs_source_t *s);
+static void cmxs_source_decode_audio(cmxs_source_t *s);
+
+// The stages of a source run as tasks on the shared executor: the receive stage polls the receiver
+// and demuxes the datagrams, the decoding stages run when it queues packets for them.
+struct cmxs_pipeline {
+    explicit cmxs_pipeline(cmxs_source_t *s)
+        : receiveTask([s]() { cmxs_source_receive(s); }),
+        videoTask([s]() { cmxs_source_decode_video(s); }),
+        audioTask([s]() { cmxs_source_decode_audio(s); }),
+        buf(MAX_PACKET_SIZE),
+        demux(AV_INPUT_BUFFER_PADDING_SIZE),
+        nicMonitorId(0),
+        nicGeneration(0),
+        lastDataNs(0),
+        pollMs(RECEIVE_POLL_MS),
+        qualitySnapshotNs(0),
+        qualityWindowNs(os_gettime_ns() + QUALITY_WINDOW_NS),
+        connectingReceiver(nullptr),
+        connectingListener(nullptr),
+        connectStartNs(0),
+        waitKeyframe(true),
+        videoShown(true),
+        previewMode(CMXS_PREVIEW_OFF),
+        lastVideoDts(cmxs_common::kTsNoTimestamp),
+        frameTicks(0),
+        canvasTicks(0),
+        canvasCheckNs(0),
+        overCanvas(false),
+        gateStartNs(os_gettime_ns()),
+        gatedFrames(0),
+        cleanFrameFromNs(0),
+        latencyLogNs(os_gettime_ns() + LATENCY_LOG_INTERVAL_NS) {
+    }
+
+    SerialTask receiveTask;
+    SerialTask videoTask;
+    SerialTask audioTask;
+
+    // receive
+    std::vector<uint8_t> buf;
+    // The demux keeps its program and its frames in progress when the receiver is re-created.
+    cmxs_common::TsDemuxer demux;
+    // the codec parameters of every stream (by PID), as the decoders are opened with.
+    std::map<int, cmxs_codec_key> streamKeys;
+    // The links selected when the pulling started, only the ones which are up are used.
+    link_list_t selectedLinks;
+    link_list_t appliedLinks;
+    int nicMonitorId;
+    uint64_t nicGeneration;
+    cmxs_common::CaptureWriter capture;
+    // last datagram, or last attempt to recover
+    uint64_t lastDataNs;
+    // the next poll when nothing is received, see RECEIVE_POLL_MS
+    uint32_t pollMs;
+    uint64_t qualitySnapshotNs;
+    uint64_t qualityWindowNs;
+    // the TS quality when the window started, the log tells what changed since.
+    std::vector<cmxs_common::TsPidQuality> qualityLogged;
+    // A receiver waiting for its connection, it replaces s->receiver when connected.
+    // Its listener schedules the receive stage when the result comes.
+    Receiver *connectingReceiver;
+    MyRecvListener *connectingListener;
+    link_list_t connectingLinks;
+    uint64_t connectStartNs;
+    // The video is discarded until a keyframe, from the start and after a loss (see cmxs_source_gate_video()):
+    // the decoder would only output gray or smeared pictures from it.
+    bool waitKeyframe;
+    // s->showing and s->previewMode as last seen by the gate
+    bool videoShown;
+    int previewMode;
+    cmxs_decode_rate decodeRate;
+    // the frame interval of the video (mean of the dts steps) and of the OBS canvas, in 90 kHz
+    int64_t lastVideoDts;
+    int64_t frameTicks;
+    int64_t canvasTicks;
+    uint64_t canvasCheckNs;
+    // the video is faster than the canvas, as last logged
+    bool overCanvas;
+    uint64_t gateStartNs;
+    uint64_t gatedFrames;
+
+    // video decode: when the wait for the keyframe being decoded started, until its frame is output.
+    uint64_t cleanFrameFromNs;
+
+    // video decode: capture times of the latency SEI of the output (see cmxs_latency.h) by packet pts,
+    // until the frame is given to OBS.
+    std::map<int64_t, uint64_t> latencyStamps;
+    cmxs_common::LatencyStats latency;
+    uint64_t latencyLogNs;
+};
+
 static inline enum video_format convert_pixel_format(int f) {
     switch (f) {
     case AV_PIX_FMT_NONE:
@@ -281,14 +536,77 @@ const char *cmxs_source_getname(void *) {
     return obs_module_text("CMXSPlugin.CMXSSourceName");
 }
 
+static void clearPktQ(packet_queue_t *q, std::mutex *mtx) {
+    std::unique_lock<std::mutex> locker(*mtx);
+    for (queued_packet &queued : *q) {
+        freeQueuedPacket(queued);
+    }
+    q->clear();
+}
+
+// The receive stage is done, release what it used.
+static void cmxs_source_receive_done(cmxs_source_t *s) {
+    cmxs_pipeline *p = s->pipeline;
+    if (p->capture.isOpen()) {
+        blog(p->capture.failed() ? LOG_WARNING : LOG_INFO, "%llu datagrams captured%s",
+            static_cast<unsigned long long>(p->capture.records()),
+            p->capture.failed() ? ", the capture failed to write" : "");
+        p->capture.close();
+    }
+    if (p->nicMonitorId) {
+        NicMonitor::instance().unsubscribe(p->nicMonitorId);
+        p->nicMonitorId = 0;
+    }
+    if (p->connectingReceiver) {
+        Receiver::destroy(p->connectingReceiver);
+        p->connectingReceiver = nullptr;
+    }
+    delete p->connectingListener;
+    p->connectingListener = nullptr;
+    if (s->receiver) {
+        Receiver::destroy(s->receiver);
+        s->receiver = nullptr;
+    }
+    if (s->listener) {
+        delete static_cast<MyRecvListener*>(s->listener);
+        s->listener = nullptr;
+        blog(LOG_INFO, "free listener");
+    }
+    s->dataArrived = false;
+}
+
+// Stop the pulling: the stages see it at their next run.
+static void cmxs_source_cancel(cmxs_source_t *s) {
+    s->running = false;
+}
+
+// Also cleans up after a pulling which stopped itself, e.g. when the connection failed.
+// It waits for the runs in progress only, the pending timers of the stages (the connect
+// fallback is 5 s) are cancelled: a stop right after the start does not hold the UI.
 void cmxs_source_thread_stop(cmxs_source_t *s) {
-    if (s->running) {
-        s->running = false;
-        pthread_join(s->cmxs_thread, nullptr);
-        pthread_join(s->av_thread, nullptr);
-        pthread_join(s->video_thread, nullptr);
-        pthread_join(s->audio_thread, nullptr);
-        blog(LOG_INFO, "stop pulling done");
+    if (s->pipeline) {
+        uint64_t stopStartNs = os_gettime_ns();
+        cmxs_source_cancel(s);
+        // the stages see running is false and do not schedule themselves again.
+        s->pipeline->receiveTask.wait();
+        s->pipeline->videoTask.wait();
+        s->pipeline->audioTask.wait();
+        cmxs_source_receive_done(s);
+        // a listener may have scheduled the receive stage until its receiver was destroyed.
+        s->pipeline->receiveTask.wait();
+        delete s->pipeline;
+        s->pipeline = nullptr;
+        clearPktQ(s->videoQ, s->video_mtx);
+        clearPktQ(s->audioQ, s->audio_mtx);
+        uint64_t stopMs = (os_gettime_ns() - stopStartNs) / 1000000;
+        blog(stopMs > STOP_SLOW_MS ? LOG_WARNING : LOG_INFO, "stop pulling done in %llu ms",
+            static_cast<unsigned long long>(stopMs));
+        // the counts of the last faults are not lost.
+        s->logs->flush();
+        if (s->trace->isOpen()) {
+            blog(LOG_INFO, "%llu spans traced", static_cast<unsigned long long>(s->trace->events()));
+            s->trace->close();
+        }
         if (s->videoCodecContext) {
             // avcodec_close(s->videoCodecContext);
             avcodec_free_context(&s->videoCodecContext);
@@ -299,12 +617,9 @@ void cmxs_source_thread_stop(cmxs_source_t *s) {
                 // avcodec_close(audioContextPair.second);
                 avcodec_free_context(&audioContextPair.second);
             }
+            s->audioCodecContextMap->clear();
         }
-        if (s->cmxs_ffmpeg_source) {
-            avformat_close_input(&s->cmxs_ffmpeg_source);
-            avformat_free_context(s->cmxs_ffmpeg_source);
-            s->cmxs_ffmpeg_source = nullptr;
-        }
+        s->audioStreamIndices->clear();
     }
 }
 
@@ -322,6 +637,11 @@ void initObsData(void *data) {
     s->audioStreamIndices = new std::list<int>();
     s->audioCodecContextMap = new std::unordered_map<int, AVCodecContext*>;
     s->netDeviceList = new std::unordered_map<std::string, CMXSLinkDeviceType_t>();
+    s->capturePath = new std::string();
+    s->tracePath = new std::string();
+    s->trace = new cmxs_common::TraceWriter();
+    s->metrics = new cmxs_source_metrics();
+    s->logs = new LogLimiters();
 }
 
 void destroyObsData(void *data) {
@@ -361,6 +681,107 @@ void destroyObsData(void *data) {
         delete s->netDeviceList;
         s->netDeviceList = nullptr;
     }
+
+    if (s->capturePath) {
+        delete s->capturePath;
+        s->capturePath = nullptr;
+    }
+
+    if (s->tracePath) {
+        delete s->tracePath;
+        s->tracePath = nullptr;
+    }
+
+    if (s->trace) {
+        delete s->trace;
+        s->trace = nullptr;
+    }
+
+    if (s->metrics) {
+        delete s->metrics;
+        s->metrics = nullptr;
+    }
+
+    if (s->logs) {
+        delete s->logs;
+        s->logs = nullptr;
+    }
+}
+
+static void cmxs_source_collect_metrics(cmxs_source_t *s, MetricsText &text) {
+    std::string labels = metricLabel("source", obs_source_get_name(s->obs_source)) + "," +
+        metricLabel("key", s->streamKey ? s->streamKey : "");
+    const cmxs_source_metrics &m = *s->metrics;
+    text.add("cmxs_source_running", "gauge", "1 while the source is pulling.", labels, s->running ? 1 : 0);
+    text.add("cmxs_source_received_bytes_total", "counter", "Bytes received from CMXS.", labels,
+        static_cast<double>(m.receivedBytes));
+    text.add("cmxs_source_received_datagrams_total", "counter", "Datagrams received from CMXS.", labels,
+        static_cast<double>(m.receivedDatagrams));
+    size_t videoQueue = 0;
+    size_t audioQueue = 0;
+    {
+        std::unique_lock<std::mutex> locker(*s->video_mtx);
+        videoQueue = s->videoQ->size();
+    }
+    {
+        std::unique_lock<std::mutex> locker(*s->audio_mtx);
+        audioQueue = s->audioQ->size();
+    }
+    text.add("cmxs_source_queue_packets", "gauge", "Demuxed packets waiting for their decoder.",
+        labels + ",queue=\"video\"", static_cast<double>(videoQueue));
+    text.add("cmxs_source_queue_packets", "gauge", "Demuxed packets waiting for their decoder.",
+        labels + ",queue=\"audio\"", static_cast<double>(audioQueue));
+    text.add("cmxs_source_queue_delay_seconds_total", "counter",
+        "Time the video packets waited for the decoder, the jitter buffer of the source.", labels,
+        m.queueDelayNs / 1e9);
+    text.add("cmxs_source_dequeued_packets_total", "counter", "Video packets taken by the decoder.", labels,
+        static_cast<double>(m.dequeuedPackets));
+    text.add("cmxs_source_decode_seconds_total", "counter", "Time spent decoding video packets.", labels,
+        m.decodeNs / 1e9);
+    text.add("cmxs_source_decoded_packets_total", "counter", "Video packets decoded.", labels,
+        static_cast<double>(m.decodedPackets));
+    text.add("cmxs_source_output_frames_total", "counter", "Video frames given to OBS.", labels,
+        static_cast<double>(m.outputFrames));
+    text.add("cmxs_source_dropped_frames_total", "counter", "Video packets the decoder rejected or failed on.",
+        labels, static_cast<double>(m.droppedFrames));
+    text.add("cmxs_source_corrupt_frames_dropped_total", "counter",
+        "Demuxed frames with lost TS packets, dropped before their decoder.", labels,
+        static_cast<double>(m.corruptFramesDropped));
+    text.add("cmxs_source_keyframe_waits_total", "counter",
+        "Waits for a keyframe, at the start, after a loss and while hidden.", labels, static_cast<double>(m.keyframeWaits));
+    text.add("cmxs_source_keyframe_wait_frames_total", "counter",
+        "Video frames discarded while waiting for a keyframe.", labels, static_cast<double>(m.keyframeWaitFrames));
+    text.add("cmxs_source_skipped_frames_total", "counter",
+        "Video frames not decoded for the preview mode or the canvas frame rate.", labels,
+        static_cast<double>(m.skippedFrames));
+    text.add("cmxs_source_first_clean_frame_seconds", "gauge",
+        "From the start of the last wait for a keyframe to its frame given to OBS.", labels,
+        m.firstCleanFrameNs / 1e9);
+    std::unique_lock<std::mutex> locker(s->metrics->qualityMtx);
+    for (const cmxs_common::TsPidQuality &q : m.quality) {
+        std::string pidLabels = labels + "," + metricLabel("pid", std::to_string(q.pid));
+        text.add("cmxs_source_ts_packets_total", "counter", "TS packets received.", pidLabels,
+            static_cast<double>(q.packets));
+        text.add("cmxs_source_ts_cc_errors_total", "counter", "TS continuity counter errors.", pidLabels,
+            static_cast<double>(q.ccErrors));
+        text.add("cmxs_source_ts_lost_packets_total", "counter",
+            "TS packets lost, from the continuity counters (modulo 16).", pidLabels,
+            static_cast<double>(q.lostPackets));
+        text.add("cmxs_source_ts_duplicate_packets_total", "counter", "Duplicated TS packets, skipped.", pidLabels,
+            static_cast<double>(q.duplicates));
+        text.add("cmxs_source_ts_transport_errors_total", "counter", "TS packets with the transport error indicator.",
+            pidLabels, static_cast<double>(q.transportErrors));
+        text.add("cmxs_source_ts_discontinuities_total", "counter", "TS discontinuity indicators.", pidLabels,
+            static_cast<double>(q.discontinuities));
+        text.add("cmxs_source_ts_pcr_jumps_total", "counter", "PCR jumps without a discontinuity indicator.",
+            pidLabels, static_cast<double>(q.pcrJumps));
+        text.add("cmxs_source_ts_corrupt_pes_total", "counter", "PES units with lost or erroneous TS packets.",
+            pidLabels, static_cast<double>(q.corruptPes));
+        if (q.pcrs) {
+            text.add("cmxs_source_ts_pcr_jitter_seconds", "gauge",
+                "Max PCR arrival jitter of the last 10s window.", pidLabels, q.pcrJitterUs / 1e6);
+        }
+    }
 }
 
 static void *cmxs_source_create(obs_data_t *settings, obs_source_t *source) {
@@ -370,6 +791,9 @@ static void *cmxs_source_create(obs_data_t *settings, obs_source_t *source) {
     struct cmxs_source *stream = static_cast<struct cmxs_source *>(bzalloc(sizeof(struct cmxs_source)));
     stream->obs_source = source;
     initObsData(stream);
+    stream->metrics->collectorId = MetricsServer::instance().subscribe([stream](MetricsText &text) {
+        cmxs_source_collect_metrics(stream, text);
+    });
     #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 9, 100)
         av_register_all();
     #endif
@@ -379,6 +803,7 @@ static void *cmxs_source_create(obs_data_t *settings, obs_source_t *source) {
 
 static void cmxs_source_destroy(void *data) {
     struct cmxs_source *stream = static_cast<struct cmxs_source *>(data);
+    MetricsServer::instance().unsubscribe(stream->metrics->collectorId);
     cmxs_source_thread_stop(stream);
     free(const_cast<char*>(stream->streamKey));
     stream->streamKey = nullptr;
@@ -410,15 +835,38 @@ obs_properties_t *cmxs_source_getproperties(void *) {
         props, PROP_START_PULL,
         obs_module_text("CMXSPlugin.CMXSSource.Start"));
     obs_properties_add_text(props, PROP_KEY, obs_module_text("CMXSPlugin.streamKey"), OBS_TEXT_DEFAULT);
+    obs_properties_add_path(
+        props, PROP_CAPTURE,
+        obs_module_text("CMXSPlugin.CMXSSource.Capture"), OBS_PATH_FILE_SAVE, "CMXS capture (*.cmxscap)", nullptr);
+    obs_properties_add_path(
+        props, PROP_TRACE,
+        obs_module_text("CMXSPlugin.CMXSSource.Trace"), OBS_PATH_FILE_SAVE, "Chrome trace (*.json)", nullptr);
+    obs_properties_add_bool(
+        props, PROP_DROP_CORRUPT,
+        obs_module_text("CMXSPlugin.CMXSSource.DropCorrupt"));
+    obs_properties_add_bool(
+        props, PROP_KEYFRAME_AFTER_LOSS,
+        obs_module_text("CMXSPlugin.CMXSSource.KeyframeAfterLoss"));
+    obs_property_t *preview = obs_properties_add_list(
+        props, PROP_PREVIEW,
+        obs_module_text("CMXSPlugin.CMXSSource.Preview"), OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+    obs_property_list_add_int(preview, obs_module_text("CMXSPlugin.CMXSSource.PreviewOff"), CMXS_PREVIEW_OFF);
+    obs_property_list_add_int(preview, obs_module_text("CMXSPlugin.CMXSSource.PreviewReference"),
+        CMXS_PREVIEW_REFERENCE);
+    obs_property_list_add_int(preview, obs_module_text("CMXSPlugin.CMXSSource.PreviewKeyframes"),
+        CMXS_PREVIEW_KEYFRAMES);
     obs_properties_add_int(
-        props, PROP_START_INTPORT,
-        obs_module_text("CMXSPlugin.CMXSSource.Intport"), 10000, 65535, 1);
-#ifdef __APPLE__
+        props, PROP_PREVIEW_FPS,
+        obs_module_text("CMXSPlugin.CMXSSource.PreviewMaxFps"), 1, 60, 1);
+    obs_properties_add_bool(
+        props, PROP_MATCH_CANVAS,
+        obs_module_text("CMXSPlugin.CMXSSource.MatchCanvas"));
+#ifdef CMXS_NIC_SELECTION
     std::unordered_map<std::string, std::string>   nics;
     getNetworkInterfacesInfo(nics);
     for (const auto& entry : nics) {
-        bool nicIsWifi = false;
-        if (!getNicType(entry.first, nicIsWifi)) {
+        CMXSLinkDeviceType_t nicType = kCMXSLinkDeviceTypeUnknown;
+        if (!getNicLinkType(entry.first, nicType)) {
             // Error, unknown Nic type
             continue;
         }
@@ -434,448 +882,799 @@ obs_properties_t *cmxs_source_getproperties(void *) {
         obs_module_text("CMXSPlugin.NetinterfaceType"),
         OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
 
-        if (nicIsWifi) {
-            obs_property_list_add_int(source_list, obs_module_text("CMXSPlugin.wifi"),
-                            kCMXSLinkDeviceTypeWiFi);
-            obs_property_list_add_int(source_list, obs_module_text("CMXSPlugin.cable"),
-                            kCMXSLinkDeviceTypeCable);
-        } else {
-            obs_property_list_add_int(source_list, obs_module_text("CMXSPlugin.cable"),
-                            kCMXSLinkDeviceTypeCable);
-            obs_property_list_add_int(source_list, obs_module_text("CMXSPlugin.wifi"),
-                            kCMXSLinkDeviceTypeWiFi);
+        // the detected type first, it is the default one.
+        const std::pair<const char*, CMXSLinkDeviceType_t> types[] = {
+            {"CMXSPlugin.cable", kCMXSLinkDeviceTypeCable},
+            {"CMXSPlugin.wifi", kCMXSLinkDeviceTypeWiFi},
+            {"CMXSPlugin.cellular", kCMXSLinkDeviceTypeCellular},
+        };
+        for (const auto& type : types) {
+            if (type.second == nicType) {
+                obs_property_list_add_int(source_list, obs_module_text(type.first), type.second);
+            }
+        }
+        for (const auto& type : types) {
+            if (type.second != nicType) {
+                obs_property_list_add_int(source_list, obs_module_text(type.first), type.second);
+            }
         }
-        obs_property_list_add_int(source_list, obs_module_text("CMXSPlugin.cellular"),
-                             kCMXSLinkDeviceTypeCellular);
     }
 #endif
     return props;
 }
 
-static int putPkt2Q(packet_queue_t *q, std::mutex *mtx, AVPacket *p) {
-    AVPacket *pkt1;
-    int ret = 0;
-
-    pkt1 = av_packet_alloc();
-    if (!pkt1) {
-        av_packet_unref(p);
-        return -1;
+// The queue takes the packet, then its decoding stage.
+static void putPkt2Q(packet_queue_t *q, std::mutex *mtx, AVPacket *packet, SerialTask *stage, AVCodecParameters *params,
+    uint64_t gateStartNs = 0) {
+    {
+        std::unique_lock<std::mutex> locker(*mtx);
+        q->push_back({packet, os_gettime_ns(), params, gateStartNs});
     }
-    av_packet_move_ref(pkt1, p);
-
-    std::unique_lock<std::mutex> locker(*mtx);
-
-    q->push_back(pkt1);
+    stage->schedule();
+}
 
-    return ret;
+// nullptr if the codec is not supported. lowres is applied if the decoder can.
+static AVCodecContext *openDecoder(const AVCodecParameters *params, int lowres) {
+    const AVCodec *codec = avcodec_find_decoder(params->codec_id);
+    if (!codec) {
+        blog(LOG_INFO, "no decoder for codec %d", params->codec_id);
+        return nullptr;
+    }
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    if (!ctx) {
+        return nullptr;
+    }
+    ctx->lowres = std::min(lowres, static_cast<int>(codec->max_lowres));
+    if (avcodec_parameters_to_context(ctx, params) < 0 || avcodec_open2(ctx, codec, nullptr) < 0) {
+        blog(LOG_INFO, "avcodec_open2 failed for codec %d", params->codec_id);
+        avcodec_free_context(&ctx);
+    }
+    return ctx;
 }
 
-int InterruptCallback(void* ctx) {
-    cmxs_source_t* s = reinterpret_cast<cmxs_source_t*>(ctx);
-    return s->running ? 0 : 1;
+static void freeDemuxedData(void *opaque, uint8_t *data) {
+    (void)opaque;
+    free(data);
 }
 
-void* av_source_thread(void *data) {
-    cmxs_source_t* s = reinterpret_cast<cmxs_source_t *>(data);
-    char udp_url[50];
-    snprintf(udp_url, sizeof(udp_url), "udp://0.0.0.0:%d", s->internalPort);
-    AVDictionary* options = nullptr;
-
-    av_dict_set(&options, "overrun_nonfatal", "1", 0);
-    av_dict_set(&options, "fifo_size", "278876", 0);   // 50MB
-    av_dict_set(&options, "buffer_size", "5242880", 0);  // 5MB
-    if (!s->cmxs_ffmpeg_source) {
-        s->cmxs_ffmpeg_source = avformat_alloc_context();
-        s->cmxs_ffmpeg_source->interrupt_callback.callback = InterruptCallback;
-        s->cmxs_ffmpeg_source->interrupt_callback.opaque = s;
-    }
-
-    while (s->running) {
-        if (s->dataArrived) {
-            if (avformat_open_input(&s->cmxs_ffmpeg_source, udp_url, nullptr, &options) != 0) {
-                blog(LOG_INFO, "Failed to open UDP input");
-                continue;
-            } else {
-                break;
-            }
-        } else {
-            usleep(100000);
-        }
+// A packet of size bytes at data, in the buffer of a demuxed frame.
+static AVPacket *demuxedPacket(AVBufferRef *buf, uint8_t *data, size_t size, const cmxs_common::TsFrame &frame,
+    int64_t pts, int64_t dts) {
+    AVPacket *packet = av_packet_alloc();
+    if (!packet) {
+        return nullptr;
     }
-
-    if (!s->running) {
-        blog(LOG_INFO, "exit av_thread");
+    packet->buf = av_buffer_ref(buf);
+    if (!packet->buf) {
+        av_packet_free(&packet);
         return nullptr;
     }
+    packet->data = data;
+    packet->size = static_cast<int>(size);
+    packet->pts = pts == cmxs_common::kTsNoTimestamp ? AV_NOPTS_VALUE : pts;
+    packet->dts = dts == cmxs_common::kTsNoTimestamp ? AV_NOPTS_VALUE : dts;
+    packet->stream_index = frame.pid;
+    if (frame.keyframe) {
+        packet->flags |= AV_PKT_FLAG_KEY;
+    }
+    if (frame.corrupt) {
+        packet->flags |= AV_PKT_FLAG_CORRUPT;
+    }
+    return packet;
+}
 
-    if (avformat_find_stream_info(s->cmxs_ffmpeg_source, nullptr) < 0) {
-        blog(LOG_INFO, "Failed to retrieve stream information");
-        return nullptr;
+// Wait for a keyframe, the video frames until it are discarded.
+static void cmxs_source_gate_video(cmxs_source_t *s, const char *reason) {
+    cmxs_pipeline *p = s->pipeline;
+    if (p->waitKeyframe) {
+        return;
     }
-    s->videoStreamIndex = -1;
+    blog(LOG_INFO, "[obs-cmxs] '%s' %s, wait for the next keyframe", obs_source_get_name(s->obs_source), reason);
+    p->waitKeyframe = true;
+    p->gateStartNs = os_gettime_ns();
+    p->gatedFrames = 0;
+    s->metrics->keyframeWaits++;
+}
 
-    for (int i = 0; i < static_cast<int>(s->cmxs_ffmpeg_source->nb_streams); i++) {
-        if (s->cmxs_ffmpeg_source->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-            s->videoStreamIndex = i;
-            blog(LOG_INFO, "Video streamIdx is: %d", s->videoStreamIndex);
+// Follow the frame interval of the video and the one of the canvas. Returns the min interval of the
+// decoded frames the canvas needs, 0 if it needs them all.
+static int64_t cmxs_source_canvas_interval(cmxs_source_t *s, const cmxs_common::TsFrame &frame) {
+    cmxs_pipeline *p = s->pipeline;
+    if (frame.dts != cmxs_common::kTsNoTimestamp && p->lastVideoDts != cmxs_common::kTsNoTimestamp) {
+        int64_t step = frame.dts - p->lastVideoDts;
+        // not across a gap or another timeline.
+        if (step > 0 && step < 90000) {
+            p->frameTicks = p->frameTicks ? (p->frameTicks * 7 + step) / 8 : step;
         }
-        if (s->cmxs_ffmpeg_source->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-            s->audioStreamIndices->push_back(i);
+    }
+    p->lastVideoDts = frame.dts;
+    uint64_t now = os_gettime_ns();
+    if (now >= p->canvasCheckNs) {
+        p->canvasCheckNs = now + CANVAS_CHECK_INTERVAL_NS;
+        struct obs_video_info ovi;
+        p->canvasTicks = obs_get_video_info(&ovi) && ovi.fps_num ?
+            90000LL * ovi.fps_den / ovi.fps_num : 0;
+    }
+    // 10% of margin: a 59.94 fps video in a 60 fps canvas is not reduced.
+    bool over = s->matchCanvas && p->frameTicks && p->canvasTicks && p->frameTicks * 10 < p->canvasTicks * 9;
+    if (over != p->overCanvas) {
+        p->overCanvas = over;
+        if (over) {
+            blog(LOG_INFO, "[obs-cmxs] '%s' video at %.2f fps over the %.2f fps of the canvas, "
+                "skip the non-reference frames OBS would drop", obs_source_get_name(s->obs_source),
+                90000.0 / p->frameTicks, 90000.0 / p->canvasTicks);
+        } else {
+            blog(LOG_INFO, "[obs-cmxs] '%s' video not over the canvas frame rate, decode all the frames",
+                obs_source_get_name(s->obs_source));
         }
     }
-    if (s->audioStreamIndices->size() <= 0 && s->videoStreamIndex == -1) {
-        blog(LOG_INFO, "No stream found in the input");
-        return nullptr;
+    return over ? p->canvasTicks : 0;
+}
+
+// Whether a video frame goes to the decoder. gateStartNs is set when it ends a wait for a keyframe.
+// While the source is hidden the wait goes on, and only the keyframes are decoded: nobody sees the
+// video, and the picture is a recent one when it is shown again.
+static bool cmxs_source_pass_video(cmxs_source_t *s, const cmxs_common::TsFrame &frame, uint64_t &gateStartNs) {
+    cmxs_pipeline *p = s->pipeline;
+    const bool shown = s->showing;
+    if (shown != p->videoShown) {
+        p->videoShown = shown;
+        if (!shown) {
+            cmxs_source_gate_video(s, "hidden, decode the keyframes only");
+        } else if (p->waitKeyframe) {
+            blog(LOG_INFO, "[obs-cmxs] '%s' shown, resume at the next keyframe", obs_source_get_name(s->obs_source));
+            p->gateStartNs = os_gettime_ns();
+            p->gatedFrames = 0;
+        }
     }
-    s->videoCodecContext = nullptr;
-    if (s->videoStreamIndex != -1) {
-        s->videoCodecContext = avcodec_alloc_context3(nullptr);
-        if (!s->videoCodecContext) {
-            blog(LOG_INFO, "videoCodecContext is null");
+    const int preview = s->previewMode;
+    if (preview != p->previewMode) {
+        if (p->previewMode == CMXS_PREVIEW_KEYFRAMES) {
+            // the next frames refer to the skipped ones.
+            cmxs_source_gate_video(s, "out of the keyframes preview");
         }
-        if (0 > avcodec_parameters_to_context(s->videoCodecContext,
-                                s->cmxs_ffmpeg_source->streams[s->videoStreamIndex]->codecpar)) {
-            blog(LOG_INFO, "avcodec_parameters_to_context failed");
+        p->previewMode = preview;
+    }
+    const int64_t canvasInterval = cmxs_source_canvas_interval(s, frame);
+    const bool lost = frame.corrupt && s->keyframeAfterLoss;
+    if (lost) {
+        cmxs_source_gate_video(s, "video data lost");
+    }
+    if (!p->waitKeyframe) {
+        // the frames no other one refers to are skipped above the max fps of the preview,
+        // or above the frame rate of the canvas.
+        int64_t interval = canvasInterval;
+        if (preview != CMXS_PREVIEW_OFF && s->previewMaxFps > 0) {
+            interval = std::max(interval, static_cast<int64_t>(90000 / s->previewMaxFps));
         }
-        const AVCodec *videoCodec = avcodec_find_decoder(s->videoCodecContext->codec_id);
-        if (!videoCodec) {
-            blog(LOG_INFO, "videoCodec is null");
+        if (!interval) {
+            return true;
         }
-        if (0 > avcodec_open2(s->videoCodecContext, videoCodec, nullptr)) {
-            blog(LOG_INFO, "avcodec_open2 is null");
+        bool skippable = preview == CMXS_PREVIEW_KEYFRAMES || cmxs_common::isNonReferencePicture(
+            frame.streamType == cmxs_common::kTsStreamTypeHEVC ? cmxs_common::VideoCodec::HEVC :
+            cmxs_common::VideoCodec::H264, frame.data, frame.size);
+        if ((preview == CMXS_PREVIEW_KEYFRAMES && !frame.keyframe) ||
+            !p->decodeRate.pass(frame.dts, interval, skippable)) {
+            s->metrics->skippedFrames++;
+            return false;
         }
+        return true;
     }
-    if (s->audioStreamIndices->size() > 0) {
-        for (int audioStreamIndex : *(s->audioStreamIndices)) {
-            AVCodecContext *audioCodecContext = avcodec_alloc_context3(nullptr);
-            avcodec_parameters_to_context(audioCodecContext,
-                                        s->cmxs_ffmpeg_source->streams[audioStreamIndex]->codecpar);
-            const AVCodec *audioCodec = avcodec_find_decoder(audioCodecContext->codec_id);
-            if (avcodec_open2(audioCodecContext, audioCodec, nullptr) < 0) {
-                blog(LOG_INFO, "avcodec_open2 failed for audio stream: %d", audioStreamIndex);
-                continue;
+    if (!frame.keyframe || lost) {
+        p->gatedFrames++;
+        s->metrics->keyframeWaitFrames++;
+        return false;
+    }
+    if (!shown) {
+        return true;
+    }
+    blog(LOG_INFO, "[obs-cmxs] '%s' keyframe after %llu ms, %llu video frames discarded",
+        obs_source_get_name(s->obs_source),
+        static_cast<unsigned long long>((os_gettime_ns() - p->gateStartNs) / 1000000),
+        static_cast<unsigned long long>(p->gatedFrames));
+    p->waitKeyframe = false;
+    gateStartNs = p->gateStartNs;
+    return true;
+}
+
+// Queue a demuxed frame for its decoding stage. The packets take the buffer of the frame,
+// the audio is split into its ADTS frames by references into it.
+static void cmxs_source_queue_frame(cmxs_source_t *s, cmxs_common::TsFrame &frame) {
+    cmxs_pipeline *p = s->pipeline;
+    const bool video = cmxs_common::isTsVideoStreamType(frame.streamType);
+    cmxs_common::AdtsHeader adts = {0, 0, 0};
+    if (!video && !cmxs_common::parseAdtsHeader(frame.data, frame.size, adts)) {
+        blog_limited(s->logs, LOG_INFO, "stream %d: no ADTS header, frame dropped", frame.pid);
+        return;
+    }
+    if (video && s->videoStreamIndex != -1 && frame.pid != s->videoStreamIndex &&
+        p->streamKeys.count(frame.pid)) {
+        // another video stream of the program, only one is decoded.
+        return;
+    }
+    uint64_t gateStartNs = 0;
+    if (video && !cmxs_source_pass_video(s, frame, gateStartNs)) {
+        return;
+    }
+    if (frame.corrupt && s->dropCorrupt) {
+        s->metrics->corruptFramesDropped++;
+        return;
+    }
+    // A new program, e.g. after the sender restarted, can add streams or change their codec.
+    cmxs_codec_key key = video ?
+        cmxs_codec_key{frame.streamType == cmxs_common::kTsStreamTypeHEVC ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264,
+            0, 0} :
+        cmxs_codec_key{AV_CODEC_ID_AAC, adts.sampleRate, adts.channels};
+    AVCodecParameters *params = nullptr;
+    auto known = p->streamKeys.find(frame.pid);
+    bool newStream = known == p->streamKeys.end();
+    if (newStream || known->second != key) {
+        blog(LOG_INFO, "stream %d: %s codec %d", frame.pid, newStream ? "new" : "changed", key.codecId);
+        p->streamKeys[frame.pid] = key;
+        params = avcodec_parameters_alloc();
+        if (params) {
+            params->codec_type = video ? AVMEDIA_TYPE_VIDEO : AVMEDIA_TYPE_AUDIO;
+            params->codec_id = key.codecId;
+            if (!video) {
+                params->sample_rate = key.sampleRate;
+                av_channel_layout_default(&params->ch_layout, key.channels);
             }
-            (*s->audioCodecContextMap)[audioStreamIndex] = audioCodecContext;
         }
     }
+    uint8_t *data = frame.data;
+    AVBufferRef *buf = av_buffer_create(data, frame.capacity, freeDemuxedData, nullptr, 0);
+    if (!buf) {
+        avcodec_parameters_free(&params);
+        return;
+    }
+    frame.release();
 
-    int ret = 0;
-    AVPacket *packet = av_packet_alloc();
-    while (s->running) {
-        ret = av_read_frame(s->cmxs_ffmpeg_source, packet);
-        if (!s->running) {
-            break;
-        }
-        if (ret < 0) {
-            char errbuf[AV_ERROR_MAX_STRING_SIZE];
-            av_strerror(ret, errbuf, AV_ERROR_MAX_STRING_SIZE);
-            usleep(10000);
-            blog(LOG_INFO, "av_read_frame failed, Exit, %s, %d", errbuf, ret);
-            continue;
+    if (video) {
+        if (newStream || s->videoStreamIndex == -1) {
+            s->videoStreamIndex = frame.pid;
         }
-        if (packet->stream_index == s->videoStreamIndex && s->videoCodecContext != nullptr) {
-            putPkt2Q(s->videoQ, s->video_mtx, packet);
+        AVPacket *packet = demuxedPacket(buf, data, frame.size, frame, frame.pts, frame.dts);
+        if (packet) {
+            putPkt2Q(s->videoQ, s->video_mtx, packet, &p->videoTask, params, gateStartNs);
         } else {
-            putPkt2Q(s->audioQ, s->audio_mtx, packet);
+            avcodec_parameters_free(&params);
         }
+        av_buffer_unref(&buf);
+        return;
     }
-    {
-        std::unique_lock<std::mutex> locker(*s->video_mtx);
-        s->videoQ->clear();
-    }
-
-    {
-        std::unique_lock<std::mutex> locker(*s->audio_mtx);
-        s->audioQ->clear();
+    // one packet per AAC frame, the PES timestamp is the one of the first.
+    int64_t pts = frame.pts;
+    size_t size = frame.size;
+    while (size > 0) {
+        size_t frameSize = size;
+        int sampleRate = 0;
+        if (cmxs_common::parseAdtsHeader(data, size, adts)) {
+            frameSize = adts.frameSize;
+            sampleRate = adts.sampleRate;
+        }
+        AVPacket *packet = demuxedPacket(buf, data, frameSize, frame, pts, pts);
+        if (!packet) {
+            break;
+        }
+        putPkt2Q(s->audioQ, s->audio_mtx, packet, &p->audioTask, params);
+        params = nullptr;
+        data += frameSize;
+        size -= frameSize;
+        if (pts != cmxs_common::kTsNoTimestamp && sampleRate) {
+            pts += cmxs_common::aacFrameDuration(sampleRate);
+        }
     }
-
-    av_packet_free(&packet);
-    av_dict_free(&options);
-    blog(LOG_INFO, "exit av_thread");
-    return nullptr;
+    avcodec_parameters_free(&params);
+    av_buffer_unref(&buf);
 }
 
-void *cmxs_source_thread(void *data) {
-    cmxs_source_t* s = reinterpret_cast<cmxs_source_t *>(data);
-
-    int sockfd = -1;
-    struct sockaddr_in server_addr;
-    uint32_t currentBufsize = MAX_PACKET_SIZE;
-    uint8_t* buf = nullptr;
-    uint32_t size = MAX_PACKET_SIZE;
-    if (1 == inet_pton(AF_INET, "127.0.0.1", &server_addr.sin_addr)) {
-        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(s->internalPort);
+// Copy the TS quality of the demux for the metrics, and log the PIDs which had errors in the window.
+static void cmxs_source_update_quality(cmxs_source_t *s, uint64_t now) {
+    cmxs_pipeline *p = s->pipeline;
+    if (now < p->qualitySnapshotNs) {
+        return;
     }
-    if (s->listener) {
-        MyRecvListener* myListenerPtr = static_cast<MyRecvListener*>(s->listener);
-        delete myListenerPtr;
-        s->listener = nullptr;
-        s->running = false;
-        blog(LOG_INFO, "free listener");
+    p->qualitySnapshotNs = now + QUALITY_SNAPSHOT_INTERVAL_NS;
+    // a fault which stopped still has its count logged.
+    s->logs->flushExpired();
+    bool windowEnded = now >= p->qualityWindowNs;
+    if (windowEnded) {
+        p->qualityWindowNs = now + QUALITY_WINDOW_NS;
+        p->demux.quality().endWindow();
+    }
+    std::vector<cmxs_common::TsPidQuality> quality = p->demux.quality().pids();
+    if (windowEnded) {
+        for (const cmxs_common::TsPidQuality &q : quality) {
+            cmxs_common::TsPidQuality last;
+            for (const cmxs_common::TsPidQuality &logged : p->qualityLogged) {
+                if (logged.pid == q.pid) {
+                    last = logged;
+                }
+            }
+            if (q.ccErrors == last.ccErrors && q.duplicates == last.duplicates &&
+                q.transportErrors == last.transportErrors && q.discontinuities == last.discontinuities &&
+                q.pcrJumps == last.pcrJumps && q.corruptPes == last.corruptPes) {
+                continue;
+            }
+            blog(LOG_WARNING, "[obs-cmxs] '%s' TS pid %d: %llu cc errors (%llu packets lost), %llu duplicates, "
+                "%llu transport errors, %llu discontinuities, %llu PCR jumps, %llu corrupt PES, PCR jitter %.1f ms",
+                obs_source_get_name(s->obs_source), q.pid,
+                static_cast<unsigned long long>(q.ccErrors - last.ccErrors),
+                static_cast<unsigned long long>(q.lostPackets - last.lostPackets),
+                static_cast<unsigned long long>(q.duplicates - last.duplicates),
+                static_cast<unsigned long long>(q.transportErrors - last.transportErrors),
+                static_cast<unsigned long long>(q.discontinuities - last.discontinuities),
+                static_cast<unsigned long long>(q.pcrJumps - last.pcrJumps),
+                static_cast<unsigned long long>(q.corruptPes - last.corruptPes), q.pcrJitterUs / 1000.0);
+        }
+        p->qualityLogged = quality;
     }
-    MyRecvListener * myListener = nullptr;
+    std::unique_lock<std::mutex> locker(s->metrics->qualityMtx);
+    s->metrics->quality.swap(quality);
+}
 
-    try {
-        myListener = new MyRecvListener();
-    } catch (...) {
+// Create a receiver on links, it waits in s->pipeline for its connection (see cmxs_source_check_connect()).
+static bool cmxs_source_connect(cmxs_source_t *s, const link_list_t& links) {
+    cmxs_pipeline *p = s->pipeline;
+    MyRecvListener *listener = new (std::nothrow) MyRecvListener();
+    if (!listener) {
         blog(LOG_INFO, "No mem");
-        s->running = false;
-        return nullptr;
+        return false;
     }
-    s->listener = myListener;
-
     CMXSStreamParam_t streamCfg;
     memset(&streamCfg, 0, sizeof(CMXSStreamParam_t));
     streamCfg.mStreamkey = s->streamKey;
-    streamCfg.mConnectTimeOut = 3000;
-    fillStreamParam(*s->netDeviceList, streamCfg);
-    s->receiver = Receiver::create(&streamCfg, myListener);
-    if (!s->receiver) {
+    streamCfg.mConnectTimeOut = CONNECT_TIMEOUT_MS;
+    fillStreamParam(links, streamCfg);
+    listener->connect.onDone([p]() { p->receiveTask.schedule(); });
+    Receiver *receiver = Receiver::create(&streamCfg, listener);
+    releaseStreamParamMemory(streamCfg);
+    if (!receiver) {
         blog(LOG_INFO, "failed to create instance");
-        s->running = false;
-        goto done;
+        delete listener;
+        return false;
     }
+    p->connectingReceiver = receiver;
+    p->connectingListener = listener;
+    p->connectingLinks = links;
+    p->connectStartNs = os_gettime_ns();
+    // in case the SDK reports nothing.
+    p->receiveTask.scheduleAfter(CONNECT_TIMEOUT_MS + CONNECT_WAIT_MARGIN_MS);
+    return true;
+}
 
-    while (myListener->connecting_state == 1) {
-        MY_SLEEP(1);
+// The receiver waiting for its connection is connected or failed: use it or drop it.
+// The first receiver failing stops the pulling. A new one for other links replaces the
+// current one only once it is connected, the source keeps running meanwhile.
+static void cmxs_source_check_connect(cmxs_source_t *s) {
+    cmxs_pipeline *p = s->pipeline;
+    ConnectWait::State state = p->connectingListener->connect.state();
+    uint64_t elapsedMs = (os_gettime_ns() - p->connectStartNs) / 1000000;
+    if (state == ConnectWait::Connecting) {
+        if (elapsedMs < CONNECT_TIMEOUT_MS + CONNECT_WAIT_MARGIN_MS) {
+            return;
+        }
+        blog(LOG_INFO, "no connect result in %llu ms", static_cast<unsigned long long>(elapsedMs));
+        state = ConnectWait::Failed;
     }
-    if (myListener->connecting_state != 0) {
-        blog(LOG_INFO, "Connect failed");
-        s->running = false;
-        Receiver::destroy(s->receiver);
-        s->receiver = nullptr;
-        goto done;
+    if (state == ConnectWait::Connected) {
+        blog(LOG_INFO, "receiver connected in %llu ms", static_cast<unsigned long long>(elapsedMs));
+        if (s->receiver) {
+            Receiver::destroy(s->receiver);
+            delete static_cast<MyRecvListener*>(s->listener);
+        }
+        s->receiver = p->connectingReceiver;
+        s->listener = p->connectingListener;
+        p->appliedLinks = p->connectingLinks;
+    } else {
+        Receiver::destroy(p->connectingReceiver);
+        delete p->connectingListener;
+        if (s->receiver) {
+            blog(LOG_INFO, "re-create receiver failed, keep the current links");
+        } else {
+            blog(LOG_INFO, "Connect failed");
+            cmxs_source_cancel(s);
+        }
+    }
+    p->connectingReceiver = nullptr;
+    p->connectingListener = nullptr;
+}
+
+// The NIC monitor reported a change: re-create the receiver if the usable links changed.
+static void cmxs_source_apply_links(cmxs_source_t *s) {
+    cmxs_pipeline *p = s->pipeline;
+    link_list_t active;
+    getActiveLinks(p->selectedLinks, active);
+    if (active == p->appliedLinks) {
+        return;
+    }
+    blog(LOG_INFO, "links changed, %zu -> %zu, re-create the receiver", p->appliedLinks.size(), active.size());
+    cmxs_source_connect(s, active);
+}
+
+// Nothing was received: poll again, later and later while no data comes.
+static void cmxs_source_poll_later(cmxs_source_t *s) {
+    cmxs_pipeline *p = s->pipeline;
+    if (os_gettime_ns() - p->lastDataNs > RECEIVE_BACKOFF_NS) {
+        p->pollMs = std::min(p->pollMs * 2, RECEIVE_POLL_MAX_MS);
+    }
+    p->receiveTask.scheduleAfter(p->pollMs);
+}
+
+// The receive stage: demux the received datagrams, and queue the frames for the decoding stages.
+static void cmxs_source_receive(cmxs_source_t *s) {
+    cmxs_pipeline *p = s->pipeline;
+    if (!s->running) {
+        return;
+    }
+    if (p->connectingReceiver) {
+        cmxs_source_check_connect(s);
+        if (!s->running) {
+            return;
+        }
     }
+    if (!s->receiver) {
+        // scheduled again by the connect result.
+        return;
+    }
+    // Recover in place: a new receiver replaces the current one once connected,
+    // the demux and the decoders go on with its data from the next keyframe.
+    if (!p->connectingReceiver) {
+        uint64_t now = os_gettime_ns();
+        if (static_cast<MyRecvListener*>(s->listener)->paramChanged.exchange(false)) {
+            blog(LOG_INFO, "stream parameters changed, re-create the receiver");
+            p->lastDataNs = now;
+            cmxs_source_connect(s, p->appliedLinks);
+        } else if (s->dataArrived && now - p->lastDataNs > RECOVER_IDLE_NS) {
+            blog(LOG_INFO, "no data for %llu ms, re-create the receiver",
+                static_cast<unsigned long long>((now - p->lastDataNs) / 1000000));
+            p->lastDataNs = now;
+            cmxs_source_connect(s, p->appliedLinks);
+        }
+    }
+    // a change seen while a receiver is connecting is applied after.
+    if (p->nicMonitorId && !p->connectingReceiver && p->nicGeneration != NicMonitor::instance().generation()) {
+        p->nicGeneration = NicMonitor::instance().generation();
+        cmxs_source_apply_links(s);
+    }
+    cmxs_source_update_quality(s, os_gettime_ns());
 
-    buf = new uint8_t[MAX_PACKET_SIZE];
-    while (s->running) {
-        // blog(LOG_INFO, "Enter while, %p", s->receiver);
-        int bytesSent = 0;
-        size = currentBufsize;
-        CMXSErr err = s->receiver->receive(buf, &size, 0, 1000);
-        // blog(LOG_INFO, "Enter while, receive return %d", err);
+    for (int i = 0; i < RECEIVE_BUDGET && s->running; ++i) {
+        uint32_t size = static_cast<uint32_t>(p->buf.size());
+        uint64_t receiveStartUs = s->trace->nowUs();
+        CMXSErr err = s->receiver->receive(p->buf.data(), &size, 0, 0);
         switch (err) {
         case CMXSERR_OK:
+            p->lastDataNs = os_gettime_ns();
+            p->pollMs = RECEIVE_POLL_MS;
             s->dataArrived = true;
-            bytesSent = sendto(sockfd, (const char *)buf, size, 0,
-                           (struct sockaddr*)&server_addr, sizeof(server_addr));
-            if (bytesSent == -1) {
-                blog(LOG_INFO, "Error sending data");
+            s->metrics->receivedBytes += size;
+            s->metrics->receivedDatagrams++;
+            // the datagrams are before the demux, they have no pts.
+            s->trace->span("receive", receiveStartUs, s->trace->nowUs(), -1);
+            p->capture.write(p->buf.data(), size);
+            {
+                uint64_t demuxStartUs = s->trace->nowUs();
+                int64_t demuxedPts = -1;
+                bool demuxed = false;
+                // the arrival times give the PCR jitter.
+                p->demux.feed(p->buf.data(), size, static_cast<int64_t>(p->lastDataNs / 1000),
+                    [s, &demuxedPts, &demuxed](cmxs_common::TsFrame &frame) {
+                        demuxed = true;
+                        if (frame.pts != cmxs_common::kTsNoTimestamp) {
+                            demuxedPts = frame.pts;
+                        }
+                        cmxs_source_queue_frame(s, frame);
+                    });
+                // a span for the datagrams which complete frames.
+                if (demuxed) {
+                    s->trace->span("demux", demuxStartUs, s->trace->nowUs(), demuxedPts);
+                }
             }
             break;
-        case CMXSERR_ServiceUnavailable:
-            // Service unavailable now. We can check the flow on Caton Media XStream platform.
-            blog(LOG_INFO, "ServiceUnavailable");
-            break;
         case CMXSERR_BufferNotEnough:
             blog(LOG_INFO, "buffer not enough, need %d", size);
-            currentBufsize = size;
-            delete [] buf;
-            buf = new uint8_t[size];
             // the needed buffer size is receiveSize
             // re-allocate our buffer to enough
+            p->buf.resize(size);
             break;
+        case CMXSERR_ServiceUnavailable:
+            // Service unavailable now. We can check the flow on Caton Media XStream platform.
+            blog_limited(s->logs, LOG_INFO, "ServiceUnavailable");
+            cmxs_source_poll_later(s);
+            return;
         case CMXSERR_Again:
-            // Here simply sleep 1 second
-            // We can check the message C3SDKMSG_DataReceived for next receive() calling
-            //   or call it periodly.
-            MY_SLEEP(1);
-            break;
+            // nothing received, poll again soon.
+            cmxs_source_poll_later(s);
+            return;
         case CMXSERR_InvalidArgs:
         case CMXSERR_NotFound:
         default:
             // This is a code error. We need check our code.
-            break;
+            blog_limited(s->logs, LOG_WARNING, "receive failed: %u(%s)", err, cmxssdk_error_str(err));
+            p->pollMs = RECEIVE_POLL_MAX_MS;
+            p->receiveTask.scheduleAfter(p->pollMs);
+            return;
         }
     }
+    // more may be there, after the tasks queued meanwhile.
+    p->receiveTask.schedule();
+}
 
-    delete [] buf;
-    blog(LOG_INFO, "exit source_thread");
+// Prepare the receive stage and connect the first receiver.
+static bool cmxs_source_receive_start(cmxs_source_t *s) {
+    cmxs_pipeline *p = s->pipeline;
+    p->selectedLinks = *s->netDeviceList;
+    link_list_t active;
+    getActiveLinks(p->selectedLinks, active);
+    if (!cmxs_source_connect(s, active)) {
+        return false;
+    }
+    if (!p->selectedLinks.empty()) {
+        p->nicMonitorId = NicMonitor::instance().subscribe(nullptr);
+        p->nicGeneration = NicMonitor::instance().generation();
+    }
+    if (!s->capturePath->empty()) {
+        if (p->capture.open(*s->capturePath)) {
+            blog(LOG_INFO, "capture the received datagrams to %s", s->capturePath->c_str());
+        } else {
+            blog(LOG_WARNING, "cannot create the capture file %s", s->capturePath->c_str());
+        }
+    }
+    return true;
+}
 
-    done:
-    if (s->receiver) {
-        Receiver::destroy(s->receiver);
-        s->receiver = nullptr;
+// The demux saw new codec parameters for the video: keep the decoder and its state if they are
+// the same, e.g. after the receiver was re-created, else open a new one.
+static void cmxs_source_reopen_video(cmxs_source_t *s, const AVCodecParameters *params) {
+    if (s->videoCodecContext && codecKey(s->videoCodecContext) == codecKey(params)) {
+        return;
     }
-    if (myListener) {
-        delete myListener;
-        s->listener = nullptr;
-        blog(LOG_INFO, "free listener");
+    blog(LOG_INFO, "video codec parameters changed, reopen the decoder");
+    avcodec_free_context(&s->videoCodecContext);
+    s->videoCodecContext = openDecoder(params, s->previewMode != CMXS_PREVIEW_OFF ? PREVIEW_LOWRES : 0);
+}
+
+static void cmxs_source_reopen_audio(cmxs_source_t *s, int streamIndex, const AVCodecParameters *params) {
+    auto it = s->audioCodecContextMap->find(streamIndex);
+    if (it != s->audioCodecContextMap->end()) {
+        if (codecKey(it->second) == codecKey(params)) {
+            return;
+        }
+        blog(LOG_INFO, "audio stream %d codec parameters changed, reopen the decoder", streamIndex);
+        avcodec_free_context(&it->second);
+        s->audioCodecContextMap->erase(it);
     }
-    if (sockfd != -1) {
-        #ifdef _WIN32
-        closesocket(sockfd);
-        #else
-        close(sockfd);
-        #endif
-        sockfd = -1;
+    AVCodecContext *audioCodecContext = openDecoder(params, 0);
+    if (!audioCodecContext) {
+        return;
+    }
+    (*s->audioCodecContextMap)[streamIndex] = audioCodecContext;
+    if (std::find(s->audioStreamIndices->begin(), s->audioStreamIndices->end(), streamIndex) ==
+        s->audioStreamIndices->end()) {
+        s->audioStreamIndices->push_back(streamIndex);
     }
-    s->dataArrived = false;
-    return nullptr;
 }
 
-void* av_video_thread(void *data) {
-    cmxs_source_t* s = reinterpret_cast<cmxs_source_t *>(data);
+// The video decoding stage: decode the queued packets and give the frames to OBS.
+static void cmxs_source_decode_video(cmxs_source_t *s) {
+    cmxs_pipeline *p = s->pipeline;
     packet_queue_t msgQSwap;
     int ret;
-    while (s->running) {
-        if (!s->dataArrived) {
-            usleep(10000);
+    {
+        std::unique_lock<std::mutex> locker(*s->video_mtx);
+        msgQSwap.swap(*(s->videoQ));
+    }
+    while (!msgQSwap.empty() && s->running) {
+        AVPacket* packet = msgQSwap.front().packet;
+        if (msgQSwap.front().params) {
+            cmxs_source_reopen_video(s, msgQSwap.front().params);
+        }
+        if (msgQSwap.front().gateStartNs) {
+            p->cleanFrameFromNs = msgQSwap.front().gateStartNs;
+        }
+        if (!packet || !s->videoCodecContext) {
+            freeQueuedPacket(msgQSwap.front());
+            msgQSwap.pop_front();
             continue;
         }
-        if (msgQSwap.empty()) {
-            std::unique_lock<std::mutex> locker(*s->video_mtx);
-            if (s->videoQ->empty()) {
-                locker.unlock();
-                usleep(10000);
-                continue;
+        // the decoder skips the other frames too, e.g. the ones queued before the preview started.
+        s->videoCodecContext->skip_frame = s->previewMode == CMXS_PREVIEW_KEYFRAMES ? AVDISCARD_NONKEY :
+            AVDISCARD_DEFAULT;
+
+        profile_start(video_decode_name);
+        int64_t pts = packet->pts == AV_NOPTS_VALUE ? -1 : packet->pts;
+        uint64_t decodeStartNs = os_gettime_ns();
+        uint64_t queueDelayNs = decodeStartNs - msgQSwap.front().queuedNs;
+        s->metrics->queueDelayNs += queueDelayNs;
+        s->metrics->dequeuedPackets++;
+        uint64_t decodeStartUs = s->trace->nowUs();
+        s->trace->span("video queue wait", decodeStartUs - std::min(decodeStartUs, queueDelayNs / 1000),
+            decodeStartUs, pts);
+        uint64_t captureUs = 0;
+        cmxs_common::VideoCodec codec = s->videoCodecContext->codec_id == AV_CODEC_ID_HEVC ?
+            cmxs_common::VideoCodec::HEVC : cmxs_common::VideoCodec::H264;
+        if (packet->pts != AV_NOPTS_VALUE &&
+            cmxs_common::findLatencySei(codec, packet->data, packet->size, captureUs)) {
+            if (p->latencyStamps.size() >= MAX_LATENCY_STAMPS) {
+                p->latencyStamps.erase(p->latencyStamps.begin());
             }
-            if (!s->running) {
-                locker.unlock();
-                break;
-            }
-            msgQSwap.swap(*(s->videoQ));
-            locker.unlock();
-            while (!msgQSwap.empty()) {
-                AVPacket* packet = msgQSwap.front();
-                if (!packet) {
-                    msgQSwap.pop_front();
-                    continue;
-                }
+            p->latencyStamps[packet->pts] = captureUs;
+        }
 
-                ret = avcodec_send_packet(s->videoCodecContext, packet);
-                if (ret < 0) {
-                    blog(LOG_INFO, "Error submitting the packet to the decoder");
-                }
-                AVFrame *videoFrame = av_frame_alloc();
-                ret = avcodec_receive_frame(s->videoCodecContext, videoFrame);
-                if (ret == 0) {
-                    struct obs_source_frame video = {0};
-                    video.format = convert_pixel_format(videoFrame->format);
-                    for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-                        video.data[i] = videoFrame->data[i];
-                        video.linesize[i] = videoFrame->linesize[i];
-                    }
-                    video.width = videoFrame->width;
-                    video.height = videoFrame->height;
-
-                    video.timestamp = videoFrame->pts;
-                    video_format_get_parameters(convert_color_space(
-                        videoFrame->colorspace,
-                        videoFrame->color_trc,
-                        videoFrame->color_primaries),
-                        convert_color_range(videoFrame->color_range),
-                        video.color_matrix,
-                        video.color_range_min,
-                        video.color_range_max);
-                    obs_source_output_video(s->obs_source, &video);
-                    av_frame_free(&videoFrame);
-                } else if (ret == AVERROR(EAGAIN)) {
-                    av_frame_free(&videoFrame);
-                    blog(LOG_INFO, "No video frame available, waiting for more data...");
-                } else {
-                    av_frame_free(&videoFrame);
-                    char errbuf[AV_ERROR_MAX_STRING_SIZE];
-                    av_make_error_string(errbuf, AV_ERROR_MAX_STRING_SIZE, ret);
-                    blog(LOG_INFO, "Error receiving video frame: %d - %s, Exit", ret, errbuf);
-                    break;
+        profile_start(send_packet_name);
+        ret = avcodec_send_packet(s->videoCodecContext, packet);
+        profile_end(send_packet_name);
+        if (ret < 0) {
+            blog_limited(s->logs, LOG_INFO, "Error submitting the packet to the decoder");
+            s->metrics->droppedFrames++;
+        }
+        AVFrame *videoFrame = av_frame_alloc();
+        profile_start(receive_frame_name);
+        ret = avcodec_receive_frame(s->videoCodecContext, videoFrame);
+        profile_end(receive_frame_name);
+        s->trace->span("video decode", decodeStartUs, s->trace->nowUs(), pts);
+        s->metrics->decodeNs += os_gettime_ns() - decodeStartNs;
+        s->metrics->decodedPackets++;
+        if (ret != 0 && ret != AVERROR(EAGAIN)) {
+            s->metrics->droppedFrames++;
+        }
+        if (ret == 0) {
+            struct obs_source_frame video = {0};
+            video.format = convert_pixel_format(videoFrame->format);
+            for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+                video.data[i] = videoFrame->data[i];
+                video.linesize[i] = videoFrame->linesize[i];
+            }
+            video.width = videoFrame->width;
+            video.height = videoFrame->height;
+
+            video.timestamp = videoFrame->pts;
+            video_format_get_parameters(convert_color_space(
+                videoFrame->colorspace,
+                videoFrame->color_trc,
+                videoFrame->color_primaries),
+                convert_color_range(videoFrame->color_range),
+                video.color_matrix,
+                video.color_range_min,
+                video.color_range_max);
+            profile_start(output_video_name);
+            {
+                cmxs_common::TraceSpan span(s->trace, "present", videoFrame->pts);
+                obs_source_output_video(s->obs_source, &video);
+            }
+            s->metrics->outputFrames++;
+            profile_end(output_video_name);
+            if (p->cleanFrameFromNs) {
+                uint64_t cleanNs = os_gettime_ns() - p->cleanFrameFromNs;
+                p->cleanFrameFromNs = 0;
+                s->metrics->firstCleanFrameNs = cleanNs;
+                blog(LOG_INFO, "[obs-cmxs] '%s' first clean frame in %.1f ms", obs_source_get_name(s->obs_source),
+                    cleanNs / 1e6);
+            }
+            if (!p->latencyStamps.empty()) {
+                // the frames are output in pts order, the older stamps were dropped by the decoder.
+                auto stamp = p->latencyStamps.find(videoFrame->pts);
+                if (stamp != p->latencyStamps.end()) {
+                    p->latency.add(static_cast<int64_t>(cmxs_common::wallclockUs() - stamp->second));
                 }
-
-                msgQSwap.pop_front();
-                av_packet_unref(packet);
-                av_packet_free(&packet);
+                p->latencyStamps.erase(p->latencyStamps.begin(), p->latencyStamps.upper_bound(videoFrame->pts));
             }
-            usleep(10000);
+            av_frame_free(&videoFrame);
+        } else if (ret == AVERROR(EAGAIN)) {
+            av_frame_free(&videoFrame);
+            blog_limited(s->logs, LOG_INFO, "No video frame available, waiting for more data...");
+        } else {
+            av_frame_free(&videoFrame);
+            char errbuf[AV_ERROR_MAX_STRING_SIZE];
+            av_make_error_string(errbuf, AV_ERROR_MAX_STRING_SIZE, ret);
+            blog_limited(s->logs, LOG_INFO, "Error receiving video frame: %d - %s", ret, errbuf);
+        }
+        profile_end(video_decode_name);
+
+        freeQueuedPacket(msgQSwap.front());
+        msgQSwap.pop_front();
+    }
+    // left when stopping.
+    for (queued_packet &queued : msgQSwap) {
+        freeQueuedPacket(queued);
+    }
+    if (os_gettime_ns() >= p->latencyLogNs) {
+        p->latencyLogNs = os_gettime_ns() + LATENCY_LOG_INTERVAL_NS;
+        if (!p->latency.empty()) {
+            blog(LOG_INFO, "[obs-cmxs] '%s' capture to present latency: %s",
+                obs_source_get_name(s->obs_source), p->latency.take().c_str());
         }
     }
-    blog(LOG_INFO, "Exit av_video_thread");
-    return nullptr;
 }
 
-void* av_audio_thread(void *data) {
-    cmxs_source_t* s = reinterpret_cast<cmxs_source_t *>(data);
+// The audio decoding stage.
+static void cmxs_source_decode_audio(cmxs_source_t *s) {
     packet_queue_t msgQSwap;
     int ret;
-    while (s->running) {
-        if (!s->dataArrived) {
-            usleep(10000);
-            continue;
+    {
+        std::unique_lock<std::mutex> locker(*s->audio_mtx);
+        msgQSwap.swap(*(s->audioQ));
+    }
+    while (!msgQSwap.empty() && s->running) {
+        AVPacket* packet = msgQSwap.front().packet;
+        if (msgQSwap.front().params) {
+            cmxs_source_reopen_audio(s, packet->stream_index, msgQSwap.front().params);
         }
-        if (msgQSwap.empty()) {
-            std::unique_lock<std::mutex> locker(*s->audio_mtx);
-            if (s->audioQ->empty()) {
-                locker.unlock();
-                usleep(10000);
-                continue;
-            }
-            if (!s->running) {
-                locker.unlock();
-                break;
-            }
-            msgQSwap.swap(*(s->audioQ));
-            locker.unlock();
-            while (!msgQSwap.empty()) {
-                AVPacket* packet = msgQSwap.front();
-                for (int audioStreamIndex : *(s->audioStreamIndices)) {
-                    if (packet->stream_index == audioStreamIndex) {
-                        // Audio frame
-                        auto audioContextIt = s->audioCodecContextMap->find(audioStreamIndex);
-                        if (audioContextIt != s->audioCodecContextMap->end()) {
-                            AVCodecContext* audioCodecContext = audioContextIt->second;
-                            ret = avcodec_send_packet(audioCodecContext, packet);
-                            if (ret < 0) {
-                                blog(LOG_INFO, "Error submitting the packet to the decoder");
-                            }
-                            AVFrame *audioFrame = av_frame_alloc();
-                            ret = avcodec_receive_frame(audioCodecContext, audioFrame);
-                            if (ret == 0) {
-                                struct obs_source_audio audio = {0};
-                                for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-                                    audio.data[i] = audioFrame->data[i];
-                                }
-
-                                audio.samples_per_sec = audioFrame->sample_rate;
-                                audio.speakers = convert_speaker_layout(audioFrame->ch_layout.nb_channels);
-                                audio.format = convert_sample_format(audioFrame->format);
-                                audio.frames = audioFrame->nb_samples;
-                                audio.timestamp =  audioFrame->pts;
-                                obs_source_output_audio(s->obs_source, &audio);
-                                av_frame_free(&audioFrame);
-                            } else if (ret == AVERROR(EAGAIN)) {
-                                av_frame_free(&audioFrame);
-                                blog(LOG_INFO, "No audio frame available, waiting for more data...");
-                            } else {
-                                av_frame_free(&audioFrame);
-                                char errbuf[AV_ERROR_MAX_STRING_SIZE];
-                                av_make_error_string(errbuf, AV_ERROR_MAX_STRING_SIZE, ret);
-                                blog(LOG_INFO, "Error receiving audio frame: %d - %s, Exit", ret, errbuf);
-                                break;
-                            }
-                        } else {
-                            blog(LOG_INFO, "Audio stream with index %d is not found in the map", packet->stream_index);
+        uint64_t queueDelayUs = (os_gettime_ns() - msgQSwap.front().queuedNs) / 1000;
+        uint64_t dequeuedUs = s->trace->nowUs();
+        s->trace->span("audio queue wait", dequeuedUs - std::min(dequeuedUs, queueDelayUs), dequeuedUs,
+            packet->pts == AV_NOPTS_VALUE ? -1 : packet->pts);
+        for (int audioStreamIndex : *(s->audioStreamIndices)) {
+            if (packet->stream_index == audioStreamIndex) {
+                // Audio frame
+                auto audioContextIt = s->audioCodecContextMap->find(audioStreamIndex);
+                if (audioContextIt != s->audioCodecContextMap->end()) {
+                    AVCodecContext* audioCodecContext = audioContextIt->second;
+                    ret = avcodec_send_packet(audioCodecContext, packet);
+                    if (ret < 0) {
+                        blog_limited(s->logs, LOG_INFO, "Error submitting the packet to the decoder");
+                    }
+                    AVFrame *audioFrame = av_frame_alloc();
+                    ret = avcodec_receive_frame(audioCodecContext, audioFrame);
+                    if (ret == 0) {
+                        struct obs_source_audio audio = {0};
+                        for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+                            audio.data[i] = audioFrame->data[i];
                         }
+
+                        audio.samples_per_sec = audioFrame->sample_rate;
+                        audio.speakers = convert_speaker_layout(audioFrame->ch_layout.nb_channels);
+                        audio.format = convert_sample_format(audioFrame->format);
+                        audio.frames = audioFrame->nb_samples;
+                        audio.timestamp =  audioFrame->pts;
+                        obs_source_output_audio(s->obs_source, &audio);
+                        av_frame_free(&audioFrame);
+                    } else if (ret == AVERROR(EAGAIN)) {
+                        av_frame_free(&audioFrame);
+                        blog_limited(s->logs, LOG_INFO, "No audio frame available, waiting for more data...");
+                    } else {
+                        av_frame_free(&audioFrame);
+                        char errbuf[AV_ERROR_MAX_STRING_SIZE];
+                        av_make_error_string(errbuf, AV_ERROR_MAX_STRING_SIZE, ret);
+                        blog_limited(s->logs, LOG_INFO, "Error receiving audio frame: %d - %s", ret, errbuf);
                     }
+                } else {
+                    blog(LOG_INFO, "Audio stream with index %d is not found in the map", packet->stream_index);
                 }
-                msgQSwap.pop_front();
-                av_packet_unref(packet);
-                av_packet_free(&packet);
             }
-            usleep(10);
         }
+        freeQueuedPacket(msgQSwap.front());
+        msgQSwap.pop_front();
+    }
+    // left when stopping.
+    for (queued_packet &queued : msgQSwap) {
+        freeQueuedPacket(queued);
     }
-    blog(LOG_INFO, "Exit av_audio_thread");
-    return nullptr;
 }
 
 void cmxs_source_thread_start(cmxs_source_t *s) {
+    // a pulling which stopped itself is cleaned up first.
+    cmxs_source_thread_stop(s);
+    if (!s->tracePath->empty()) {
+        std::string key = s->streamKey ? s->streamKey : "";
+        if (s->trace->open(*s->tracePath, "cmxs source " + key, key)) {
+            blog(LOG_INFO, "trace the pipeline to %s", s->tracePath->c_str());
+        } else {
+            blog(LOG_WARNING, "cannot create the trace file %s", s->tracePath->c_str());
+        }
+    }
     s->running = true;
     s->dataArrived = false;
-    pthread_create(&s->video_thread, nullptr, av_video_thread, s);
-    pthread_create(&s->audio_thread, nullptr, av_audio_thread, s);
-    pthread_create(&s->av_thread, nullptr, av_source_thread, s);
-    pthread_create(&s->cmxs_thread, nullptr, cmxs_source_thread, s);
+    s->videoStreamIndex = -1;
+    s->showing = obs_source_showing(s->obs_source);
+    s->pipeline = new cmxs_pipeline(s);
+    // the video starts at a keyframe.
+    s->metrics->keyframeWaits++;
+    if (!cmxs_source_receive_start(s)) {
+        cmxs_source_cancel(s);
+    }
+    s->pipeline->receiveTask.schedule();
 }
 
 void cmxs_source_update(void *data, obs_data_t *settings) {
@@ -929,13 +1728,22 @@ void cmxs_source_update(void *data, obs_data_t *settings) {
     snprintf(const_cast<char*>(s->streamKey), streamKeyLength+1,
                                                             "%s", const_cast<char*>(streamKey));
 
-    s->internalPort = obs_data_get_int(settings, PROP_START_INTPORT);
-    #ifdef __APPLE__
+    // used from the next start of pulling.
+    *s->capturePath = obs_data_get_string(settings, PROP_CAPTURE);
+    *s->tracePath = obs_data_get_string(settings, PROP_TRACE);
+    s->dropCorrupt = obs_data_get_bool(settings, PROP_DROP_CORRUPT);
+    s->keyframeAfterLoss = obs_data_get_bool(settings, PROP_KEYFRAME_AFTER_LOSS);
+    s->previewMode = static_cast<int>(obs_data_get_int(settings, PROP_PREVIEW));
+    s->previewMaxFps = static_cast<int>(obs_data_get_int(settings, PROP_PREVIEW_FPS));
+    s->matchCanvas = obs_data_get_bool(settings, PROP_MATCH_CANVAS);
+    #ifdef CMXS_NIC_SELECTION
+    // rebuilt from the settings, a link unchecked since the last update is removed.
+    s->netDeviceList->clear();
     std::unordered_map<std::string, std::string>   nics;
     getNetworkInterfacesInfo(nics);
     for (const auto& entry : nics) {
-        bool nicIsWifi = false;
-        if (!getNicType(entry.first, nicIsWifi)) {
+        CMXSLinkDeviceType_t nicType = kCMXSLinkDeviceTypeUnknown;
+        if (!getNicLinkType(entry.first, nicType)) {
             continue;
         }
         const std::string labelStr = entry.first;
@@ -945,13 +1753,11 @@ void cmxs_source_update(void *data, obs_data_t *settings) {
         if (enabled) {
             int value = obs_data_get_int(settings, listName.c_str());
             blog(LOG_INFO, "%s, Device : %s ebabled, devicetype is: %d", listName.c_str(), lableName.c_str(), value);
-            CMXSLinkDeviceType_t linkdevicetype = \
-                            static_cast<CMXSLinkDeviceType_t>(obs_data_get_int(settings, listName.c_str()));
-            if (s->netDeviceList->find(entry.first) == s->netDeviceList->end()) {
-                s->netDeviceList->insert({labelStr, linkdevicetype});
-            } else {
-                (*s->netDeviceList)[labelStr] = linkdevicetype;
+            CMXSLinkDeviceType_t linkdevicetype = nicType;
+            if (obs_data_has_user_value(settings, listName.c_str())) {
+                linkdevicetype = static_cast<CMXSLinkDeviceType_t>(value);
             }
+            (*s->netDeviceList)[labelStr] = linkdevicetype;
         }
     }
     #endif
@@ -973,12 +1779,15 @@ void cmxs_source_shown(void *data) {
     auto s = (cmxs_source_t *)data;  // NOLINT
     auto name = obs_source_get_name(s->obs_source);
     blog(LOG_INFO, "[obs-cmxs] cmxs_source_shown('%s'...)", name);
+    // the receive stage resumes the video decode at the next keyframe.
+    s->showing = true;
 }
 
 void cmxs_source_hidden(void *data) {
     auto s = (cmxs_source_t *)data;  // NOLINT
     auto name = obs_source_get_name(s->obs_source);
     blog(LOG_INFO, "[obs-cmxs] cmxs_source_hidden('%s'...)", name);
+    s->showing = false;
 }
 
 void cmxs_source_activated(void *data) {
@@ -997,6 +1806,9 @@ void cmxs_source_get_defaults(obs_data_t *settings) {
     blog(LOG_INFO, "Enter cmxs_source_get_defaults");
     obs_data_set_default_bool(settings, PROP_START_PULL,
                   false);
+    obs_data_set_default_int(settings, PROP_PREVIEW, CMXS_PREVIEW_OFF);
+    obs_data_set_default_int(settings, PROP_PREVIEW_FPS, PREVIEW_DEFAULT_FPS);
+    obs_data_set_default_bool(settings, PROP_MATCH_CANVAS, true);
 }
 
 obs_source_info create_cmxs_source_info() {
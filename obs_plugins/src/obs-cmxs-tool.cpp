@@ -22,6 +22,11 @@ with this program. If not, see <https://www.gnu.org/licenses/>
  * You can use CMake to generate makefile and make it.
  */
 #include "obs-cmxs-tool.h"
+#ifdef __linux__
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#endif
 
 
 void fillStreamParam(const std::unordered_map<std::string,
@@ -90,7 +95,86 @@ bool getNicType(const std::string& bsdDeviceName, bool& isWifi) {
     // no active device found
     return false;
 }
+#endif
+
+#ifdef __linux__
+static bool sysfsExists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
 
+// Basename of the driver bound to the interface, empty for virtual ones.
+static std::string sysfsDriver(const std::string& deviceName) {
+    char target[256];
+    const std::string link = "/sys/class/net/" + deviceName + "/device/driver";
+    ssize_t len = readlink(link.c_str(), target, sizeof(target) - 1);
+    if (len <= 0) {
+        return "";
+    }
+    target[len] = '\0';
+    const char* base = strrchr(target, '/');
+    return base ? base + 1 : target;
+}
+
+// DEVTYPE of the uevent file: "wlan", "wwan", ... empty for ethernet.
+static std::string sysfsDevType(const std::string& deviceName) {
+    std::ifstream uevent("/sys/class/net/" + deviceName + "/uevent");
+    std::string line;
+    while (std::getline(uevent, line)) {
+        if (line.compare(0, 8, "DEVTYPE=") == 0) {
+            return line.substr(8);
+        }
+    }
+    return "";
+}
+
+bool getNicLinkType(const std::string& deviceName, CMXSLinkDeviceType_t& type) {
+    const std::string sysfs = "/sys/class/net/" + deviceName;
+    // bridges, tunnels, veth, docker... have no device behind them.
+    if (!sysfsExists(sysfs + "/device")) {
+        return false;
+    }
+    if (sysfsExists(sysfs + "/wireless") || sysfsExists(sysfs + "/phy80211")) {
+        type = kCMXSLinkDeviceTypeWiFi;
+        return true;
+    }
+    const std::string devType = sysfsDevType(deviceName);
+    if (devType == "wlan") {
+        type = kCMXSLinkDeviceTypeWiFi;
+        return true;
+    }
+    if (devType == "wwan" || deviceName.compare(0, 4, "wwan") == 0) {
+        type = kCMXSLinkDeviceTypeCellular;
+        return true;
+    }
+    // USB modems and phone tethering show up as ethernet devices.
+    static const char* const cellularDrivers[] = {
+        "qmi_wwan", "cdc_mbim", "huawei_cdc_ncm", "sierra_net", "ipheth", "rndis_host",
+    };
+    const std::string driver = sysfsDriver(deviceName);
+    for (const char* cellular : cellularDrivers) {
+        if (driver == cellular) {
+            type = kCMXSLinkDeviceTypeCellular;
+            return true;
+        }
+    }
+    type = kCMXSLinkDeviceTypeCable;
+    return true;
+}
+#endif
+
+#ifdef __APPLE__
+bool getNicLinkType(const std::string& deviceName, CMXSLinkDeviceType_t& type) {
+    bool isWifi = false;
+    if (!getNicType(deviceName, isWifi)) {
+        return false;
+    }
+    type = isWifi ? kCMXSLinkDeviceTypeWiFi : kCMXSLinkDeviceTypeCable;
+    return true;
+}
+#endif
+
+#ifdef CMXS_NIC_SELECTION
 // Function to get network interfaces and their IP addresses
 void getNetworkInterfacesInfo(std::unordered_map<std::string, std::string>& nicMap) {
     struct ifaddrs *ifap;
@@ -107,9 +191,15 @@ void getNetworkInterfacesInfo(std::unordered_map<std::string, std::string>& nicM
             continue;   // deeply nested code harder to read
         }
         std::string interfaceName(interface->ifa_name);
+        #ifdef __APPLE__
         if (interfaceName.compare(0, 2, "en") != 0) {
             continue;
         }
+        #else
+        if (interface->ifa_flags & IFF_LOOPBACK) {
+            continue;
+        }
+        #endif
         const struct sockaddr_in *addr = (const struct sockaddr_in*)interface->ifa_addr;
         char addrBuf[ INET6_ADDRSTRLEN ];
         if (addr && (addr->sin_family == AF_INET || addr->sin_family == AF_INET6)) {
@@ -124,7 +214,8 @@ void getNetworkInterfacesInfo(std::unordered_map<std::string, std::string>& nicM
                     type = "ip6";
                 }
             }
-            if (type) {
+            // show the IPv4 address when the interface has both.
+            if (type && (addr->sin_family == AF_INET || nicMap.find(interfaceName) == nicMap.end())) {
                 std::string ipAddress = getIPAddress(interface->ifa_addr);
                 nicMap[interfaceName] = ipAddress;
             }
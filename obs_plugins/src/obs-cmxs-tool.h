@@ -27,14 +27,17 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include <string>
 #include <cmxssdk/cmxssdk.h>
 
-#ifdef __APPLE__
+#if defined(__APPLE__) || defined(__linux__)
+// The network interfaces can be listed and selected for the cmxs links.
+#define CMXS_NIC_SELECTION 1
 #include <net/if.h>
 #include <ifaddrs.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#endif
 
-
+#ifdef __APPLE__
 #include <CoreFoundation/CoreFoundation.h>
 #include <SystemConfiguration/SystemConfiguration.h>
 
@@ -47,9 +50,13 @@ void fillStreamParam(const std::unordered_map<std::string,
                      CMXSStreamParam_t& streamParam);
 
 void releaseStreamParamMemory(CMXSStreamParam_t& streamParam);
-    #ifdef __APPLE__
+    #ifdef CMXS_NIC_SELECTION
     void getNetworkInterfacesInfo(std::unordered_map<std::string, std::string>& nicMap);
     std::string getIPAddress(const struct sockaddr* sa);
+    // Link type of a physical interface, false for unknown or virtual ones.
+    bool getNicLinkType(const std::string& deviceName, CMXSLinkDeviceType_t& type);
+    #endif
+    #ifdef __APPLE__
     bool getNicType(const std::string& bsdDeviceName, bool& isWifi);
     #endif
 #endif
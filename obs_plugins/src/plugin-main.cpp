@@ -60,6 +60,8 @@ extern "C" {
 #include "main-output.h"
 #include "Config.h"
 #include "forms/output-settings.h"
+#include "obs-cmxs-metrics.h"
+#include "obs-cmxs-executor.h"
 
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE(PLUGIN_NAME, "en-US")
@@ -104,6 +106,7 @@ bool obs_module_load(void) {
     if (main_window) {
         Config *conf = Config::Current();
         conf->Load();
+        MetricsServer::instance().setPort(conf->metricsPort);
         main_output_init();
         // Ui setup
         QAction *menu_action =
@@ -143,6 +146,9 @@ void obs_module_unload(void) {
     blog(LOG_INFO, "[obs-cmxs] +obs_module_unload()");
 
     // obs_ffmpeg_unload_logging();
+    MetricsServer::instance().setPort(0);
+    // the sources are destroyed, their stages are done.
+    Executor::instance().shutdown();
     CMXSSDK::uninit();
     if (s_g_host) {
         free((void*)s_g_host);  // NOLINT
@@ -39,6 +39,7 @@
 #include <string>
 #include <unordered_map>
 #include <list>
+#include <memory>
 #include <ctype.h>
 
 #ifdef _WIN32
@@ -48,6 +49,7 @@ typedef SSIZE_T ssize_t;
 #define strcasecmp _stricmp
 #endif
 
+#include <inttypes.h>
 #include <stdint.h>
 
 #define MODULE_STRING "cmxs"
@@ -60,6 +62,11 @@ typedef SSIZE_T ssize_t;
 
 #include <cmxssdk/cmxssdk.h>
 
+#include "cmxs_capture.h"
+#include "cmxs_latency.h"
+#include "cmxs_stream.h"
+#include "cmxs_stats.h"
+#include "cmxs_warm_pool.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -70,21 +77,31 @@ namespace cmxs_plugin {
 
 using namespace caton::cmxs;
 
-class CMXSReceiver : public CMXSListener {
+class CMXSReceiver {
  public:
     static constexpr char * SETTING_ITEM_SERVER = "server";
     static constexpr char * SETTING_ITEM_DEVICE = "device";
     static constexpr char * SETTING_ITEM_KEY = "key";
     static constexpr char * SETTING_ITEM_DATA_LEN = "data_len";
+    static constexpr char * SETTING_ITEM_SESSION_LINGER = "session_linger";
+    static constexpr char * SETTING_ITEM_WARM_POOL = "warm_pool";
+    static constexpr char * SETTING_ITEM_WARM_POOL_TTL = "warm_pool_ttl";
+    static constexpr char * SETTING_ITEM_STATS_INTERVAL = "stats_interval";
+    static constexpr char * SETTING_ITEM_CAPTURE = "capture";
+    static constexpr char * SETTING_ITEM_LATENCY = "latency";
 
     CMXSReceiver() = delete;
     explicit CMXSReceiver(vlc_object_t * obj)
         : mVlcObj(obj),
         mVlcIntF(reinterpret_cast<intf_thread_t *>(obj)),
         mDataLen(0),
-        mReceiver(nullptr),
-        mConnected(false),
-        mReserved{0} {
+        mWarmPoolSize(0),
+        mWarmPoolTtlMs(0),
+        mStream(nullptr),
+        mStatsPublisher(nullptr),
+        mCapture(nullptr),
+        mLatencyLogInterval(0),
+        mNextLatencyLog(0) {
         cmxssdk_set_log_callback(cmxsLogCb);
         stream_t *access = reinterpret_cast<stream_t *>(obj);
         access->p_sys = nullptr;
@@ -103,185 +120,155 @@ class CMXSReceiver : public CMXSListener {
     }
 
  private:
-    void onMessage(uint32_t message,
-        uint32_t param1,
-        const void * param2) noexcept override {
-        switch (message) {
-            case CMXSMSG_ServerConnected:
-                {
-                    msg_Info(mVlcIntF, "server connect success.\n");
-                    mConnected = true;
-                }
-                break;
-            case CMXSMSG_ServerConnectFailed:
-                {
-                    const CMXSServerConnectFailedMsgData_t * data =
-                        reinterpret_cast<const CMXSServerConnectFailedMsgData_t *>(param2);
-                    msg_Err(mVlcIntF, "connect failed: %s.\n", data->mErrorInfo);
-                }
-                break;
-            case CMXSMSG_DataReady:
-                {
-                    msg_Info(mVlcIntF, "Data ready\n");
-                }
-                break;
-            case CMXSMSG_DataServerState:
-                {
-                    const CMXSDataServerStateMsgData_t * data =
-                        reinterpret_cast<const CMXSDataServerStateMsgData_t *>(param2);
-                    msg_Info(mVlcIntF, "data server state: %u\n", data->mDataServerConnectState);
-                }
-                break;
-            case CMXSMSG_DataServerLinkState:
-                {
-                    const CMXSDataServerLinkStateMsgData_t * data =
-                        reinterpret_cast<const CMXSDataServerLinkStateMsgData_t *>(param2);
-                    msg_Info(mVlcIntF, "CMXS data server link state: device: %s, state: %u\n",
-                        data->mNetDevice, data->mDataServerConnectState);
-                }
-                break;
-            case CMXSMSG_Stat:
-                {
-                    if (param1) {
-                        // for receiver, cannot go here
-                        break;
-                    }
-                    const CMXSReceiveStatMsgData_t * data =
-                        reinterpret_cast<const CMXSReceiveStatMsgData_t *>(param2);
-                    msg_Info(mVlcIntF, "receive stat: mLastSize: %u\n", data->mLastSize);
-                }
-                break;
-            case CMXSMSG_StreamParamChanged:
-                {
-                    const CMXSStreamParamChangedMsgData_t * data =
-                        reinterpret_cast<const CMXSStreamParamChangedMsgData_t *>(param2);
-                    msg_Info(mVlcIntF, "stream param changed from platform: %s, should re-create the stream\n",
-                        data->mDesc);
-                }
-                break;
-            case CMXSMSG_ConnectProgress:
-                {
-                    const CMXSConnectProgressMsgData_t * data =
-                        reinterpret_cast<const CMXSConnectProgressMsgData_t *>(param2);
-                    msg_Info(mVlcIntF, "CMXS progress: %s\n", data->mDescription);
-                }
-                break;
-            case CMXSMSG_ERROR:
-                {
-                    switch (param1) {
-                        case CMXSERR_DataPortDetectFailed:
-                            {
-                                const CMXSDataPortDetectFailedMsgData_t * data =
-                                    reinterpret_cast<const CMXSDataPortDetectFailedMsgData_t *>(param2);
-                                for (uint32_t i = 0; i < data->mPortsCount; ++i) {
-                                    msg_Err(mVlcIntF, "data port detect failed, expect port: %u\n", data->mPorts[i]);
-                                }
-                            }
-                            break;
-                        case CMXSERR_NoMem:
-                            {
-                                msg_Err(mVlcIntF, "NoMem\n");
-                            }
-                            break;
-                        case CMXSERR_ServiceUnavailable:
-                            {
-                                const CMXSUnAvailableMsgData_t * data =
-                                    reinterpret_cast<const CMXSUnAvailableMsgData_t *>(param2);
-                                msg_Err(mVlcIntF, "service unavailable: %s\n", data->mErrorInfo);
-                            }
-                            break;
-                        default:
-                            msg_Err(mVlcIntF, "error: %d(%s)\n", param1, cmxssdk_error_str(param1));
-                            break;
-                    }
-                }
-                break;
-            case CMXSMSG_WARNING:
-                {
-                    switch (param1) {
-                        case CMXSERR_NotReceiveDataInTime:
-                            msg_Err(mVlcIntF, "warning: NotReceiveDataInTime\n");
-                            break;
-                        default:
-                            msg_Err(mVlcIntF, "warning: %d(%s)\n", param1, cmxssdk_error_str(param1));
-                            break;
-                    }
-                }
-            default:
-                break;
+    bool start(stream_t *access) {
+        CMXSStreamConfig cfg;
+        if (!parseConfig(mVlcObj, access->psz_location, cfg, true)) {
+            return false;
+        }
+        mDataLen = cfg.dataLen;
+
+        // Take the stream from the warm pool if it is already connected.
+        int64_t warmPoolSize = var_InheritInteger(mVlcIntF, SETTING_ITEM_WARM_POOL);
+        mWarmPoolSize = warmPoolSize > 0 ? static_cast<size_t>(warmPoolSize) : 0;
+        int64_t warmPoolTtl = var_InheritInteger(mVlcIntF, SETTING_ITEM_WARM_POOL_TTL);
+        mWarmPoolTtlMs = warmPoolTtl > 0 ? static_cast<uint32_t>(warmPoolTtl * 1000) : 0;
+        if (mWarmPoolSize) {
+            mStream = CMXSWarmPool::instance().take(cfg, mVlcObj);
+            // the session of another server or device would be kept by its parked streams.
+            CMXSWarmPool::instance().dropOtherSessions(cfg);
+        }
+
+        // Now, we create receiver.
+        if (!mStream) {
+            std::string error;
+            mStream = CMXSStream::create(mVlcObj, cfg, error);
+            if (!mStream) {
+                vlc_dialog_display_error(mVlcObj, "Failed to create receiver", "%s", error.c_str());
+                msg_Err(mVlcIntF, "Failed to create receiver: %s", error.c_str());
+                return false;
+            }
+        }
+
+        mStatsPublisher.reset(new CMXSStatsPublisher(mVlcObj, mStream->stats(), cfg.key,
+            var_InheritInteger(mVlcIntF, SETTING_ITEM_STATS_INTERVAL)));
+
+        char * capturePath = var_InheritString(mVlcIntF, SETTING_ITEM_CAPTURE);
+        if (capturePath && *capturePath) {
+            mCapture.reset(new cmxs_common::CaptureWriter());
+            if (mCapture->open(capturePath)) {
+                msg_Info(mVlcIntF, "capturing the received datagrams to %s", capturePath);
+            } else {
+                msg_Err(mVlcIntF, "cannot create the capture file %s", capturePath);
+                mCapture.reset();
+            }
+        }
+        free(capturePath);
+
+        if (var_InheritBool(mVlcIntF, SETTING_ITEM_LATENCY)) {
+            mLatencyScanner.reset(new cmxs_common::TsLatencyScanner());
+            int64_t intervalSeconds = var_InheritInteger(mVlcIntF, SETTING_ITEM_STATS_INTERVAL);
+            mLatencyLogInterval = intervalSeconds > 0 ? intervalSeconds * CLOCK_FREQ : 0;
+            mNextLatencyLog = mdate() + mLatencyLogInterval;
         }
+
+        if (mWarmPoolSize) {
+            CMXSWarmPool::instance().prewarmNeighbours(VLC_OBJECT(mVlcObj->obj.libvlc), cfg, mWarmPoolSize,
+                mWarmPoolTtlMs, [](vlc_object_t * obj, const char * location, CMXSStreamConfig & neighbour) {
+                    return parseConfig(obj, location, neighbour, false);
+                });
+        }
+
+        // now, after CMXSMSG_ServerConnected message received, we can receive data
+        return true;
     }
 
-    bool start(stream_t *access) {
+    void stop() {
+        if (!mStream) {
+            return;
+        }
+        mStatsPublisher.reset();
+        if (mCapture) {
+            if (mCapture->failed()) {
+                msg_Err(mVlcIntF, "capture failed to write, %" PRIu64 " datagrams captured", mCapture->records());
+            } else {
+                msg_Info(mVlcIntF, "%" PRIu64 " datagrams captured", mCapture->records());
+            }
+            mCapture.reset();
+        }
+        if (mLatencyScanner) {
+            logLatency();
+            mLatencyScanner.reset();
+        }
+        if (mWarmPoolSize && mStream->connected()) {
+            // keep it connected, switching back to it is fast.
+            CMXSWarmPool::instance().park(mStream, VLC_OBJECT(mVlcObj->obj.libvlc), mWarmPoolSize,
+                mWarmPoolTtlMs);
+        } else {
+            CMXSStream::destroy(mStream);
+        }
+        mStream = nullptr;
+    }
+
+    // Build the stream config from the url, and from setting dialog for the missing parameters.
+    // interactive shows the setting errors to the user.
+    static bool parseConfig(vlc_object_t * obj, const char * location, CMXSStreamConfig & cfg, bool interactive) {
+        std::unordered_map<std::string, std::string> settings;
         // parse url
-        parseLocation(access->psz_location);
+        parseLocation(obj, location, settings);
 
         // If paramter not provided by url, see if it is provided by setting dialog.
-        if (!checkSetting(SETTING_ITEM_SERVER) ||
-            !checkSetting(SETTING_ITEM_DEVICE) ||
-            !checkSetting(SETTING_ITEM_KEY) ||
-            !checkSetting(SETTING_ITEM_DATA_LEN)) {
-            msg_Err(mVlcIntF, "check settings failed");
+        if (!checkSetting(obj, settings, SETTING_ITEM_SERVER) ||
+            !checkSetting(obj, settings, SETTING_ITEM_DEVICE) ||
+            !checkSetting(obj, settings, SETTING_ITEM_KEY) ||
+            !checkSetting(obj, settings, SETTING_ITEM_DATA_LEN)) {
+            msg_Err(obj, "check settings failed");
             return false;
         }
 
         // data_len can be the max data length of the packets in bytes.
-        const std::string & dataLenStr = mSettings.at(SETTING_ITEM_DATA_LEN);
+        const std::string & dataLenStr = settings.at(SETTING_ITEM_DATA_LEN);
         for (uint32_t i = 0; i < dataLenStr.size(); ++i) {
             if (dataLenStr[i] > '9' || dataLenStr[i] < '0') {
-                vlc_dialog_display_error(mVlcObj, "Setting error", "data len must be number");
+                if (interactive) {
+                    vlc_dialog_display_error(obj, "Setting error", "data len must be number");
+                }
                 return false;
             }
         }
-        sscanf(dataLenStr.c_str(), "%zu", &mDataLen);
-        if (!mDataLen) {
-            vlc_dialog_display_error(mVlcObj, "Setting error", "data len must large than 0");
-            return false;
-        }
-        mSettings.erase(SETTING_ITEM_DATA_LEN);
-
-        // Now, we create receiver.
-        // Step 1: init the global configs.
-        CMXSConfig_t cmxsCfg;
-        memset(&cmxsCfg, 0, sizeof(CMXSConfig_t));
-        cmxsCfg.mServer = mSettings.at(SETTING_ITEM_SERVER).c_str();
-        cmxsCfg.mDeviceId = mSettings.at(SETTING_ITEM_DEVICE).c_str();
-        CMXSErr err = CMXSSDK::init(&cmxsCfg, this);
-        if (err != CMXSERR_OK) {
-            vlc_dialog_display_error(mVlcObj, "Failed to init cmxs", cmxssdk_error_str(err));
-            msg_Err(mVlcIntF, "Failed to init cmxs: %s", cmxssdk_error_str(err));
-            return false;
-        }
-
-        // Step 2: create a receiver
-        CMXSStreamParam_t streamCfg;
-        memset(&streamCfg, 0, sizeof(CMXSStreamParam_t));
-        streamCfg.mStreamkey = mSettings.at(SETTING_ITEM_KEY).c_str();
-        mReceiver = Receiver::create(&streamCfg, this);
-        if (!mReceiver) {
-            vlc_dialog_display_error(mVlcObj, "Failed to create receiver", cmxssdk_error_str(err));
-            msg_Err(mVlcIntF, "Failed to create receiver: %s", cmxssdk_error_str(err));
-            CMXSSDK::uninit();
+        cfg.dataLen = 0;
+        sscanf(dataLenStr.c_str(), "%zu", &cfg.dataLen);
+        if (!cfg.dataLen) {
+            if (interactive) {
+                vlc_dialog_display_error(obj, "Setting error", "data len must large than 0");
+            }
             return false;
         }
 
-        // now, after CMXSMSG_ServerConnected message received, we can receive data
+        cfg.server = settings.at(SETTING_ITEM_SERVER);
+        cfg.device = settings.at(SETTING_ITEM_DEVICE);
+        cfg.key = settings.at(SETTING_ITEM_KEY);
+        int64_t lingerMs = var_InheritInteger(obj, SETTING_ITEM_SESSION_LINGER);
+        cfg.lingerMs = static_cast<uint32_t>(lingerMs > 0 ? lingerMs : 0);
         return true;
     }
 
-    void stop() {
-        if (mReceiver) {
-            mConnected = false;
-            // destroy receiver
-            Receiver::destroy(mReceiver);
-            mReceiver = nullptr;
+    void logLatency() {
+        if (!mLatency.empty()) {
+            msg_Info(mVlcIntF, "cmxs latency: capture to receive %s", mLatency.take().c_str());
         }
+    }
 
-        // uninit global configs.
-        CMXSSDK::uninit();
+    // Look for the capture times of the sender in the received data.
+    void measureLatency(const uint8_t * data, size_t size) {
+        mLatencyScanner->feed(data, size, [this](uint64_t captureUs) {
+            mLatency.add(static_cast<int64_t>(cmxs_common::wallclockUs() - captureUs));
+        });
+        if (mLatencyLogInterval && mdate() >= mNextLatencyLog) {
+            mNextLatencyLog = mdate() + mLatencyLogInterval;
+            logLatency();
+        }
     }
 
- private:
     static void cmxsLogCb(int level, const char * format, ...) {
         // If you want to make this log works,
         // you should modify VLC code and let vlc_vaLog(nullptr, ...) works.
@@ -307,7 +294,9 @@ class CMXSReceiver : public CMXSListener {
 
     static block_t * block(stream_t *access, bool *eof) {
         CMXSReceiver * me = reinterpret_cast<CMXSReceiver *>(access->p_sys);
-        if (!me->mConnected) {
+        me->mStatsPublisher->update();
+        if (!me->mStream->connected()) {
+            me->mStream->stats().addAgain();
             return 0;
         }
         uint32_t dataLen = static_cast<uint32_t>(me->mDataLen);
@@ -316,9 +305,26 @@ class CMXSReceiver : public CMXSListener {
             return nullptr;
         }
 
-        CMXSErr ret = me->mReceiver->receive(pkt->p_buffer, &dataLen, 0, 100);
+        CMXSErr ret = me->mStream->receive(pkt->p_buffer, &dataLen, 100);
+        if (ret == CMXSERR_BufferNotEnough) {
+            // The datagram is not consumed, e.g. the backlog of a warm stream: grow the block
+            // and take it now, or every block asks for it again.
+            msg_Warn(me->mVlcObj, "data len %zu is too short, use %u", me->mDataLen, dataLen);
+            me->mDataLen = dataLen;
+            pkt = ::block_Realloc(pkt, 0, dataLen);
+            if (!pkt) {
+                return nullptr;
+            }
+            ret = me->mStream->receive(pkt->p_buffer, &dataLen, 100);
+        }
         switch (ret) {
             case CMXSERR_OK:
+                if (me->mCapture) {
+                    me->mCapture->write(pkt->p_buffer, dataLen);
+                }
+                if (me->mLatencyScanner) {
+                    me->measureLatency(pkt->p_buffer, dataLen);
+                }
                 pkt->i_buffer = dataLen;
                 return pkt;
             case CMXSERR_BufferNotEnough:
@@ -377,11 +383,12 @@ class CMXSReceiver : public CMXSListener {
     }
 
     // cmxs://server[[?device=xx[&key=xx][&data_len=xx]]
-    void parseLocation(const char * location) {
+    static void parseLocation(vlc_object_t * obj, const char * location,
+        std::unordered_map<std::string, std::string> & settings) {
         #define SET_SERVER_SETTING(_p) do {\
-            mSettings[SETTING_ITEM_SERVER] = std::string("https://") + _p;\
+            settings[SETTING_ITEM_SERVER] = std::string("https://") + _p;\
         } while (0)
-        msg_Info(mVlcIntF, "url: %s", location);
+        msg_Info(obj, "url: %s", location);
         if (!location || *location == '\0') {
             return;
         }
@@ -441,41 +448,51 @@ class CMXSReceiver : public CMXSListener {
             }
 
             if (*p == '\0') {
-                mSettings[key] = value;
+                settings[key] = value;
                 free(str);
                 return;
             }
             *p = '\0';
             ++p;
-            mSettings[key] = value;
+            settings[key] = value;
         }
         #undef SET_SERVER_SETTING
     }
 
-    bool checkSetting(const char * key) {
-        std::unordered_map<std::string, std::string>::iterator i = mSettings.find(key);
-        if (i != mSettings.end()) {
+    static bool checkSetting(vlc_object_t * obj, std::unordered_map<std::string, std::string> & settings,
+        const char * key) {
+        std::unordered_map<std::string, std::string>::iterator i = settings.find(key);
+        if (i != settings.end()) {
             return true;
         }
 
-        char * moduleValue = var_InheritString(mVlcIntF, key);
+        char * moduleValue = var_InheritString(obj, key);
         if (!moduleValue) {
             return false;
         }
 
-        mSettings[key] = moduleValue;
+        settings[key] = moduleValue;
+        free(moduleValue);
         return true;
     }
 
     vlc_object_t * mVlcObj;
     intf_thread_t * mVlcIntF;
 
-    std::unordered_map<std::string, std::string> mSettings;
     size_t mDataLen;
-    Receiver * mReceiver;
-    std::list<block_t *> mData;
-    bool mConnected;
-    uint8_t mReserved[3];
+    // max parked streams of the warm pool, 0 disables it.
+    size_t mWarmPoolSize;
+    // how long a stream stays parked
+    uint32_t mWarmPoolTtlMs;
+    CMXSStream * mStream;
+    std::unique_ptr<CMXSStatsPublisher> mStatsPublisher;
+    // records the received datagrams when the capture setting is set.
+    std::unique_ptr<cmxs_common::CaptureWriter> mCapture;
+    // set when the latency setting is on.
+    std::unique_ptr<cmxs_common::TsLatencyScanner> mLatencyScanner;
+    cmxs_common::LatencyStats mLatency;
+    mtime_t mLatencyLogInterval;
+    mtime_t mNextLatencyLog;
 };
 
 }  // namespace cmxs_plugin
@@ -523,4 +540,21 @@ add_shortcut("cmxs");
 add_string(CMXSReceiver::SETTING_ITEM_DEVICE, "", "device", "unique device id in your Caton Id.", false)
 add_string(CMXSReceiver::SETTING_ITEM_KEY, "", "key", "cmxs key provided by Caton.", false)
 add_string(CMXSReceiver::SETTING_ITEM_DATA_LEN, "1316", "data length(bytes)", "Data max length in bytes.", false)
+add_integer(CMXSReceiver::SETTING_ITEM_SESSION_LINGER, 5000, "session linger(ms)",
+    "Keep cmxs initialized for this time after the last stream closed, for fast reopen.", true)
+add_integer(CMXSReceiver::SETTING_ITEM_WARM_POOL, 0, "warm pool size",
+    "Keep up to this number of streams connected for fast switching: the closed ones, "
+    "and the previous and next cmxs items of the playlist. 0 disables it.", true)
+add_integer(CMXSReceiver::SETTING_ITEM_WARM_POOL_TTL, 60, "warm pool ttl(s)",
+    "Destroy the streams of the warm pool which are not used for this number of seconds, "
+    "their server and device are released.", true)
+add_integer(CMXSReceiver::SETTING_ITEM_STATS_INTERVAL, 10, "stats log interval(s)",
+    "Log the receive statistics every this number of seconds. 0 disables it, "
+    "the cmxs-* variables of the input are still updated.", true)
+add_string(CMXSReceiver::SETTING_ITEM_CAPTURE, "", "capture file",
+    "Record the received datagrams with their arrival time into this file, for replaying them "
+    "with the mock CMXS SDK. Empty disables it.", true)
+add_bool(CMXSReceiver::SETTING_ITEM_LATENCY, false, "measure latency",
+    "Log the capture to receive latency percentiles every stats log interval, from the capture times "
+    "put into the video by the OBS output. The clocks of both machines must be synchronized.", true)
 vlc_module_end();
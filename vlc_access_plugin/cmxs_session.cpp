@@ -0,0 +1,191 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cmxs_session.h"
+
+#include <string.h>
+#include <new>
+
+#include <vlc_common.h>
+
+namespace cmxs_plugin {
+
+// There is only one CMXSSDK per process, so there is at most one session alive.
+struct CMXSSession::Registry {
+    std::mutex mtx;
+    CMXSSession * session = nullptr;
+    bool lingering = false;
+    mtime_t deadline = 0;
+    // Created by the first linger. vlc_timer_schedule() waits for a running callback, which takes
+    // mtx: it is called under scheduleMtx only, which the callback does not take.
+    std::mutex scheduleMtx;
+    vlc_timer_t lingerTimer;
+    bool hasLingerTimer = false;
+
+    ~Registry() {
+        if (hasLingerTimer) {
+            // waits for a running callback only, there is no thread to join.
+            vlc_timer_destroy(lingerTimer);
+        }
+        std::unique_lock<std::mutex> locker(mtx);
+        if (session && session->mRefs == 0) {
+            uninitLocked(*this);
+        }
+    }
+};
+
+CMXSSession::Registry & CMXSSession::registry() {
+    static Registry sRegistry;
+    return sRegistry;
+}
+
+void CMXSSession::initRegistry() {
+    registry();
+}
+
+CMXSSession::CMXSSession(const std::string & server, const std::string & device)
+    : mServer(server),
+    mDevice(device),
+    mRefs(0),
+    mLingerMs(0) {
+}
+
+CMXSSession * CMXSSession::acquire(const std::string & server,
+    const std::string & device,
+    CMXSListener * listener,
+    uint32_t lingerMs,
+    std::string & error) {
+    Registry & r = registry();
+    std::unique_lock<std::mutex> locker(r.mtx);
+
+    if (r.session && (r.session->mServer != server || r.session->mDevice != device)) {
+        if (r.session->mRefs > 0) {
+            error = "cmxs is in use by server " + r.session->mServer +
+                ", device " + r.session->mDevice;
+            return nullptr;
+        }
+        // Only lingering, nobody uses it. Re-init for the new server and device.
+        uninitLocked(r);
+    }
+
+    if (!r.session) {
+        CMXSSession * session = new (std::nothrow) CMXSSession(server, device);
+        if (!session) {
+            error = cmxssdk_error_str(CMXSERR_NoMem);
+            return nullptr;
+        }
+        CMXSConfig_t cmxsCfg;
+        memset(&cmxsCfg, 0, sizeof(CMXSConfig_t));
+        cmxsCfg.mServer = session->mServer.c_str();
+        cmxsCfg.mDeviceId = session->mDevice.c_str();
+        CMXSErr err = CMXSSDK::init(&cmxsCfg, session);
+        if (err != CMXSERR_OK) {
+            error = cmxssdk_error_str(err);
+            delete session;
+            return nullptr;
+        }
+        r.session = session;
+    }
+
+    r.lingering = false;
+    r.session->mRefs++;
+    r.session->mLingerMs = lingerMs;
+    {
+        std::unique_lock<std::mutex> listenersLocker(r.session->mListenersMtx);
+        r.session->mListeners.push_back(listener);
+    }
+    return r.session;
+}
+
+void CMXSSession::release(CMXSListener * listener) {
+    {
+        std::unique_lock<std::mutex> listenersLocker(mListenersMtx);
+        mListeners.remove(listener);
+    }
+
+    Registry & r = registry();
+    std::unique_lock<std::mutex> locker(r.mtx);
+    if (--mRefs > 0) {
+        return;
+    }
+
+    if (mLingerMs == 0) {
+        uninitLocked(r);
+        return;
+    }
+
+    r.lingering = true;
+    r.deadline = mdate() + static_cast<mtime_t>(mLingerMs) * 1000;
+    locker.unlock();
+    scheduleReap(r);
+}
+
+void CMXSSession::scheduleReap(Registry & r) {
+    std::unique_lock<std::mutex> scheduleLocker(r.scheduleMtx);
+    mtime_t deadline = 0;
+    {
+        std::unique_lock<std::mutex> locker(r.mtx);
+        if (!r.lingering) {
+            // taken again meanwhile.
+            return;
+        }
+        if (!r.hasLingerTimer) {
+            if (vlc_timer_create(&r.lingerTimer, reap, nullptr) != 0) {
+                uninitLocked(r);
+                return;
+            }
+            r.hasLingerTimer = true;
+        }
+        // the latest deadline, a release scheduling after a later one does not shorten it.
+        deadline = r.deadline;
+    }
+    vlc_timer_schedule(r.lingerTimer, true, deadline, 0);
+}
+
+void CMXSSession::reap(void *) {
+    Registry & r = registry();
+    std::unique_lock<std::mutex> locker(r.mtx);
+    if (r.lingering && r.session && r.session->mRefs == 0 && mdate() >= r.deadline) {
+        uninitLocked(r);
+    }
+}
+
+void CMXSSession::uninitLocked(Registry & r) {
+    if (!r.session) {
+        return;
+    }
+    CMXSSDK::uninit();
+    delete r.session;
+    r.session = nullptr;
+    r.lingering = false;
+}
+
+void CMXSSession::onMessage(uint32_t message,
+    uint32_t param1,
+    const void * param2) noexcept {
+    // Global messages are delivered to every input using this session.
+    std::unique_lock<std::mutex> locker(mListenersMtx);
+    for (CMXSListener * listener : mListeners) {
+        listener->onMessage(message, param1, param2);
+    }
+}
+
+}  // namespace cmxs_plugin
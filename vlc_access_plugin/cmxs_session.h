@@ -0,0 +1,98 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * The CMXSSDK global config (CMXSSDK::init/uninit) belongs to the whole process,
+ * but VLC may open several cmxs:// inputs at the same time (mosaic, playlist pre-buffering).
+ * CMXSSession shares one SDK init between all of them and counts the references,
+ * so closing one input does not tear down the others.
+ *
+ * When the last reference is released, the SDK is kept initialized for a short
+ * linger time, so switching to the next stream only creates a new Receiver.
+ * The linger is a VLC timer: no thread of the plugin is left to join when the module is unloaded,
+ * which on Windows runs under the loader lock.
+ */
+
+#ifndef CMXS_SESSION_H
+#define CMXS_SESSION_H
+
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <mutex>
+
+#include <cmxssdk/cmxssdk.h>
+
+namespace cmxs_plugin {
+
+using namespace caton::cmxs;
+
+class CMXSSession : public CMXSListener {
+ public:
+    // Take a reference on the session for server and device.
+    // The SDK is initialized by the first reference.
+    // listener receives the SDK global messages until it is released.
+    // lingerMs is how long the SDK stays initialized after the last release.
+    // Returns nullptr and fills error if it failed.
+    static CMXSSession * acquire(const std::string & server,
+        const std::string & device,
+        CMXSListener * listener,
+        uint32_t lingerMs,
+        std::string & error);
+
+    // Drop the reference taken by acquire(). The session must not be used after this.
+    void release(CMXSListener * listener);
+
+    // Objects holding a session from static storage must call this in their constructor,
+    // so the session registry is destroyed after them.
+    static void initRegistry();
+
+    const std::string & server() const { return mServer; }
+    const std::string & device() const { return mDevice; }
+
+ private:
+    CMXSSession(const std::string & server, const std::string & device);
+    ~CMXSSession() = default;
+
+    void onMessage(uint32_t message,
+        uint32_t param1,
+        const void * param2) noexcept override;
+
+    struct Registry;
+    static Registry & registry();
+    // the linger timer, uninit the session if nobody took it meanwhile.
+    static void reap(void * data);
+    static void scheduleReap(Registry & r);
+    static void uninitLocked(Registry & r);
+
+    const std::string mServer;
+    const std::string mDevice;
+    uint32_t mRefs;
+    uint32_t mLingerMs;
+
+    // protects mListeners, messages may come from the SDK threads.
+    std::mutex mListenersMtx;
+    std::list<CMXSListener *> mListeners;
+};
+
+}  // namespace cmxs_plugin
+
+#endif  // CMXS_SESSION_H
@@ -0,0 +1,201 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cmxs_stats.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+namespace cmxs_plugin {
+
+static const char * const VAR_BYTES_PER_SECOND = "cmxs-bytes-per-second";
+static const char * const VAR_DATAGRAMS_PER_SECOND = "cmxs-datagrams-per-second";
+static const char * const VAR_BYTES = "cmxs-bytes";
+static const char * const VAR_DATAGRAMS = "cmxs-datagrams";
+static const char * const VAR_TIMEOUTS = "cmxs-timeouts";
+static const char * const VAR_AGAIN = "cmxs-again";
+static const char * const VAR_BUFFER_RESIZES = "cmxs-buffer-resizes";
+static const char * const VAR_SERVER_STATE = "cmxs-server-state";
+static const char * const VAR_LINK_STATES = "cmxs-link-states";
+static const char * const VAR_CC_ERRORS = "cmxs-cc-errors";
+static const char * const VAR_LOST_PACKETS = "cmxs-lost-packets";
+static const char * const VAR_CORRUPT_PES = "cmxs-corrupt-pes";
+static const char * const VAR_DISCONTINUITIES = "cmxs-discontinuities";
+static const char * const VAR_PCR_JITTER_MS = "cmxs-pcr-jitter-ms";
+static const char * const VAR_TS_PIDS = "cmxs-ts-pids";
+// the PCR jitter is the max over this window.
+static const mtime_t TS_QUALITY_WINDOW = 10 * CLOCK_FREQ;
+
+static const char * const INTEGER_VARS[] = {
+    VAR_BYTES_PER_SECOND,
+    VAR_DATAGRAMS_PER_SECOND,
+    VAR_BYTES,
+    VAR_DATAGRAMS,
+    VAR_TIMEOUTS,
+    VAR_AGAIN,
+    VAR_BUFFER_RESIZES,
+    VAR_SERVER_STATE,
+    VAR_CC_ERRORS,
+    VAR_LOST_PACKETS,
+    VAR_CORRUPT_PES,
+    VAR_DISCONTINUITIES,
+};
+
+CMXSStats::CMXSStats()
+    : mBytes(0),
+    mDatagrams(0),
+    mTimeouts(0),
+    mAgain(0),
+    mBufferResizes(0),
+    mLastStatSize(0),
+    mServerState(-1),
+    mTsWindowEnd(0),
+    mLastSnapshot(0),
+    mLastBytes(0),
+    mLastDatagrams(0) {
+}
+
+void CMXSStats::setLinkState(const char * device, uint32_t state) {
+    std::unique_lock<std::mutex> locker(mLinksMtx);
+    mLinkStates[device ? device : ""] = state;
+}
+
+CMXSStats::Snapshot CMXSStats::snapshot(mtime_t now) {
+    Snapshot snap;
+    snap.bytes = mBytes;
+    snap.datagrams = mDatagrams;
+    snap.timeouts = mTimeouts;
+    snap.again = mAgain;
+    snap.bufferResizes = mBufferResizes;
+    snap.lastStatSize = mLastStatSize;
+    snap.serverState = mServerState;
+
+    snap.bytesPerSecond = 0;
+    snap.datagramsPerSecond = 0;
+    if (mLastSnapshot && now > mLastSnapshot) {
+        mtime_t elapsed = now - mLastSnapshot;
+        snap.bytesPerSecond = (snap.bytes - mLastBytes) * CLOCK_FREQ / elapsed;
+        snap.datagramsPerSecond = (snap.datagrams - mLastDatagrams) * CLOCK_FREQ / elapsed;
+    }
+    mLastSnapshot = now;
+    mLastBytes = snap.bytes;
+    mLastDatagrams = snap.datagrams;
+
+    std::unique_lock<std::mutex> locker(mLinksMtx);
+    for (const auto & link : mLinkStates) {
+        if (!snap.linkStates.empty()) {
+            snap.linkStates += ",";
+        }
+        snap.linkStates += link.first + ":" + std::to_string(link.second);
+    }
+    locker.unlock();
+
+    std::unique_lock<std::mutex> tsLocker(mTsMtx);
+    if (now >= mTsWindowEnd) {
+        mTsWindowEnd = now + TS_QUALITY_WINDOW;
+        mTsQuality.endWindow();
+    }
+    snap.ts = mTsQuality.total();
+    for (const cmxs_common::TsPidQuality & q : mTsQuality.pids()) {
+        char pid[96];
+        snprintf(pid, sizeof(pid), "%s%u:%" PRIu64 "/%" PRIu64 "/%" PRIu64 "/%.1f", snap.tsPids.empty() ? "" : ",",
+            q.pid, q.ccErrors, q.lostPackets, q.corruptPes, q.pcrJitterUs / 1000.0);
+        snap.tsPids += pid;
+    }
+    return snap;
+}
+
+CMXSStatsPublisher::CMXSStatsPublisher(vlc_object_t * obj, CMXSStats & stats, const std::string & key,
+    int64_t logIntervalSeconds)
+    : mObj(obj),
+    mStats(stats),
+    mKey(key),
+    mLogInterval(logIntervalSeconds > 0 ? logIntervalSeconds * CLOCK_FREQ : 0),
+    mNextPublish(0),
+    mNextLog(0) {
+    for (const char * name : INTEGER_VARS) {
+        var_Create(mObj, name, VLC_VAR_INTEGER);
+    }
+    var_Create(mObj, VAR_LINK_STATES, VLC_VAR_STRING);
+    var_Create(mObj, VAR_PCR_JITTER_MS, VLC_VAR_FLOAT);
+    var_Create(mObj, VAR_TS_PIDS, VLC_VAR_STRING);
+    // The stream may come from the warm pool, the rates start from now.
+    mStats.snapshot(mdate());
+}
+
+CMXSStatsPublisher::~CMXSStatsPublisher() {
+    for (const char * name : INTEGER_VARS) {
+        var_Destroy(mObj, name);
+    }
+    var_Destroy(mObj, VAR_LINK_STATES);
+    var_Destroy(mObj, VAR_PCR_JITTER_MS);
+    var_Destroy(mObj, VAR_TS_PIDS);
+}
+
+void CMXSStatsPublisher::update() {
+    mtime_t now = mdate();
+    if (now < mNextPublish) {
+        return;
+    }
+    mNextPublish = now + CLOCK_FREQ;
+
+    CMXSStats::Snapshot snap = mStats.snapshot(now);
+    var_SetInteger(mObj, VAR_BYTES_PER_SECOND, static_cast<int64_t>(snap.bytesPerSecond));
+    var_SetInteger(mObj, VAR_DATAGRAMS_PER_SECOND, static_cast<int64_t>(snap.datagramsPerSecond));
+    var_SetInteger(mObj, VAR_BYTES, static_cast<int64_t>(snap.bytes));
+    var_SetInteger(mObj, VAR_DATAGRAMS, static_cast<int64_t>(snap.datagrams));
+    var_SetInteger(mObj, VAR_TIMEOUTS, static_cast<int64_t>(snap.timeouts));
+    var_SetInteger(mObj, VAR_AGAIN, static_cast<int64_t>(snap.again));
+    var_SetInteger(mObj, VAR_BUFFER_RESIZES, static_cast<int64_t>(snap.bufferResizes));
+    var_SetInteger(mObj, VAR_SERVER_STATE, snap.serverState);
+    var_SetString(mObj, VAR_LINK_STATES, snap.linkStates.c_str());
+    var_SetInteger(mObj, VAR_CC_ERRORS, static_cast<int64_t>(snap.ts.ccErrors));
+    var_SetInteger(mObj, VAR_LOST_PACKETS, static_cast<int64_t>(snap.ts.lostPackets));
+    var_SetInteger(mObj, VAR_CORRUPT_PES, static_cast<int64_t>(snap.ts.corruptPes));
+    var_SetInteger(mObj, VAR_DISCONTINUITIES, static_cast<int64_t>(snap.ts.discontinuities));
+    var_SetFloat(mObj, VAR_PCR_JITTER_MS, static_cast<float>(snap.ts.pcrJitterUs / 1000.0));
+    var_SetString(mObj, VAR_TS_PIDS, snap.tsPids.c_str());
+
+    if (!mLogInterval || now < mNextLog) {
+        return;
+    }
+    if (!mNextLog) {
+        // the first rates are not meaningful yet.
+        mNextLog = now + mLogInterval;
+        return;
+    }
+    mNextLog = now + mLogInterval;
+    // one line, key=value, easy to parse.
+    msg_Info(mObj, "cmxs stats: key=%s bytes_per_second=%" PRIu64 " datagrams_per_second=%" PRIu64
+        " bytes=%" PRIu64 " datagrams=%" PRIu64 " timeouts=%" PRIu64 " again=%" PRIu64
+        " buffer_resizes=%" PRIu64 " last_stat_size=%u server_state=%" PRId64 " links=%s"
+        " cc_errors=%" PRIu64 " lost_packets=%" PRIu64 " duplicates=%" PRIu64 " transport_errors=%" PRIu64
+        " discontinuities=%" PRIu64 " pcr_jumps=%" PRIu64 " corrupt_pes=%" PRIu64 " pcr_jitter_ms=%.1f ts_pids=%s",
+        mKey.c_str(), snap.bytesPerSecond, snap.datagramsPerSecond,
+        snap.bytes, snap.datagrams, snap.timeouts, snap.again,
+        snap.bufferResizes, snap.lastStatSize, snap.serverState,
+        snap.linkStates.empty() ? "-" : snap.linkStates.c_str(),
+        snap.ts.ccErrors, snap.ts.lostPackets, snap.ts.duplicates, snap.ts.transportErrors,
+        snap.ts.discontinuities, snap.ts.pcrJumps, snap.ts.corruptPes, snap.ts.pcrJitterUs / 1000.0,
+        snap.tsPids.empty() ? "-" : snap.tsPids.c_str());
+}
+
+}  // namespace cmxs_plugin
@@ -0,0 +1,140 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Receive counters of one cmxs input.
+ * They are updated by the receive path and the listener messages,
+ * and published as VLC object variables (see CMXSStatsPublisher) so they can be graphed:
+ *
+ *   cmxs-bytes-per-second, cmxs-datagrams-per-second   rates over the last publish period
+ *   cmxs-bytes, cmxs-datagrams                         totals
+ *   cmxs-timeouts        receive() returned Again after waiting the full timeout
+ *   cmxs-again           receive() returned Again at once, e.g. not connected yet
+ *   cmxs-buffer-resizes  receive() needed a larger buffer (BufferNotEnough)
+ *   cmxs-server-state    last CMXSMSG_DataServerState
+ *   cmxs-link-states     last CMXSMSG_DataServerLinkState per device, "dev:state,..."
+ *   cmxs-cc-errors, cmxs-lost-packets    TS continuity counter errors, and the TS packets they lost
+ *   cmxs-corrupt-pes     PES units with lost or erroneous TS packets
+ *   cmxs-discontinuities TS discontinuity indicators
+ *   cmxs-pcr-jitter-ms   max PCR arrival jitter of the last 10s window (float)
+ *   cmxs-ts-pids         the same per PID, "pid:cc_errors/lost/corrupt_pes/jitter_ms,..."
+ */
+
+#ifndef CMXS_STATS_H
+#define CMXS_STATS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <vlc_common.h>
+
+#include "cmxs_ts_quality.h"
+
+namespace cmxs_plugin {
+
+class CMXSStats {
+ public:
+    struct Snapshot {
+        uint64_t bytes;
+        uint64_t datagrams;
+        uint64_t bytesPerSecond;
+        uint64_t datagramsPerSecond;
+        uint64_t timeouts;
+        uint64_t again;
+        uint64_t bufferResizes;
+        uint32_t lastStatSize;
+        int64_t serverState;
+        std::string linkStates;
+        // all the PIDs, and each one
+        cmxs_common::TsPidQuality ts;
+        std::string tsPids;
+    };
+
+    CMXSStats();
+
+    void addDatagram(uint32_t size) {
+        mBytes += size;
+        mDatagrams++;
+    }
+    void addTimeout() { mTimeouts++; }
+    void addAgain() { mAgain++; }
+    void addBufferResize() { mBufferResizes++; }
+    void setReceiveStat(uint32_t lastSize) { mLastStatSize = lastSize; }
+    void setServerState(uint32_t state) { mServerState = state; }
+    void setLinkState(const char * device, uint32_t state);
+    // The TS packets of a datagram received at arrival (mdate()), before any buffering.
+    void addTsDatagram(const uint8_t * data, size_t size, mtime_t arrival) {
+        std::unique_lock<std::mutex> locker(mTsMtx);
+        mTsQuality.addDatagram(data, size, arrival);
+    }
+
+    // Totals, and rates since the previous snapshot.
+    Snapshot snapshot(mtime_t now);
+
+ private:
+    std::atomic<uint64_t> mBytes;
+    std::atomic<uint64_t> mDatagrams;
+    std::atomic<uint64_t> mTimeouts;
+    std::atomic<uint64_t> mAgain;
+    std::atomic<uint64_t> mBufferResizes;
+    std::atomic<uint32_t> mLastStatSize;
+    std::atomic<int64_t> mServerState;
+
+    // link states come from the SDK threads.
+    std::mutex mLinksMtx;
+    std::map<std::string, uint32_t> mLinkStates;
+
+    // the TS comes from the warm thread, then from the input thread.
+    std::mutex mTsMtx;
+    cmxs_common::TsQuality mTsQuality;
+    mtime_t mTsWindowEnd;
+
+    // only used by snapshot()
+    mtime_t mLastSnapshot;
+    uint64_t mLastBytes;
+    uint64_t mLastDatagrams;
+};
+
+// Publishes the stats of an input as variables of its VLC object,
+// and logs them as one line every log interval.
+class CMXSStatsPublisher {
+ public:
+    CMXSStatsPublisher(vlc_object_t * obj, CMXSStats & stats, const std::string & key, int64_t logIntervalSeconds);
+    ~CMXSStatsPublisher();
+
+    // Called from the receive path, it only does the work once per second.
+    void update();
+
+ private:
+    vlc_object_t * mObj;
+    CMXSStats & mStats;
+    const std::string mKey;
+    mtime_t mLogInterval;
+    mtime_t mNextPublish;
+    mtime_t mNextLog;
+};
+
+}  // namespace cmxs_plugin
+
+#endif  // CMXS_STATS_H
@@ -0,0 +1,354 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cmxs_stream.h"
+
+#include <string.h>
+#include <chrono>
+#include <new>
+
+#include "cmxs_session.h"
+
+namespace cmxs_plugin {
+
+CMXSStream::CMXSStream(const CMXSStreamConfig & cfg)
+    : mCfg(cfg),
+    mLogObj(nullptr),
+    mSession(nullptr),
+    mReceiver(nullptr),
+    mConnected(false),
+    mWarm(false),
+    mBacklogBytes(0),
+    mBacklogHasKeyframe(false) {
+}
+
+CMXSStream::~CMXSStream() {
+    stopWarm();
+    if (mReceiver) {
+        mConnected = false;
+        Receiver::destroy(mReceiver);
+        mReceiver = nullptr;
+    }
+    if (mSession) {
+        mSession->release(this);
+        mSession = nullptr;
+    }
+}
+
+CMXSStream * CMXSStream::create(vlc_object_t * logObj, const CMXSStreamConfig & cfg, std::string & error) {
+    CMXSStream * stream = new (std::nothrow) CMXSStream(cfg);
+    if (!stream) {
+        error = cmxssdk_error_str(CMXSERR_NoMem);
+        return nullptr;
+    }
+    stream->mLogObj = logObj;
+
+    // Step 1: init the global configs.
+    // The SDK is shared with the other cmxs streams of this process, see CMXSSession.
+    stream->mSession = CMXSSession::acquire(cfg.server, cfg.device, stream, cfg.lingerMs, error);
+    if (!stream->mSession) {
+        delete stream;
+        return nullptr;
+    }
+
+    // Step 2: create a receiver
+    CMXSStreamParam_t streamCfg;
+    memset(&streamCfg, 0, sizeof(CMXSStreamParam_t));
+    streamCfg.mStreamkey = stream->mCfg.key.c_str();
+    stream->mReceiver = Receiver::create(&streamCfg, stream);
+    if (!stream->mReceiver) {
+        error = "Failed to create receiver";
+        delete stream;
+        return nullptr;
+    }
+
+    // now, after CMXSMSG_ServerConnected message received, we can receive data
+    return stream;
+}
+
+void CMXSStream::destroy(CMXSStream * stream) {
+    delete stream;
+}
+
+CMXSErr CMXSStream::receive(uint8_t * buf, uint32_t * len, int32_t timeoutMs) {
+    if (!mBacklog.empty()) {
+        const std::vector<uint8_t> & data = mBacklog.front();
+        if (data.size() > *len) {
+            *len = static_cast<uint32_t>(data.size());
+            mStats.addBufferResize();
+            return CMXSERR_BufferNotEnough;
+        }
+        memcpy(buf, data.data(), data.size());
+        *len = static_cast<uint32_t>(data.size());
+        mBacklogBytes -= data.size();
+        mBacklog.pop_front();
+        mStats.addDatagram(*len);
+        return CMXSERR_OK;
+    }
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    CMXSErr err = mReceiver->receive(buf, len, 0, timeoutMs);
+    switch (err) {
+        case CMXSERR_OK:
+            mStats.addDatagram(*len);
+            mStats.addTsDatagram(buf, *len, mdate());
+            break;
+        case CMXSERR_BufferNotEnough:
+            mStats.addBufferResize();
+            break;
+        case CMXSERR_Again:
+            // Again before the timeout means the receiver is not ready, not that data is late.
+            if (std::chrono::steady_clock::now() - begin >= std::chrono::milliseconds(timeoutMs)) {
+                mStats.addTimeout();
+            } else {
+                mStats.addAgain();
+            }
+            break;
+        default:
+            break;
+    }
+    return err;
+}
+
+void CMXSStream::startWarm() {
+    if (mWarm) {
+        return;
+    }
+    mBacklog.clear();
+    mBacklogBytes = 0;
+    mBacklogHasKeyframe = false;
+    mPsi.clear();
+    mTs.reset();
+    mWarm = true;
+    mWarmThread = std::thread(&CMXSStream::warmLoop, this);
+}
+
+void CMXSStream::stopWarm() {
+    if (!mWarm) {
+        return;
+    }
+    mWarm = false;
+    if (mWarmThread.joinable()) {
+        mWarmThread.join();
+    }
+
+    if (!mBacklogHasKeyframe) {
+        // Nothing useful, the input starts as a cold one.
+        mBacklog.clear();
+        mBacklogBytes = 0;
+        return;
+    }
+    // The demuxer needs the PAT and PMT before the buffered IDR.
+    std::vector<uint8_t> psi;
+    std::map<uint16_t, std::vector<uint8_t>>::const_iterator pat = mPsi.find(cmxs_common::kTsPidPat);
+    if (pat != mPsi.end()) {
+        psi.insert(psi.end(), pat->second.begin(), pat->second.end());
+    }
+    for (const auto & entry : mPsi) {
+        if (entry.first != cmxs_common::kTsPidPat) {
+            psi.insert(psi.end(), entry.second.begin(), entry.second.end());
+        }
+    }
+    if (!psi.empty()) {
+        mBacklogBytes += psi.size();
+        mBacklog.push_front(std::move(psi));
+    }
+    std::unique_lock<std::mutex> locker(mLogMtx);
+    msg_Dbg(mLogObj, "warm stream %s: %zu bytes buffered from the last IDR", mCfg.key.c_str(), mBacklogBytes);
+}
+
+void CMXSStream::warmLoop() {
+    std::vector<uint8_t> buf(mCfg.dataLen);
+    while (mWarm) {
+        if (!mConnected) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            continue;
+        }
+        uint32_t size = static_cast<uint32_t>(buf.size());
+        CMXSErr err = mReceiver->receive(buf.data(), &size, 0, 100);
+        switch (err) {
+            case CMXSERR_OK:
+                // the backlog is not accounted again when receive() returns it.
+                mStats.addTsDatagram(buf.data(), size, mdate());
+                bufferDatagram(buf.data(), size);
+                break;
+            case CMXSERR_BufferNotEnough:
+                buf.resize(size);
+                break;
+            case CMXSERR_Again:
+                break;
+            default:
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                break;
+        }
+    }
+}
+
+void CMXSStream::bufferDatagram(const uint8_t * data, size_t size) {
+    using namespace cmxs_common;
+    bool keyframe = false;
+    if (size % kTsPacketSize == 0) {
+        for (size_t offset = 0; offset < size; offset += kTsPacketSize) {
+            TsPacket pkt;
+            if (!parseTsPacket(data + offset, pkt)) {
+                break;
+            }
+            mTs.feed(pkt);
+            if (mTs.isPsi(pkt.pid)) {
+                if (pkt.pusi) {
+                    mPsi[pkt.pid].assign(data + offset, data + offset + kTsPacketSize);
+                }
+            } else if (pkt.pid == mTs.videoPid() && tsPacketStartsKeyframe(pkt, mTs.videoCodec())) {
+                keyframe = true;
+            }
+        }
+    }
+
+    if (keyframe) {
+        mBacklog.clear();
+        mBacklogBytes = 0;
+        mBacklogHasKeyframe = true;
+    }
+    mBacklog.emplace_back(data, data + size);
+    mBacklogBytes += size;
+    while (mBacklogBytes > WARM_BUFFER_MAX && mBacklog.size() > 1) {
+        mBacklogBytes -= mBacklog.front().size();
+        mBacklog.pop_front();
+        mBacklogHasKeyframe = false;
+    }
+}
+
+void CMXSStream::onMessage(uint32_t message,
+    uint32_t param1,
+    const void * param2) noexcept {
+    std::unique_lock<std::mutex> locker(mLogMtx);
+    vlc_object_t * obj = mLogObj;
+    switch (message) {
+        case CMXSMSG_ServerConnected:
+            {
+                msg_Info(obj, "server connect success.\n");
+                mConnected = true;
+            }
+            break;
+        case CMXSMSG_ServerConnectFailed:
+            {
+                const CMXSServerConnectFailedMsgData_t * data =
+                    reinterpret_cast<const CMXSServerConnectFailedMsgData_t *>(param2);
+                msg_Err(obj, "connect failed: %s.\n", data->mErrorInfo);
+            }
+            break;
+        case CMXSMSG_DataReady:
+            {
+                msg_Info(obj, "Data ready\n");
+            }
+            break;
+        case CMXSMSG_DataServerState:
+            {
+                const CMXSDataServerStateMsgData_t * data =
+                    reinterpret_cast<const CMXSDataServerStateMsgData_t *>(param2);
+                msg_Info(obj, "data server state: %u\n", data->mDataServerConnectState);
+                mStats.setServerState(data->mDataServerConnectState);
+            }
+            break;
+        case CMXSMSG_DataServerLinkState:
+            {
+                const CMXSDataServerLinkStateMsgData_t * data =
+                    reinterpret_cast<const CMXSDataServerLinkStateMsgData_t *>(param2);
+                msg_Info(obj, "CMXS data server link state: device: %s, state: %u\n",
+                    data->mNetDevice, data->mDataServerConnectState);
+                mStats.setLinkState(data->mNetDevice, data->mDataServerConnectState);
+            }
+            break;
+        case CMXSMSG_Stat:
+            {
+                if (param1) {
+                    // for receiver, cannot go here
+                    break;
+                }
+                const CMXSReceiveStatMsgData_t * data =
+                    reinterpret_cast<const CMXSReceiveStatMsgData_t *>(param2);
+                msg_Info(obj, "receive stat: mLastSize: %u\n", data->mLastSize);
+                mStats.setReceiveStat(data->mLastSize);
+            }
+            break;
+        case CMXSMSG_StreamParamChanged:
+            {
+                const CMXSStreamParamChangedMsgData_t * data =
+                    reinterpret_cast<const CMXSStreamParamChangedMsgData_t *>(param2);
+                msg_Info(obj, "stream param changed from platform: %s, should re-create the stream\n",
+                    data->mDesc);
+            }
+            break;
+        case CMXSMSG_ConnectProgress:
+            {
+                const CMXSConnectProgressMsgData_t * data =
+                    reinterpret_cast<const CMXSConnectProgressMsgData_t *>(param2);
+                msg_Info(obj, "CMXS progress: %s\n", data->mDescription);
+            }
+            break;
+        case CMXSMSG_ERROR:
+            {
+                switch (param1) {
+                    case CMXSERR_DataPortDetectFailed:
+                        {
+                            const CMXSDataPortDetectFailedMsgData_t * data =
+                                reinterpret_cast<const CMXSDataPortDetectFailedMsgData_t *>(param2);
+                            for (uint32_t i = 0; i < data->mPortsCount; ++i) {
+                                msg_Err(obj, "data port detect failed, expect port: %u\n", data->mPorts[i]);
+                            }
+                        }
+                        break;
+                    case CMXSERR_NoMem:
+                        {
+                            msg_Err(obj, "NoMem\n");
+                        }
+                        break;
+                    case CMXSERR_ServiceUnavailable:
+                        {
+                            const CMXSUnAvailableMsgData_t * data =
+                                reinterpret_cast<const CMXSUnAvailableMsgData_t *>(param2);
+                            msg_Err(obj, "service unavailable: %s\n", data->mErrorInfo);
+                        }
+                        break;
+                    default:
+                        msg_Err(obj, "error: %d(%s)\n", param1, cmxssdk_error_str(param1));
+                        break;
+                }
+            }
+            break;
+        case CMXSMSG_WARNING:
+            {
+                switch (param1) {
+                    case CMXSERR_NotReceiveDataInTime:
+                        msg_Err(obj, "warning: NotReceiveDataInTime\n");
+                        break;
+                    default:
+                        msg_Err(obj, "warning: %d(%s)\n", param1, cmxssdk_error_str(param1));
+                        break;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+}  // namespace cmxs_plugin
@@ -0,0 +1,130 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * CMXSStream is one CMXS Receiver and its listener.
+ * It is used by a cmxs:// input, or kept connected in the warm pool (see cmxs_warm_pool.h).
+ * While it is warm, a thread keeps receiving and buffers the data from the last IDR,
+ * so the next input using it gets a picture at once.
+ */
+
+#ifndef CMXS_STREAM_H
+#define CMXS_STREAM_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <vlc_common.h>
+
+#include <cmxssdk/cmxssdk.h>
+
+#include "cmxs_ts.h"
+#include "cmxs_stats.h"
+
+namespace cmxs_plugin {
+
+using namespace caton::cmxs;
+
+class CMXSSession;
+
+struct CMXSStreamConfig {
+    std::string server;
+    std::string device;
+    std::string key;
+    size_t dataLen;
+    uint32_t lingerMs;
+
+    // Streams with the same id can be shared by the warm pool.
+    std::string id() const {
+        return server + "|" + device + "|" + key;
+    }
+};
+
+class CMXSStream : public CMXSListener {
+ public:
+    // Create the receiver. logObj is used for the messages of this stream.
+    // Returns nullptr and fills error if failed.
+    static CMXSStream * create(vlc_object_t * logObj, const CMXSStreamConfig & cfg, std::string & error);
+    static void destroy(CMXSStream * stream);
+
+    const CMXSStreamConfig & config() const { return mCfg; }
+    bool connected() const { return mConnected; }
+    // Counters of the receive path and the listener messages.
+    CMXSStats & stats() { return mStats; }
+
+    // Change the object used for the messages, e.g. when moved into or out of the warm pool.
+    // A message of the SDK being logged is done on return, the old object can be freed.
+    void setLogObject(vlc_object_t * logObj) {
+        std::unique_lock<std::mutex> locker(mLogMtx);
+        mLogObj = logObj;
+    }
+
+    // Same as Receiver::receive, buffered data of the warm period is returned first.
+    CMXSErr receive(uint8_t * buf, uint32_t * len, int32_t timeoutMs);
+
+    // Keep receiving in background and buffer the stream from the last IDR.
+    void startWarm();
+    // Stop the background receiving, the buffered data is kept for receive().
+    void stopWarm();
+
+ private:
+    explicit CMXSStream(const CMXSStreamConfig & cfg);
+    ~CMXSStream();
+
+    void onMessage(uint32_t message,
+        uint32_t param1,
+        const void * param2) noexcept override;
+
+    void warmLoop();
+    void bufferDatagram(const uint8_t * data, size_t size);
+
+    // Max bytes buffered while warm, older data is dropped.
+    static constexpr size_t WARM_BUFFER_MAX = 16 * 1024 * 1024;
+
+    const CMXSStreamConfig mCfg;
+    // held while logging through mLogObj, the input owning it may be closing.
+    std::mutex mLogMtx;
+    vlc_object_t * mLogObj;
+    CMXSSession * mSession;
+    Receiver * mReceiver;
+    std::atomic<bool> mConnected;
+    CMXSStats mStats;
+
+    std::thread mWarmThread;
+    std::atomic<bool> mWarm;
+    // mBacklog is written by the warm thread, and read by receive() once it is stopped.
+    std::deque<std::vector<uint8_t>> mBacklog;
+    size_t mBacklogBytes;
+    bool mBacklogHasKeyframe;
+    cmxs_common::TsProgramTracker mTs;
+    // Last PAT and PMT packets, sent before the backlog.
+    std::map<uint16_t, std::vector<uint8_t>> mPsi;
+};
+
+}  // namespace cmxs_plugin
+
+#endif  // CMXS_STREAM_H
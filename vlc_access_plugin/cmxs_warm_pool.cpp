@@ -0,0 +1,260 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cmxs_warm_pool.h"
+
+#include <string.h>
+#include <vector>
+
+#include <vlc_interface.h>
+#include <vlc_playlist.h>
+#include <vlc_input_item.h>
+
+#include "cmxs_session.h"
+
+namespace cmxs_plugin {
+
+static const char CMXS_URI_PREFIX[] = "cmxs://";
+
+// Locations of the cmxs items just before and after the playing one.
+static std::vector<std::string> neighbourLocations(vlc_object_t * libvlc) {
+    std::vector<std::string> locations;
+    playlist_t * playlist = pl_Get(reinterpret_cast<intf_thread_t *>(libvlc));
+    if (!playlist) {
+        return locations;
+    }
+
+    std::vector<input_item_t *> items;
+    playlist_Lock(playlist);
+    playlist_item_t * playing = playlist_CurrentPlayingItem(playlist);
+    for (int i = 0; playing && i < playlist->current.i_size; ++i) {
+        if (playlist->current.p_elems[i] != playing) {
+            continue;
+        }
+        if (i > 0) {
+            items.push_back(input_item_Hold(playlist->current.p_elems[i - 1]->p_input));
+        }
+        if (i + 1 < playlist->current.i_size) {
+            items.push_back(input_item_Hold(playlist->current.p_elems[i + 1]->p_input));
+        }
+        break;
+    }
+    playlist_Unlock(playlist);
+
+    for (input_item_t * item : items) {
+        char * uri = input_item_GetURI(item);
+        if (uri && strncmp(uri, CMXS_URI_PREFIX, sizeof(CMXS_URI_PREFIX) - 1) == 0) {
+            locations.push_back(uri + sizeof(CMXS_URI_PREFIX) - 1);
+        }
+        free(uri);
+        input_item_Release(item);
+    }
+    return locations;
+}
+
+CMXSWarmPool & CMXSWarmPool::instance() {
+    static CMXSWarmPool sPool;
+    return sPool;
+}
+
+CMXSWarmPool::CMXSWarmPool() : mQuit(false) {
+    // parked streams hold sessions until our destructor.
+    CMXSSession::initRegistry();
+    mWorker = std::thread(&CMXSWarmPool::worker, this);
+}
+
+CMXSWarmPool::~CMXSWarmPool() {
+    {
+        std::unique_lock<std::mutex> locker(mMtx);
+        mQuit = true;
+    }
+    mJobsCond.notify_all();
+    if (mWorker.joinable()) {
+        mWorker.join();
+    }
+    for (const Parked & parked : mParked) {
+        CMXSStream::destroy(parked.stream);
+    }
+    mParked.clear();
+}
+
+CMXSStream * CMXSWarmPool::take(const CMXSStreamConfig & cfg, vlc_object_t * logObj) {
+    CMXSStream * stream = nullptr;
+    {
+        std::unique_lock<std::mutex> locker(mMtx);
+        const std::string id = cfg.id();
+        for (std::list<Parked>::iterator i = mParked.begin(); i != mParked.end(); ++i) {
+            if (i->stream->config().id() == id && i->stream->config().dataLen == cfg.dataLen) {
+                stream = i->stream;
+                mParked.erase(i);
+                break;
+            }
+        }
+    }
+    if (!stream) {
+        return nullptr;
+    }
+    stream->stopWarm();
+    stream->setLogObject(logObj);
+    msg_Info(logObj, "use warm stream %s", cfg.key.c_str());
+    return stream;
+}
+
+void CMXSWarmPool::park(CMXSStream * stream, vlc_object_t * libvlc, size_t capacity, uint32_t ttlMs) {
+    stream->setLogObject(libvlc);
+    stream->startWarm();
+
+    std::list<CMXSStream *> evicted;
+    {
+        std::unique_lock<std::mutex> locker(mMtx);
+        const std::string id = stream->config().id();
+        for (std::list<Parked>::iterator i = mParked.begin(); i != mParked.end();) {
+            if (i->stream->config().id() == id) {
+                evicted.push_back(i->stream);
+                i = mParked.erase(i);
+            } else {
+                ++i;
+            }
+        }
+        mParked.push_front(Parked{stream, std::chrono::steady_clock::now() + std::chrono::milliseconds(ttlMs)});
+        trim(capacity, evicted);
+    }
+    // the worker waits for the new expiry.
+    mJobsCond.notify_one();
+    // Receiver::destroy may block, do not hold the lock.
+    for (CMXSStream * old : evicted) {
+        CMXSStream::destroy(old);
+    }
+}
+
+void CMXSWarmPool::prewarmNeighbours(vlc_object_t * libvlc, const CMXSStreamConfig & current,
+    size_t capacity, uint32_t ttlMs, LocationParser parser) {
+    const std::string currentId = current.id();
+    post([this, libvlc, currentId, capacity, ttlMs, parser]() {
+        std::vector<std::string> locations = neighbourLocations(libvlc);
+        for (const std::string & location : locations) {
+            CMXSStreamConfig cfg;
+            if (!parser(libvlc, location.c_str(), cfg) || cfg.id() == currentId || isParked(cfg.id())) {
+                continue;
+            }
+            std::string error;
+            CMXSStream * stream = CMXSStream::create(libvlc, cfg, error);
+            if (!stream) {
+                msg_Warn(libvlc, "failed to pre-connect %s: %s", cfg.key.c_str(), error.c_str());
+                continue;
+            }
+            msg_Info(libvlc, "pre-connect %s", cfg.key.c_str());
+            park(stream, libvlc, capacity, ttlMs);
+        }
+    });
+}
+
+void CMXSWarmPool::dropOtherSessions(const CMXSStreamConfig & cfg) {
+    std::list<CMXSStream *> evicted;
+    {
+        std::unique_lock<std::mutex> locker(mMtx);
+        for (std::list<Parked>::iterator i = mParked.begin(); i != mParked.end();) {
+            if (i->stream->config().server != cfg.server || i->stream->config().device != cfg.device) {
+                evicted.push_back(i->stream);
+                i = mParked.erase(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+    // the last one releases the session.
+    for (CMXSStream * old : evicted) {
+        CMXSStream::destroy(old);
+    }
+}
+
+void CMXSWarmPool::post(std::function<void()> job) {
+    {
+        std::unique_lock<std::mutex> locker(mMtx);
+        mJobs.push_back(std::move(job));
+    }
+    mJobsCond.notify_one();
+}
+
+void CMXSWarmPool::worker() {
+    std::unique_lock<std::mutex> locker(mMtx);
+    while (!mQuit) {
+        std::list<CMXSStream *> expired;
+        expire(expired);
+        if (!expired.empty()) {
+            // Receiver::destroy may block, do not hold the lock.
+            locker.unlock();
+            for (CMXSStream * old : expired) {
+                CMXSStream::destroy(old);
+            }
+            locker.lock();
+            continue;
+        }
+        if (mJobs.empty()) {
+            if (mParked.empty()) {
+                mJobsCond.wait(locker);
+            } else {
+                std::chrono::steady_clock::time_point next = mParked.front().expiry;
+                for (const Parked & parked : mParked) {
+                    next = std::min(next, parked.expiry);
+                }
+                mJobsCond.wait_until(locker, next);
+            }
+            continue;
+        }
+        std::function<void()> job = std::move(mJobs.front());
+        mJobs.pop_front();
+        locker.unlock();
+        job();
+        locker.lock();
+    }
+}
+
+void CMXSWarmPool::trim(size_t capacity, std::list<CMXSStream *> & evicted) {
+    while (mParked.size() > capacity) {
+        evicted.push_back(mParked.back().stream);
+        mParked.pop_back();
+    }
+}
+
+void CMXSWarmPool::expire(std::list<CMXSStream *> & evicted) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (std::list<Parked>::iterator i = mParked.begin(); i != mParked.end();) {
+        if (i->expiry <= now) {
+            evicted.push_back(i->stream);
+            i = mParked.erase(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+bool CMXSWarmPool::isParked(const std::string & id) {
+    std::unique_lock<std::mutex> locker(mMtx);
+    for (const Parked & parked : mParked) {
+        if (parked.stream->config().id() == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace cmxs_plugin
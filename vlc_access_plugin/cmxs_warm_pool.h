@@ -0,0 +1,100 @@
+/*
+ * Copyright(c) 2023, Caton Technology.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * The warm pool keeps CMXS streams connected while no input uses them:
+ * the stream of a closed input, and the streams of the previous and next playlist items.
+ * Opening one of them takes it from the pool and shows picture from the buffered IDR,
+ * without waiting for the connection.
+ * A parked stream holds its session (server and device): it is destroyed after its ttl, or
+ * when another server or device is opened.
+ */
+
+#ifndef CMXS_WARM_POOL_H
+#define CMXS_WARM_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <vlc_common.h>
+
+#include "cmxs_stream.h"
+
+namespace cmxs_plugin {
+
+class CMXSWarmPool {
+ public:
+    // Parse a cmxs location (the url without "cmxs://") into a stream config.
+    typedef std::function<bool(vlc_object_t *, const char *, CMXSStreamConfig &)> LocationParser;
+
+    static CMXSWarmPool & instance();
+
+    // Take the parked stream for cfg, nullptr if there is none.
+    // The stream stops its background receiving, and logs to logObj.
+    CMXSStream * take(const CMXSStreamConfig & cfg, vlc_object_t * logObj);
+
+    // Park a stream closed by its input for ttlMs. capacity is the max number of parked streams,
+    // the least recently used ones are destroyed.
+    void park(CMXSStream * stream, vlc_object_t * libvlc, size_t capacity, uint32_t ttlMs);
+
+    // Pre-connect the cmxs streams of the previous and next playlist items, in background.
+    void prewarmNeighbours(vlc_object_t * libvlc, const CMXSStreamConfig & current,
+        size_t capacity, uint32_t ttlMs, LocationParser parser);
+
+    // Destroy the parked streams of another server or device than cfg: the SDK has one session
+    // per process, and they would keep the old one.
+    void dropOtherSessions(const CMXSStreamConfig & cfg);
+
+ private:
+    CMXSWarmPool();
+    ~CMXSWarmPool();
+
+    struct Parked {
+        CMXSStream * stream;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    void post(std::function<void()> job);
+    void worker();
+    // mMtx is held.
+    void trim(size_t capacity, std::list<CMXSStream *> & evicted);
+    void expire(std::list<CMXSStream *> & evicted);
+    bool isParked(const std::string & id);
+
+    std::mutex mMtx;
+    // Most recently parked first.
+    std::list<Parked> mParked;
+
+    std::condition_variable mJobsCond;
+    std::deque<std::function<void()>> mJobs;
+    std::thread mWorker;
+    bool mQuit;
+};
+
+}  // namespace cmxs_plugin
+
+#endif  // CMXS_WARM_POOL_H